@@ -267,6 +267,45 @@ static void at_gprs_deactivate_primary(struct ofono_gprs_context *gc,
 	g_at_ppp_shutdown(gcd->ppp);
 }
 
+static void at_gprs_get_stats(struct ofono_gprs_context *gc,
+				unsigned int cid,
+				ofono_gprs_context_stats_cb_t cb, void *data)
+{
+	struct gprs_context_data *gcd = ofono_gprs_context_get_data(gc);
+	struct ofono_gprs_context_stats stats;
+	GAtPPPStats ppp;
+
+	DBG("cid %u", cid);
+
+	if (gcd->state != STATE_ACTIVE || gcd->ppp == NULL ||
+			g_at_ppp_get_stats(gcd->ppp, &ppp) == FALSE) {
+		CALLBACK_WITH_FAILURE(cb, NULL, data);
+		return;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+
+	stats.tx_packets = ppp.tx_ip_packets;
+	stats.tx_bytes = ppp.tx_ip_bytes;
+	stats.tx_wire_bytes = ppp.hdlc.tx_wire_bytes;
+	stats.tx_dropped = ppp.hdlc.tx_overruns;
+
+	if (ppp.hdlc.tx_queue_samples > 0)
+		stats.tx_queue_delay = ppp.hdlc.tx_queue_delay_total /
+						ppp.hdlc.tx_queue_samples;
+
+	stats.tx_queue_delay_max = ppp.hdlc.tx_queue_delay_max;
+
+	stats.rx_packets = ppp.rx_ip_packets;
+	stats.rx_bytes = ppp.rx_ip_bytes;
+	stats.rx_wire_bytes = ppp.hdlc.rx_wire_bytes;
+	stats.rx_errors = ppp.rx_discarded + ppp.hdlc.rx_fcs_errors +
+				ppp.hdlc.rx_short_frames +
+				ppp.hdlc.rx_overruns;
+
+	CALLBACK_WITH_SUCCESS(cb, &stats, data);
+}
+
 static int at_gprs_context_probe(struct ofono_gprs_context *gc,
 					unsigned int vendor, void *data)
 {
@@ -315,6 +354,7 @@ static struct ofono_gprs_context_driver driver = {
 	.remove			= at_gprs_context_remove,
 	.activate_primary	= at_gprs_activate_primary,
 	.deactivate_primary	= at_gprs_deactivate_primary,
+	.get_stats		= at_gprs_get_stats,
 };
 
 void at_gprs_context_init(void)
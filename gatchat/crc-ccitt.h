@@ -26,8 +26,11 @@
 #include <glib.h>
 
 extern guint16 const crc_ccitt_table[256];
+extern guint16 const crc_ccitt_slice_table[7][256];
 
 static inline guint16 crc_ccitt_byte(guint16 crc, const guint8 c)
 {
 	return (crc >> 8) ^ crc_ccitt_table[(crc ^ c) & 0xff];
 }
+
+guint16 crc_ccitt(guint16 crc, const guint8 *buffer, gsize len);
@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -38,6 +39,12 @@
 
 /* #define WRITE_SCHEDULER_DEBUG 1 */
 
+#define LINE_ARENA_BLOCK_SIZE 1024
+#define LINE_ARENA_MAX_SIZE 65536
+
+/* Upper bound of commands written ahead of the final response */
+#define PIPELINE_MAX_DEPTH 8
+
 struct at_chat;
 static void chat_wakeup_writer(struct at_chat *chat);
 
@@ -53,6 +60,7 @@ struct at_command {
 	GAtNotifyFunc listing;
 	gpointer user_data;
 	GDestroyNotify notify;
+	gdouble sent_at;
 };
 
 struct at_notify_node {
@@ -72,6 +80,31 @@ struct at_notify {
 	gboolean pdu;
 };
 
+/* Prefix trie over the registered notification prefixes */
+struct at_prefix_node {
+	char c;					/* Character on the edge */
+	struct at_notify *notify;		/* Registration ending here */
+	struct at_prefix_node *child;		/* First child */
+	struct at_prefix_node *next;		/* Next sibling */
+};
+
+/*
+ * Response lines are carved out of a per-chat arena instead of being
+ * allocated one by one.  The arena is rewound once no response, final or
+ * PDU line is outstanding anymore, so a whole listing costs no allocation
+ * at all once the arena has grown to the size of the response.
+ */
+struct line_block {
+	struct line_block *next;		/* Older block */
+	gsize size;				/* Usable bytes in block */
+	gsize used;				/* Bytes handed out */
+};
+
+struct line_arena {
+	struct line_block *blocks;		/* Current block first */
+	gsize block_size;			/* Size of the next block */
+};
+
 struct at_chat {
 	gint ref_count;				/* Ref count */
 	guint next_cmd_id;			/* Next command id */
@@ -81,6 +114,7 @@ struct at_chat {
 	GQueue *command_queue;			/* Command queue */
 	guint cmd_bytes_written;		/* bytes written from cmd */
 	GHashTable *notify_list;		/* List of notification reg */
+	struct at_prefix_node notify_trie;	/* Index of notify_list */
 	GAtDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
 	guint read_so_far;			/* Number of bytes processed */
@@ -89,6 +123,7 @@ struct at_chat {
 	gpointer debug_data;			/* Data to pass to debug func */
 	char *pdu_notify;			/* Unsolicited Resp w/ PDU */
 	GSList *response_lines;			/* char * lines of the response */
+	struct line_arena arena;		/* Storage of response lines */
 	char *wakeup;				/* command sent to wakeup modem */
 	gint timeout_source;
 	gdouble inactivity_time;		/* Period of inactivity */
@@ -98,7 +133,15 @@ struct at_chat {
 	gboolean destroyed;			/* Re-entrancy guard */
 	gboolean in_read_handler;		/* Re-entrancy guard */
 	gboolean in_notify;
+	gboolean notify_marked;			/* Nodes pending removal */
 	GSList *terminator_list;		/* Non-standard terminator */
+	char **pipeline_cmds;			/* Commands allowed to pipeline */
+	guint pipeline_depth;			/* Max commands in flight */
+	guint pipeline_sent;			/* Commands in flight after head */
+	guint pipeline_bytes_written;		/* bytes written from next cmd */
+	GTimer *pipeline_timer;			/* Time base for sent_at */
+	guint pipeline_count;			/* Commands written ahead */
+	gdouble pipeline_saved;			/* Seconds they were ahead */
 };
 
 struct _GAtChat {
@@ -114,6 +157,64 @@ struct terminator_info {
 	gboolean success;
 };
 
+static char *line_arena_alloc(struct line_arena *arena, gsize len)
+{
+	struct line_block *block = arena->blocks;
+	char *data;
+
+	if (block == NULL || block->size - block->used < len) {
+		gsize size = MAX(arena->block_size, len);
+
+		block = g_try_malloc(sizeof(struct line_block) + size);
+		if (block == NULL)
+			return NULL;
+
+		block->next = arena->blocks;
+		block->size = size;
+		block->used = 0;
+		arena->blocks = block;
+	}
+
+	data = (char *) (block + 1) + block->used;
+	block->used += len;
+
+	return data;
+}
+
+static void line_arena_free(struct line_arena *arena)
+{
+	struct line_block *block;
+
+	while ((block = arena->blocks)) {
+		arena->blocks = block->next;
+		g_free(block);
+	}
+}
+
+static void line_arena_reset(struct line_arena *arena)
+{
+	struct line_block *block = arena->blocks;
+	gsize total = 0;
+
+	if (block == NULL)
+		return;
+
+	if (block->next == NULL) {
+		block->used = 0;
+		return;
+	}
+
+	/*
+	 * The last response did not fit into a single block, size the
+	 * next one so that a response of the same size will
+	 */
+	for (; block; block = block->next)
+		total += block->size;
+
+	line_arena_free(arena);
+	arena->block_size = MIN(total, LINE_ARENA_MAX_SIZE);
+}
+
 static gboolean node_is_destroyed(struct at_notify_node *node, gpointer user)
 {
 	return node->destroyed;
@@ -151,6 +252,92 @@ static void at_notify_destroy(gpointer user_data)
 	g_free(notify);
 }
 
+static struct at_prefix_node *prefix_node_child(struct at_prefix_node *node,
+							char c)
+{
+	struct at_prefix_node *child;
+
+	for (child = node->child; child; child = child->next)
+		if (child->c == c)
+			return child;
+
+	return NULL;
+}
+
+static void prefix_trie_remove(struct at_prefix_node *parent,
+				const char *prefix)
+{
+	struct at_prefix_node **link = &parent->child;
+	struct at_prefix_node *node;
+
+	/* The empty prefix is registered on the root itself */
+	if (*prefix == '\0') {
+		parent->notify = NULL;
+		return;
+	}
+
+	while (*link && (*link)->c != *prefix)
+		link = &(*link)->next;
+
+	node = *link;
+	if (node == NULL)
+		return;
+
+	if (prefix[1] == '\0')
+		node->notify = NULL;
+	else
+		prefix_trie_remove(node, prefix + 1);
+
+	/* Prune branches which no longer lead to a registration */
+	if (node->notify == NULL && node->child == NULL) {
+		*link = node->next;
+		g_free(node);
+	}
+}
+
+static gboolean prefix_trie_insert(struct at_prefix_node *root,
+					const char *prefix,
+					struct at_notify *notify)
+{
+	struct at_prefix_node *node = root;
+	struct at_prefix_node *child;
+	const char *p;
+
+	for (p = prefix; *p; p++) {
+		child = prefix_node_child(node, *p);
+
+		if (child == NULL) {
+			child = g_try_new0(struct at_prefix_node, 1);
+			if (child == NULL) {
+				prefix_trie_remove(root, prefix);
+				return FALSE;
+			}
+
+			child->c = *p;
+			child->next = node->child;
+			node->child = child;
+		}
+
+		node = child;
+	}
+
+	node->notify = notify;
+
+	return TRUE;
+}
+
+static void prefix_trie_free(struct at_prefix_node *node)
+{
+	struct at_prefix_node *next;
+
+	while (node) {
+		next = node->next;
+		prefix_trie_free(node->child);
+		g_free(node);
+		node = next;
+	}
+}
+
 static gint at_command_compare_by_id(gconstpointer a, gconstpointer b)
 {
 	const struct at_command *command = a;
@@ -200,6 +387,7 @@ static gboolean at_chat_unregister_all(struct at_chat *chat,
 
 			if (mark_only) {
 				node->destroyed = TRUE;
+				chat->notify_marked = TRUE;
 				p = c;
 				c = c->next;
 				continue;
@@ -217,13 +405,25 @@ static gboolean at_chat_unregister_all(struct at_chat *chat,
 			g_slist_free_1(t);
 		}
 
-		if (notify->nodes == NULL)
+		if (notify->nodes == NULL) {
+			prefix_trie_remove(&chat->notify_trie, key);
 			g_hash_table_iter_remove(&iter);
+		}
 	}
 
 	return TRUE;
 }
 
+static void at_chat_sweep_notify(struct at_chat *chat)
+{
+	/* Only walk the registrations if a callback unregistered any */
+	if (chat->notify_marked == FALSE)
+		return;
+
+	chat->notify_marked = FALSE;
+	at_chat_unregister_all(chat, FALSE, node_is_destroyed, NULL);
+}
+
 static struct at_command *at_command_create(guint gid, const char *cmd,
 						const char **prefix_list,
 						gboolean expect_pdu,
@@ -320,7 +520,6 @@ static void chat_cleanup(struct at_chat *chat)
 	chat->command_queue = NULL;
 
 	/* Cleanup any response lines we have pending */
-	g_slist_foreach(chat->response_lines, (GFunc)g_free, NULL);
 	g_slist_free(chat->response_lines);
 	chat->response_lines = NULL;
 
@@ -328,10 +527,12 @@ static void chat_cleanup(struct at_chat *chat)
 	g_hash_table_destroy(chat->notify_list);
 	chat->notify_list = NULL;
 
-	if (chat->pdu_notify) {
-		g_free(chat->pdu_notify);
-		chat->pdu_notify = NULL;
-	}
+	prefix_trie_free(chat->notify_trie.child);
+	chat->notify_trie.child = NULL;
+	chat->notify_trie.notify = NULL;
+
+	chat->pdu_notify = NULL;
+	line_arena_free(&chat->arena);
 
 	if (chat->wakeup) {
 		g_free(chat->wakeup);
@@ -351,6 +552,14 @@ static void chat_cleanup(struct at_chat *chat)
 	g_at_syntax_unref(chat->syntax);
 	chat->syntax = NULL;
 
+	g_strfreev(chat->pipeline_cmds);
+	chat->pipeline_cmds = NULL;
+
+	if (chat->pipeline_timer) {
+		g_timer_destroy(chat->pipeline_timer);
+		chat->pipeline_timer = NULL;
+	}
+
 	if (chat->terminator_list) {
 		g_slist_foreach(chat->terminator_list,
 					(GFunc)free_terminator, NULL);
@@ -381,25 +590,23 @@ static void at_notify_call_callback(gpointer data, gpointer user_data)
 
 static gboolean at_chat_match_notify(struct at_chat *chat, char *line)
 {
-	GHashTableIter iter;
+	struct at_prefix_node *node = &chat->notify_trie;
 	struct at_notify *notify;
-	gpointer key, value;
-	gboolean ret = FALSE;
+	GSList *matches = NULL;
+	GSList *l;
 	GAtResult result;
+	const char *p;
 
-	g_hash_table_iter_init(&iter, chat->notify_list);
-	result.lines = 0;
-	result.final_or_pdu = 0;
-
-	chat->in_notify = TRUE;
-
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		notify = value;
-
-		if (!g_str_has_prefix(line, key))
-			continue;
+	/*
+	 * Walk the prefix trie along the line, every node carrying a
+	 * registration on the way is a prefix of the line.  The root
+	 * holds the empty prefix, which matches any line.
+	 */
+	for (p = line; node; node = prefix_node_child(node, *p++)) {
+		notify = node->notify;
 
-		if (notify->pdu) {
+		if (notify && notify->pdu) {
+			g_slist_free(matches);
 			chat->pdu_notify = line;
 
 			if (chat->syntax->set_hint)
@@ -408,24 +615,35 @@ static gboolean at_chat_match_notify(struct at_chat *chat, char *line)
 			return TRUE;
 		}
 
-		if (result.lines == NULL)
-			result.lines = g_slist_prepend(NULL, line);
+		if (notify)
+			matches = g_slist_prepend(matches, notify);
+
+		if (*p == '\0')
+			break;
+	}
+
+	if (matches == NULL)
+		return FALSE;
+
+	result.lines = g_slist_prepend(NULL, line);
+	result.final_or_pdu = 0;
+
+	chat->in_notify = TRUE;
 
+	for (l = matches; l; l = l->next) {
+		notify = l->data;
 		g_slist_foreach(notify->nodes, at_notify_call_callback,
 					&result);
-		ret = TRUE;
 	}
 
 	chat->in_notify = FALSE;
 
-	if (ret) {
-		g_slist_free(result.lines);
-		g_free(line);
+	g_slist_free(matches);
+	g_slist_free(result.lines);
 
-		at_chat_unregister_all(chat, FALSE, node_is_destroyed, NULL);
-	}
+	at_chat_sweep_notify(chat);
 
-	return ret;
+	return TRUE;
 }
 
 static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
@@ -439,6 +657,19 @@ static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
 
 	p->cmd_bytes_written = 0;
 
+	/* The next command might already be on its way to the modem */
+	if (p->pipeline_sent > 0) {
+		struct at_command *next = g_queue_peek_head(p->command_queue);
+
+		p->pipeline_sent -= 1;
+		p->cmd_bytes_written = strlen(next->cmd);
+		p->pipeline_saved += g_timer_elapsed(p->pipeline_timer, NULL) -
+					next->sent_at;
+	} else {
+		p->cmd_bytes_written = p->pipeline_bytes_written;
+		p->pipeline_bytes_written = 0;
+	}
+
 	if (g_queue_peek_head(p->command_queue))
 		chat_wakeup_writer(p);
 
@@ -456,10 +687,8 @@ static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
 		cmd->callback(ok, &result, cmd->user_data);
 	}
 
-	g_slist_foreach(response_lines, (GFunc)g_free, NULL);
 	g_slist_free(response_lines);
 
-	g_free(final);
 	at_command_destroy(cmd);
 }
 
@@ -555,7 +784,6 @@ out:
 		cmd->listing(&result, cmd->user_data);
 
 		g_slist_free(result.lines);
-		g_free(line);
 	} else
 		p->response_lines = g_slist_prepend(p->response_lines, line);
 
@@ -572,7 +800,7 @@ static void have_line(struct at_chat *p, char *str)
 
 	/* Check for echo, this should not happen, but lets be paranoid */
 	if (!strncmp(str, "AT", 2) == TRUE)
-		goto done;
+		return;
 
 	cmd = g_queue_peek_head(p->command_queue);
 
@@ -592,44 +820,33 @@ static void have_line(struct at_chat *p, char *str)
 			return;
 	}
 
-	if (at_chat_match_notify(p, str) == TRUE)
-		return;
-
-done:
 	/* No matches & no commands active, ignore line */
-	g_free(str);
+	at_chat_match_notify(p, str);
 }
 
 static void have_notify_pdu(struct at_chat *p, char *pdu, GAtResult *result)
 {
-	GHashTableIter iter;
-	struct at_notify *notify;
-	char *prefix;
-	gpointer key, value;
+	struct at_prefix_node *node = &p->notify_trie;
+	const char *c;
 	gboolean called = FALSE;
 
 	p->in_notify = TRUE;
 
-	g_hash_table_iter_init(&iter, p->notify_list);
-
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		prefix = key;
-		notify = value;
-
-		if (!g_str_has_prefix(p->pdu_notify, prefix))
-			continue;
-
-		if (!notify->pdu)
-			continue;
+	for (c = p->pdu_notify; node; node = prefix_node_child(node, *c++)) {
+		if (node->notify && node->notify->pdu) {
+			g_slist_foreach(node->notify->nodes,
+					at_notify_call_callback, result);
+			called = TRUE;
+		}
 
-		g_slist_foreach(notify->nodes, at_notify_call_callback, result);
-		called = TRUE;
+		if (*c == '\0')
+			break;
 	}
 
 	p->in_notify = FALSE;
 
 	if (called)
-		at_chat_unregister_all(p, FALSE, node_is_destroyed, NULL);
+		at_chat_sweep_notify(p);
 }
 
 static void have_pdu(struct at_chat *p, char *pdu)
@@ -665,11 +882,7 @@ static void have_pdu(struct at_chat *p, char *pdu)
 	g_slist_free(result.lines);
 
 error:
-	g_free(p->pdu_notify);
 	p->pdu_notify = NULL;
-
-	if (pdu)
-		g_free(pdu);
 }
 
 static char *extract_line(struct at_chat *p, struct ring_buffer *rbuf)
@@ -682,6 +895,24 @@ static char *extract_line(struct at_chat *p, struct ring_buffer *rbuf)
 	int line_length = 0;
 	char *line;
 
+	/* The syntax already found the end of the line, skip the rescan */
+	if (p->syntax->line_end >= 0 &&
+			p->syntax->line_end < (gssize) p->read_so_far) {
+		while (pos < (guint) p->syntax->line_end &&
+				(*buf == '\r' || *buf == '\n')) {
+			buf += 1;
+			pos += 1;
+
+			if (pos == wrap)
+				buf = ring_buffer_read_ptr(rbuf, pos);
+		}
+
+		strip_front = pos;
+		line_length = p->syntax->line_end - pos;
+		p->syntax->line_end = -1;
+		goto out;
+	}
+
 	while (pos < p->read_so_far) {
 		if (in_string == FALSE && (*buf == '\r' || *buf == '\n')) {
 			if (!line_length)
@@ -702,7 +933,8 @@ static char *extract_line(struct at_chat *p, struct ring_buffer *rbuf)
 			buf = ring_buffer_read_ptr(rbuf, pos);
 	}
 
-	line = g_try_new(char, line_length + 1);
+out:
+	line = line_arena_alloc(&p->arena, line_length + 1);
 	if (line == NULL) {
 		ring_buffer_drain(rbuf, p->read_so_far);
 		return NULL;
@@ -763,6 +995,10 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 			break;
 		}
 
+		/* Rewind the arena once nothing refers to its lines */
+		if (p->response_lines == NULL && p->pdu_notify == NULL)
+			line_arena_reset(&p->arena);
+
 		len -= p->read_so_far;
 		wrap -= p->read_so_far;
 		p->read_so_far = 0;
@@ -813,6 +1049,93 @@ static gboolean wakeup_no_response(gpointer user_data)
 	return TRUE;
 }
 
+static gboolean pipeline_allowed(struct at_chat *chat,
+					struct at_command *cmd)
+{
+	const char *cr = strchr(cmd->cmd, '\r');
+	int i;
+
+	/* Commands expecting a prompt have to wait for their turn */
+	if (cr == NULL || cr[1] != '\0')
+		return FALSE;
+
+	if (g_ascii_strncasecmp(cmd->cmd, "AT", 2))
+		return FALSE;
+
+	for (i = 0; chat->pipeline_cmds[i]; i++)
+		if (g_str_has_prefix(cmd->cmd + 2, chat->pipeline_cmds[i]))
+			return TRUE;
+
+	return FALSE;
+}
+
+/*
+ * Write commands following the head of the queue before the head has been
+ * answered.  This is only done as long as every command in flight has been
+ * marked as safe to pipeline, since the modem answers them strictly in
+ * order and the responses are attributed to the head of the queue.
+ */
+static gboolean pipeline_write(struct at_chat *chat)
+{
+	struct iovec iov[PIPELINE_MAX_DEPTH];
+	struct at_command *cmd;
+	gsize bytes_written;
+	guint first = chat->pipeline_sent + 1;
+	guint count = 0;
+	gdouble now;
+	guint i;
+
+	if (chat->pipeline_depth < 2)
+		return FALSE;
+
+	for (i = 0; i < first; i++)
+		if (!pipeline_allowed(chat,
+				g_queue_peek_nth(chat->command_queue, i)))
+			return FALSE;
+
+	while (first + count < chat->pipeline_depth) {
+		cmd = g_queue_peek_nth(chat->command_queue, first + count);
+		if (cmd == NULL || !pipeline_allowed(chat, cmd))
+			break;
+
+		iov[count].iov_base = cmd->cmd;
+		iov[count].iov_len = strlen(cmd->cmd);
+		count += 1;
+	}
+
+	if (count == 0)
+		return FALSE;
+
+	iov[0].iov_base = (char *) iov[0].iov_base +
+					chat->pipeline_bytes_written;
+	iov[0].iov_len -= chat->pipeline_bytes_written;
+
+	bytes_written = g_at_io_writev(chat->io, iov, count);
+
+	if (bytes_written == 0)
+		return FALSE;
+
+	now = g_timer_elapsed(chat->pipeline_timer, NULL);
+
+	for (i = 0; i < count; i++) {
+		if (bytes_written < iov[i].iov_len) {
+			chat->pipeline_bytes_written += bytes_written;
+			return TRUE;
+		}
+
+		bytes_written -= iov[i].iov_len;
+
+		cmd = g_queue_peek_nth(chat->command_queue, first + i);
+		cmd->sent_at = now;
+
+		chat->pipeline_bytes_written = 0;
+		chat->pipeline_sent += 1;
+		chat->pipeline_count += 1;
+	}
+
+	return FALSE;
+}
+
 static gboolean can_write_data(gpointer data)
 {
 	struct at_chat *chat = data;
@@ -834,12 +1157,11 @@ static gboolean can_write_data(gpointer data)
 
 	len = strlen(cmd->cmd);
 
-	/* For some reason write watcher fired, but we've already
-	 * written the entire command out to the io channel,
-	 * cancel write watcher
+	/* The entire command has already been written out to the io
+	 * channel, see if any of the following ones can be sent ahead
 	 */
 	if (chat->cmd_bytes_written >= len)
-		return FALSE;
+		return pipeline_write(chat);
 
 	if (chat->wakeup) {
 		if (chat->wakeup_timer == NULL) {
@@ -893,7 +1215,10 @@ static gboolean can_write_data(gpointer data)
 	if (chat->wakeup_timer)
 		g_timer_start(chat->wakeup_timer);
 
-	return FALSE;
+	if (chat->cmd_bytes_written < len)
+		return FALSE;
+
+	return pipeline_write(chat);
 }
 
 static void chat_wakeup_writer(struct at_chat *chat)
@@ -988,6 +1313,28 @@ static gboolean at_chat_set_wakeup_command(struct at_chat *chat,
 	return TRUE;
 }
 
+static gboolean at_chat_set_pipeline(struct at_chat *chat, guint depth,
+					const char **commands)
+{
+	g_strfreev(chat->pipeline_cmds);
+	chat->pipeline_cmds = NULL;
+	chat->pipeline_depth = 0;
+
+	if (depth < 2 || commands == NULL)
+		return TRUE;
+
+	if (chat->pipeline_timer == NULL)
+		chat->pipeline_timer = g_timer_new();
+
+	chat->pipeline_cmds = g_strdupv((char **) commands);
+	chat->pipeline_depth = MIN(depth, PIPELINE_MAX_DEPTH);
+
+	if (g_queue_get_length(chat->command_queue) > 1)
+		chat_wakeup_writer(chat);
+
+	return TRUE;
+}
+
 static guint at_chat_send_common(struct at_chat *chat, guint gid,
 					const char *cmd,
 					const char **prefix_list,
@@ -1011,7 +1358,8 @@ static guint at_chat_send_common(struct at_chat *chat, guint gid,
 
 	g_queue_push_tail(chat->command_queue, c);
 
-	if (g_queue_get_length(chat->command_queue) == 1)
+	if (g_queue_get_length(chat->command_queue) == 1 ||
+			chat->pipeline_depth > 1)
 		chat_wakeup_writer(chat);
 
 	return c->id;
@@ -1038,9 +1386,26 @@ static struct at_notify *at_notify_create(struct at_chat *chat,
 
 	g_hash_table_insert(chat->notify_list, key, notify);
 
+	if (prefix_trie_insert(&chat->notify_trie, key, notify) == FALSE) {
+		g_hash_table_remove(chat->notify_list, key);
+		return 0;
+	}
+
 	return notify;
 }
 
+/* Whether the n-th command in the queue has been (partially) written */
+static gboolean at_chat_cmd_in_flight(struct at_chat *chat, guint n)
+{
+	if (n == 0)
+		return chat->cmd_bytes_written > 0;
+
+	if (n <= chat->pipeline_sent)
+		return TRUE;
+
+	return n == chat->pipeline_sent + 1 && chat->pipeline_bytes_written > 0;
+}
+
 static gboolean at_chat_cancel(struct at_chat *chat, guint group, guint id)
 {
 	GList *l;
@@ -1060,8 +1425,8 @@ static gboolean at_chat_cancel(struct at_chat *chat, guint group, guint id)
 	if (c->gid != group)
 		return FALSE;
 
-	if (c == g_queue_peek_head(chat->command_queue) &&
-			chat->cmd_bytes_written > 0) {
+	if (at_chat_cmd_in_flight(chat,
+				g_queue_index(chat->command_queue, c))) {
 		/* We can't actually remove it since it is most likely
 		 * already in progress, just null out the callback
 		 * so it won't be called
@@ -1089,7 +1454,7 @@ static gboolean at_chat_cancel_group(struct at_chat *chat, guint group)
 			continue;
 		}
 
-		if (n == 0 && chat->cmd_bytes_written > 0) {
+		if (at_chat_cmd_in_flight(chat, n)) {
 			c->callback = NULL;
 			n += 1;
 			continue;
@@ -1172,14 +1537,17 @@ static gboolean at_chat_unregister(struct at_chat *chat, gboolean mark_only,
 
 		if (mark_only) {
 			node->destroyed = TRUE;
+			chat->notify_marked = TRUE;
 			return TRUE;
 		}
 
 		at_notify_node_destroy(node, NULL);
 		notify->nodes = g_slist_remove(notify->nodes, node);
 
-		if (notify->nodes == NULL)
+		if (notify->nodes == NULL) {
+			prefix_trie_remove(&chat->notify_trie, key);
 			g_hash_table_iter_remove(&iter);
+		}
 
 		return TRUE;
 	}
@@ -1198,12 +1566,11 @@ static gboolean node_compare_by_group(struct at_notify_node *node,
 	return FALSE;
 }
 
-static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
-					GAtSyntax *syntax)
+static struct at_chat *create_chat(GAtIO *io, GAtSyntax *syntax)
 {
 	struct at_chat *chat;
 
-	if (channel == NULL)
+	if (io == NULL)
 		return NULL;
 
 	if (syntax == NULL)
@@ -1217,14 +1584,9 @@ static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
 	chat->next_cmd_id = 1;
 	chat->next_notify_id = 1;
 	chat->debugf = NULL;
+	chat->arena.block_size = LINE_ARENA_BLOCK_SIZE;
 
-	if (flags & G_IO_FLAG_NONBLOCK)
-		chat->io = g_at_io_new(channel);
-	else
-		chat->io = g_at_io_new_blocking(channel);
-
-	if (chat->io == NULL)
-		goto error;
+	chat->io = g_at_io_ref(io);
 
 	g_at_io_set_disconnect_function(chat->io, io_disconnect, chat);
 
@@ -1242,6 +1604,8 @@ static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
 	return chat;
 
 error:
+	/* The IO may live on with whoever created it */
+	g_at_io_set_disconnect_function(chat->io, NULL, NULL);
 	g_at_io_unref(chat->io);
 
 	if (chat->command_queue)
@@ -1254,8 +1618,7 @@ error:
 	return NULL;
 }
 
-static GAtChat *g_at_chat_new_common(GIOChannel *channel, GIOFlags flags,
-					GAtSyntax *syntax)
+GAtChat *g_at_chat_new_from_io(GAtIO *io, GAtSyntax *syntax)
 {
 	GAtChat *chat;
 
@@ -1263,7 +1626,7 @@ static GAtChat *g_at_chat_new_common(GIOChannel *channel, GIOFlags flags,
 	if (chat == NULL)
 		return NULL;
 
-	chat->parent = create_chat(channel, flags, syntax);
+	chat->parent = create_chat(io, syntax);
 	if (chat->parent == NULL) {
 		g_free(chat);
 		return NULL;
@@ -1275,6 +1638,26 @@ static GAtChat *g_at_chat_new_common(GIOChannel *channel, GIOFlags flags,
 	return chat;
 }
 
+static GAtChat *g_at_chat_new_common(GIOChannel *channel, GIOFlags flags,
+					GAtSyntax *syntax)
+{
+	GAtChat *chat;
+	GAtIO *io;
+
+	if (flags & G_IO_FLAG_NONBLOCK)
+		io = g_at_io_new(channel);
+	else
+		io = g_at_io_new_blocking(channel);
+
+	if (io == NULL)
+		return NULL;
+
+	chat = g_at_chat_new_from_io(io, syntax);
+	g_at_io_unref(io);
+
+	return chat;
+}
+
 GAtChat *g_at_chat_new(GIOChannel *channel, GAtSyntax *syntax)
 {
 	return g_at_chat_new_common(channel, G_IO_FLAG_NONBLOCK, syntax);
@@ -1433,6 +1816,26 @@ gboolean g_at_chat_set_wakeup_command(GAtChat *chat, const char *cmd,
 	return at_chat_set_wakeup_command(chat->parent, cmd, timeout, msec);
 }
 
+gboolean g_at_chat_set_pipeline(GAtChat *chat, guint depth,
+					const char **commands)
+{
+	if (chat == NULL || chat->group != 0)
+		return FALSE;
+
+	return at_chat_set_pipeline(chat->parent, depth, commands);
+}
+
+guint g_at_chat_get_pipeline_stats(GAtChat *chat, gdouble *saved)
+{
+	if (chat == NULL)
+		return 0;
+
+	if (saved)
+		*saved = chat->parent->pipeline_saved;
+
+	return chat->parent->pipeline_count;
+}
+
 guint g_at_chat_send(GAtChat *chat, const char *cmd,
 			const char **prefix_list, GAtResultFunc func,
 			gpointer user_data, GDestroyNotify notify)
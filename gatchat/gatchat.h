@@ -42,6 +42,13 @@ typedef void (*GAtNotifyFunc)(GAtResult *result, gpointer user_data);
 GAtChat *g_at_chat_new(GIOChannel *channel, GAtSyntax *syntax);
 GAtChat *g_at_chat_new_blocking(GIOChannel *channel, GAtSyntax *syntax);
 
+/*
+ * Creates a chat on top of an existing IO, e.g. one from g_at_io_new_threaded
+ * to have the device read on a thread of its own.  The chat takes a reference
+ * and installs its own read and disconnect handlers.
+ */
+GAtChat *g_at_chat_new_from_io(GAtIO *io, GAtSyntax *syntax);
+
 GIOChannel *g_at_chat_get_channel(GAtChat *chat);
 GAtIO *g_at_chat_get_io(GAtChat *chat);
 
@@ -140,6 +147,25 @@ gboolean g_at_chat_set_wakeup_command(GAtChat *chat, const char *cmd,
 void g_at_chat_add_terminator(GAtChat *chat, char *terminator,
 				int len, gboolean success);
 
+/*!
+ * Allow up to depth commands to be written to the modem before the final
+ * response to the first one has been received.  Only commands starting
+ * with one of the entries of the NULL terminated commands array (given
+ * without the leading "AT", e.g. "+CGMI") are written ahead of time, and
+ * only while every command in flight is such a command.  The modem must
+ * answer pipelined commands in order.  A depth below 2 turns pipelining
+ * off, which is the default.
+ */
+gboolean g_at_chat_set_pipeline(GAtChat *chat, guint depth,
+					const char **commands);
+
+/*!
+ * Returns the number of commands written ahead of time.  If saved is not
+ * NULL, it is set to the total time in seconds those commands were in
+ * flight before the preceding command completed.
+ */
+guint g_at_chat_get_pipeline_stats(GAtChat *chat, gdouble *saved);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <glib.h>
 
@@ -38,6 +40,7 @@
 #include "gathdlc.h"
 
 #define BUFFER_SIZE 2048
+#define DECODE_BUFFER_SIZE (BUFFER_SIZE * 2)
 
 #define HDLC_FLAG	0x7e	/* Flag sequence */
 #define HDLC_ESCAPE	0x7d	/* Asynchronous control escape */
@@ -56,7 +59,8 @@ struct _GAtHDLC {
 	guint decode_offset;
 	guint16 decode_fcs;
 	gboolean decode_escape;
-	guint32 xmit_accm[8];
+	guint32 xmit_accm;
+	guint8 xmit_escape[256];
 	guint32 recv_accm;
 	GAtReceiveFunc receive_func;
 	gpointer receive_data;
@@ -65,8 +69,20 @@ struct _GAtHDLC {
 	int record_fd;
 	gboolean in_read_handler;
 	gboolean destroyed;
+	guint64 queued_since;
+	GAtHDLCStats stats;
 };
 
+/* Monotonic clock in microseconds, for the queueing delay statistics */
+static guint64 hdlc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (guint64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static void hdlc_record(int fd, gboolean in, guint8 *data, guint16 length)
 {
 	guint16 len = htons(length);
@@ -127,57 +143,152 @@ guint32 g_at_hdlc_get_recv_accm(GAtHDLC *hdlc)
 	return hdlc->recv_accm;
 }
 
-static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
+#define ONES	0x0101010101010101ULL
+#define HIGHS	0x8080808080808080ULL
+#define HAS_ZERO_BYTE(v) (((v) - ONES) & ~(v) & HIGHS)
+#define HAS_BYTE_BELOW(v, n) (((v) - ONES * (n)) & ~(v) & HIGHS)
+
+/*
+ * Length of the run at the start of buf that contains no flag, no escape
+ * and, if filter_ctrl is set, no control character.  Scans a word at a time
+ * where possible; control characters are reported conservatively and
+ * filtered against the ACCM by the byte decoder.
+ */
+static unsigned int clean_run(const unsigned char *buf, unsigned int len,
+				gboolean filter_ctrl)
 {
-	GAtHDLC *hdlc = user_data;
-	unsigned int len = ring_buffer_len(rbuf);
-	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
-	unsigned char *buf = ring_buffer_read_ptr(rbuf, 0);
 	unsigned int pos = 0;
+	guint64 v;
 
-	hdlc_record(hdlc->record_fd, TRUE, buf, wrap);
+	while (pos + sizeof(v) <= len) {
+		memcpy(&v, buf + pos, sizeof(v));
 
-	hdlc->in_read_handler = TRUE;
+		if (HAS_ZERO_BYTE(v ^ (ONES * HDLC_FLAG)) ||
+				HAS_ZERO_BYTE(v ^ (ONES * HDLC_ESCAPE)))
+			break;
+
+		if (filter_ctrl && HAS_BYTE_BELOW(v, HDLC_TRANS))
+			break;
+
+		pos += sizeof(v);
+	}
+
+	while (pos < len) {
+		if (buf[pos] == HDLC_FLAG || buf[pos] == HDLC_ESCAPE)
+			break;
+
+		if (filter_ctrl && buf[pos] < HDLC_TRANS)
+			break;
+
+		pos += 1;
+	}
+
+	return pos;
+}
+
+/* Returns FALSE if the receive callback destroyed the HDLC object */
+static gboolean decode_bytes(GAtHDLC *hdlc, const unsigned char *buf,
+				unsigned int len)
+{
+	gboolean filter_ctrl = hdlc->recv_accm != 0;
+	unsigned int pos = 0;
+	unsigned int run;
 
 	while (pos < len) {
+		/* Fast path, copy a run of plain data in one go */
+		if (hdlc->decode_escape == FALSE) {
+			run = clean_run(buf + pos, len - pos, filter_ctrl);
+			run = MIN(run, DECODE_BUFFER_SIZE - hdlc->decode_offset);
+
+			if (run > 0) {
+				memcpy(hdlc->decode_buffer + hdlc->decode_offset,
+					buf + pos, run);
+				hdlc->decode_fcs = crc_ccitt(hdlc->decode_fcs,
+								buf + pos, run);
+				hdlc->decode_offset += run;
+				pos += run;
+				continue;
+			}
+		}
+
+		/* Oversized frame, drop what we have and resync on a flag */
+		if (hdlc->decode_offset == DECODE_BUFFER_SIZE) {
+			hdlc->stats.rx_overruns += 1;
+			hdlc->decode_fcs = HDLC_INITFCS;
+			hdlc->decode_offset = 0;
+		}
+
+		/* Reference byte decoder */
 		if (hdlc->decode_escape == TRUE) {
-			unsigned char val = *buf ^ HDLC_TRANS;
+			unsigned char val = buf[pos] ^ HDLC_TRANS;
 
 			hdlc->decode_buffer[hdlc->decode_offset++] = val;
 			hdlc->decode_fcs = HDLC_FCS(hdlc->decode_fcs, val);
 
 			hdlc->decode_escape = FALSE;
-		} else if (*buf == HDLC_ESCAPE) {
+		} else if (buf[pos] == HDLC_ESCAPE) {
 			hdlc->decode_escape = TRUE;
-		} else if (*buf == HDLC_FLAG) {
-			if (hdlc->receive_func && hdlc->decode_offset > 2 &&
-					hdlc->decode_fcs == HDLC_GOODFCS) {
+		} else if (buf[pos] == HDLC_FLAG) {
+			gboolean good = hdlc->decode_offset > 2 &&
+					hdlc->decode_fcs == HDLC_GOODFCS;
+
+			/* Back to back flags delimit an empty frame */
+			if (good) {
+				hdlc->stats.rx_frames += 1;
+				hdlc->stats.rx_bytes += hdlc->decode_offset - 2;
+			} else if (hdlc->decode_offset > 2)
+				hdlc->stats.rx_fcs_errors += 1;
+			else if (hdlc->decode_offset > 0)
+				hdlc->stats.rx_short_frames += 1;
+
+			if (hdlc->receive_func && good) {
 				hdlc->receive_func(hdlc->decode_buffer,
 							hdlc->decode_offset - 2,
 							hdlc->receive_data);
 
 				if (hdlc->destroyed)
-					goto out;
+					return FALSE;
 			}
 
 			hdlc->decode_fcs = HDLC_INITFCS;
 			hdlc->decode_offset = 0;
-		} else if (*buf >= 0x20 ||
-					(hdlc->recv_accm & (1 << *buf)) == 0) {
-			hdlc->decode_buffer[hdlc->decode_offset++] = *buf;
-			hdlc->decode_fcs = HDLC_FCS(hdlc->decode_fcs, *buf);
+		} else if (buf[pos] >= 0x20 ||
+					(hdlc->recv_accm & (1 << buf[pos])) == 0) {
+			hdlc->decode_buffer[hdlc->decode_offset++] = buf[pos];
+			hdlc->decode_fcs = HDLC_FCS(hdlc->decode_fcs, buf[pos]);
 		}
 
-		buf++;
 		pos++;
+	}
 
-		if (pos == wrap) {
-			buf = ring_buffer_read_ptr(rbuf, pos);
-			hdlc_record(hdlc->record_fd, TRUE, buf, len - wrap);
-		}
+	return TRUE;
+}
+
+static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
+{
+	GAtHDLC *hdlc = user_data;
+	unsigned int len = ring_buffer_len(rbuf);
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+	unsigned char *buf = ring_buffer_read_ptr(rbuf, 0);
+
+	hdlc->stats.rx_wire_bytes += len;
+
+	hdlc_record(hdlc->record_fd, TRUE, buf, wrap);
+
+	hdlc->in_read_handler = TRUE;
+
+	if (decode_bytes(hdlc, buf, wrap) == FALSE)
+		goto out;
+
+	if (len > wrap) {
+		buf = ring_buffer_read_ptr(rbuf, wrap);
+		hdlc_record(hdlc->record_fd, TRUE, buf, len - wrap);
+
+		if (decode_bytes(hdlc, buf, len - wrap) == FALSE)
+			goto out;
 	}
 
-	ring_buffer_drain(rbuf, pos);
+	ring_buffer_drain(rbuf, len);
 
 out:
 	hdlc->in_read_handler = FALSE;
@@ -186,6 +297,19 @@ out:
 		g_free(hdlc);
 }
 
+static void build_escape_map(GAtHDLC *hdlc)
+{
+	unsigned int i;
+
+	memset(hdlc->xmit_escape, 0, sizeof(hdlc->xmit_escape));
+
+	for (i = 0; i < 32; i++)
+		hdlc->xmit_escape[i] = (hdlc->xmit_accm >> i) & 1;
+
+	hdlc->xmit_escape[HDLC_FLAG] = 1;
+	hdlc->xmit_escape[HDLC_ESCAPE] = 1;
+}
+
 GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 {
 	GAtHDLC *hdlc;
@@ -203,8 +327,8 @@ GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 	hdlc->decode_offset = 0;
 	hdlc->decode_escape = FALSE;
 
-	hdlc->xmit_accm[0] = ~0U;
-	hdlc->xmit_accm[3] = 0x60000000; /* 0x7d, 0x7e */
+	hdlc->xmit_accm = ~0U;
+	build_escape_map(hdlc);
 	hdlc->recv_accm = ~0U;
 
 	hdlc->write_buffer = ring_buffer_new(BUFFER_SIZE * 2);
@@ -215,8 +339,9 @@ GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 	buf = ring_buffer_write_ptr(hdlc->write_buffer, 0);
 	*buf = HDLC_FLAG;
 	ring_buffer_write_advance(hdlc->write_buffer, 1);
+	hdlc->queued_since = hdlc_now();
 
-	hdlc->decode_buffer = g_try_malloc(BUFFER_SIZE * 2);
+	hdlc->decode_buffer = g_try_malloc(DECODE_BUFFER_SIZE);
 	if (!hdlc->decode_buffer)
 		goto error;
 
@@ -311,17 +436,44 @@ void g_at_hdlc_set_receive(GAtHDLC *hdlc, GAtReceiveFunc func,
 static gboolean can_write_data(gpointer data)
 {
 	GAtHDLC *hdlc = data;
-	unsigned int len;
-	unsigned char *buf;
+	struct iovec iov[2];
 	gsize bytes_written;
+	gsize len;
+	guint64 now;
+	int count;
+	int i;
+
+	/* Write both halves of a wrapped buffer in one go */
+	count = ring_buffer_read_iov(hdlc->write_buffer, iov);
+	bytes_written = g_at_io_writev(hdlc->io, iov, count);
 
-	len = ring_buffer_len_no_wrap(hdlc->write_buffer);
-	buf = ring_buffer_read_ptr(hdlc->write_buffer, 0);
+	for (i = 0, len = bytes_written; i < count && len > 0; i++) {
+		gsize n = MIN(len, iov[i].iov_len);
+
+		hdlc_record(hdlc->record_fd, FALSE, iov[i].iov_base, n);
+		len -= n;
+	}
 
-	bytes_written = g_at_io_write(hdlc->io, (gchar *) buf, len);
-	hdlc_record(hdlc->record_fd, FALSE, buf, bytes_written);
 	ring_buffer_drain(hdlc->write_buffer, bytes_written);
 
+	/*
+	 * The queueing delay is how long the oldest byte in the write buffer
+	 * waited for the device to take it
+	 */
+	if (bytes_written > 0) {
+		now = hdlc_now();
+
+		hdlc->stats.tx_wire_bytes += bytes_written;
+		hdlc->stats.tx_queue_samples += 1;
+		hdlc->stats.tx_queue_delay_total += now - hdlc->queued_since;
+
+		if (now - hdlc->queued_since > hdlc->stats.tx_queue_delay_max)
+			hdlc->stats.tx_queue_delay_max =
+						now - hdlc->queued_since;
+
+		hdlc->queued_since = now;
+	}
+
 	if (ring_buffer_len(hdlc->write_buffer) > 0)
 		return TRUE;
 
@@ -333,7 +485,8 @@ void g_at_hdlc_set_xmit_accm(GAtHDLC *hdlc, guint32 accm)
 	if (hdlc == NULL)
 		return;
 
-	hdlc->xmit_accm[0] = accm;
+	hdlc->xmit_accm = accm;
+	build_escape_map(hdlc);
 }
 
 guint32 g_at_hdlc_get_xmit_accm(GAtHDLC *hdlc)
@@ -341,7 +494,7 @@ guint32 g_at_hdlc_get_xmit_accm(GAtHDLC *hdlc)
 	if (hdlc == NULL)
 		return 0;
 
-	return hdlc->xmit_accm[0];
+	return hdlc->xmit_accm;
 }
 
 GAtIO *g_at_hdlc_get_io(GAtHDLC *hdlc)
@@ -352,83 +505,119 @@ GAtIO *g_at_hdlc_get_io(GAtHDLC *hdlc)
 	return hdlc->io;
 }
 
-#define NEED_ESCAPE(xmit_accm, c) xmit_accm[c >> 5] & (1 << (c & 0x1f))
-
-gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
+gboolean g_at_hdlc_can_send(GAtHDLC *hdlc, gsize size)
 {
-	unsigned int avail = ring_buffer_avail(hdlc->write_buffer);
-	unsigned int wrap = ring_buffer_avail_no_wrap(hdlc->write_buffer);
-	unsigned char *buf = ring_buffer_write_ptr(hdlc->write_buffer, 0);
-	unsigned char tail[2];
-	unsigned int i = 0;
-	guint16 fcs = HDLC_INITFCS;
-	gboolean escape = FALSE;
-	gsize pos = 0;
-
-	if (avail < size)
+	if (hdlc == NULL)
 		return FALSE;
 
-	i = 0;
-
-	while (pos < avail && i < size) {
-		if (escape == TRUE) {
-			fcs = HDLC_FCS(fcs, data[i]);
-			*buf = data[i++] ^ HDLC_TRANS;
-			escape = FALSE;
-		} else if (NEED_ESCAPE(hdlc->xmit_accm, data[i])) {
-			*buf = HDLC_ESCAPE;
-			escape = TRUE;
-		} else {
-			fcs = HDLC_FCS(fcs, data[i]);
-			*buf = data[i++];
+	/* Worst case every byte, the FCS included, needs escaping */
+	return ring_buffer_avail(hdlc->write_buffer) >= (size + 2) * 2 + 1;
+}
+
+/*
+ * Escape and append data at offset *pos of the write buffer, copying runs
+ * which need no escaping in blocks.  Nothing is committed to the ring
+ * buffer, the caller advances it once the whole frame fits.
+ */
+static gboolean encode_bytes(GAtHDLC *hdlc, const unsigned char *data,
+				gsize size, unsigned int *pos,
+				unsigned int avail, unsigned int wrap)
+{
+	struct ring_buffer *rbuf = hdlc->write_buffer;
+	gboolean filter_ctrl = hdlc->xmit_accm != 0;
+	unsigned int first;
+	unsigned int run;
+	gsize i = 0;
+
+	while (i < size) {
+		run = clean_run(data + i, size - i, filter_ctrl);
+
+		/* Control characters outside of the ACCM go out as is */
+		while (i + run < size && !hdlc->xmit_escape[data[i + run]])
+			run += 1 + clean_run(data + i + run + 1,
+						size - i - run - 1,
+						filter_ctrl);
+
+		if (run > 0) {
+			if (*pos + run > avail)
+				return FALSE;
+
+			first = *pos < wrap ? MIN(run, wrap - *pos) : 0;
+			memcpy(ring_buffer_write_ptr(rbuf, *pos), data + i,
+					first);
+			memcpy(ring_buffer_write_ptr(rbuf, *pos + first),
+					data + i + first, run - first);
+
+			*pos += run;
+			i += run;
+			continue;
 		}
 
-		buf++;
-		pos++;
+		if (*pos + 2 > avail)
+			return FALSE;
+
+		*ring_buffer_write_ptr(rbuf, *pos) = HDLC_ESCAPE;
+		*ring_buffer_write_ptr(rbuf, *pos + 1) = data[i] ^ HDLC_TRANS;
 
-		if (pos == wrap)
-			buf = ring_buffer_write_ptr(hdlc->write_buffer, pos);
+		*pos += 2;
+		i += 1;
 	}
 
-	if (i < size)
-		return FALSE;
+	return TRUE;
+}
 
-	fcs ^= HDLC_INITFCS;
-	tail[0] = fcs & 0xff;
-	tail[1] = fcs >> 8;
+gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
+{
+	unsigned int avail = ring_buffer_avail(hdlc->write_buffer);
+	unsigned int wrap = ring_buffer_avail_no_wrap(hdlc->write_buffer);
+	unsigned char tail[2];
+	guint16 fcs;
+	unsigned int pos = 0;
 
-	i = 0;
-
-	while (pos < avail && i < sizeof(tail)) {
-		if (escape == TRUE) {
-			*buf = tail[i++] ^ HDLC_TRANS;
-			escape = FALSE;
-		} else if (NEED_ESCAPE(hdlc->xmit_accm, tail[i])) {
-			*buf = HDLC_ESCAPE;
-			escape = TRUE;
-		} else {
-			*buf = tail[i++];
-		}
+	if (avail < size)
+		goto overrun;
 
-		buf++;
-		pos++;
+	fcs = crc_ccitt(HDLC_INITFCS, data, size) ^ HDLC_INITFCS;
+	tail[0] = fcs & 0xff;
+	tail[1] = fcs >> 8;
 
-		if (pos == wrap)
-			buf = ring_buffer_write_ptr(hdlc->write_buffer, pos);
-	}
+	if (encode_bytes(hdlc, data, size, &pos, avail, wrap) == FALSE)
+		goto overrun;
 
-	if (i < sizeof(tail))
-		return FALSE;
+	if (encode_bytes(hdlc, tail, sizeof(tail), &pos, avail, wrap) == FALSE)
+		goto overrun;
 
 	if (pos + 1 > avail)
-		return FALSE;
+		goto overrun;
 
-	*buf = HDLC_FLAG;
+	*ring_buffer_write_ptr(hdlc->write_buffer, pos) = HDLC_FLAG;
 	pos++;
 
+	if (ring_buffer_len(hdlc->write_buffer) == 0)
+		hdlc->queued_since = hdlc_now();
+
 	ring_buffer_write_advance(hdlc->write_buffer, pos);
 
+	hdlc->stats.tx_frames += 1;
+	hdlc->stats.tx_bytes += size;
+	hdlc->stats.tx_escapes += pos - size - sizeof(tail) - 1;
+
 	g_at_io_set_write_handler(hdlc->io, can_write_data, hdlc);
 
+	return TRUE;
+
+overrun:
+	hdlc->stats.tx_overruns += 1;
+
+	return FALSE;
+}
+
+gboolean g_at_hdlc_get_stats(GAtHDLC *hdlc, GAtHDLCStats *stats)
+{
+	if (hdlc == NULL || stats == NULL)
+		return FALSE;
+
+	memcpy(stats, &hdlc->stats, sizeof(*stats));
+
 	return TRUE;
 }
@@ -33,6 +33,23 @@ struct _GAtHDLC;
 
 typedef struct _GAtHDLC GAtHDLC;
 
+typedef struct _GAtHDLCStats {
+	guint64 tx_frames;		/* Frames queued for sending */
+	guint64 tx_bytes;		/* Unescaped payload of those frames */
+	guint64 tx_escapes;		/* Escape characters added */
+	guint64 tx_wire_bytes;		/* Bytes written to the device */
+	guint64 tx_overruns;		/* Frames refused, write buffer full */
+	guint64 tx_queue_samples;	/* Writes the delays were taken over */
+	guint64 tx_queue_delay_total;	/* Time queued before written, us */
+	guint64 tx_queue_delay_max;	/* Longest such wait, us */
+	guint64 rx_frames;		/* Good frames received */
+	guint64 rx_bytes;		/* Payload of those frames */
+	guint64 rx_wire_bytes;		/* Bytes read from the device */
+	guint64 rx_fcs_errors;		/* Frames dropped for a bad FCS */
+	guint64 rx_short_frames;	/* Too short to hold an FCS */
+	guint64 rx_overruns;		/* Frames dropped for being too long */
+} GAtHDLCStats;
+
 GAtHDLC *g_at_hdlc_new(GIOChannel *channel);
 GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io);
 
@@ -50,11 +67,14 @@ guint32 g_at_hdlc_get_recv_accm(GAtHDLC *hdlc);
 void g_at_hdlc_set_receive(GAtHDLC *hdlc, GAtReceiveFunc func,
 							gpointer user_data);
 gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size);
+gboolean g_at_hdlc_can_send(GAtHDLC *hdlc, gsize size);
 
 void g_at_hdlc_set_recording(GAtHDLC *hdlc, const char *filename);
 
 GAtIO *g_at_hdlc_get_io(GAtHDLC *hdlc);
 
+gboolean g_at_hdlc_get_stats(GAtHDLC *hdlc, GAtHDLCStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,6 +29,13 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/uio.h>
+
+#ifdef NEED_THREADS
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#endif
 
 #include <glib.h>
 
@@ -48,17 +55,39 @@ struct _GAtIO {
 	GAtIOReadFunc read_handler;		/* Read callback */
 	gpointer read_data;			/* Read callback userdata */
 	gboolean use_write_watch;		/* Use write select */
+	gboolean use_writev;			/* Write the descriptor directly */
 	GAtIOWriteFunc write_handler;		/* Write callback */
 	gpointer write_data;			/* Write callback userdata */
 	GAtDebugFunc debugf;			/* debugging output function */
 	gpointer debug_data;			/* Data to pass to debug func */
 	gboolean destroyed;			/* Re-entrancy guard */
+#ifdef NEED_THREADS
+	GThread *reader;			/* Reader thread, NULL if none */
+	int fd;					/* Descriptor the reader polls */
+	int notify_fd;				/* Reader -> main loop eventfd */
+	int kick_fd;				/* Main loop -> reader eventfd */
+	gint reader_stop;			/* Reader must exit */
+	gint reader_hup;			/* Reader saw hangup or error */
+	gint reader_waiting;			/* Reader waits for free space */
+#endif
 };
 
+#ifdef NEED_THREADS
+static void stop_reader(GAtIO *io);
+#endif
+
 static void read_watcher_destroy_notify(gpointer user_data)
 {
 	GAtIO *io = user_data;
 
+#ifdef NEED_THREADS
+	/* The reader is done with the descriptor, let go of the channel */
+	if (io->reader) {
+		stop_reader(io);
+		g_io_channel_unref(io->channel);
+	}
+#endif
+
 	ring_buffer_free(io->buf);
 	io->buf = NULL;
 
@@ -151,6 +180,82 @@ gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count)
 	return bytes_written;
 }
 
+/* Hand the regions to the channel one at a time, stopping when it's full */
+static gsize write_regions(GAtIO *io, const struct iovec *iov, int iovcnt)
+{
+	GIOStatus status;
+	gsize bytes_written;
+	gsize total = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		status = g_io_channel_write_chars(io->channel, iov[i].iov_base,
+							iov[i].iov_len,
+							&bytes_written, NULL);
+
+		if (status != G_IO_STATUS_NORMAL) {
+			if (total == 0)
+				g_source_remove(io->read_watch);
+
+			break;
+		}
+
+		g_at_util_debug_chat(FALSE, iov[i].iov_base, bytes_written,
+					io->debugf, io->debug_data);
+
+		total += bytes_written;
+
+		if (bytes_written < iov[i].iov_len)
+			break;
+	}
+
+	return total;
+}
+
+/*
+ * Write several regions, e.g. both halves of a wrapped ring buffer or a
+ * number of queued buffers, with a single system call if the owner of the
+ * channel allowed it with g_at_io_set_use_writev.  Returns the total number of bytes written, which may end in
+ * the middle of any region.
+ */
+gsize g_at_io_writev(GAtIO *io, const struct iovec *iov, int iovcnt)
+{
+	ssize_t bytes_written;
+	gsize left;
+	int fd;
+	int i;
+
+	if (iovcnt == 0)
+		return 0;
+
+	if (io->use_writev == FALSE)
+		return write_regions(io, iov, iovcnt);
+
+	fd = g_io_channel_unix_get_fd(io->channel);
+
+	do {
+		bytes_written = writev(fd, iov, iovcnt);
+	} while (bytes_written < 0 && errno == EINTR);
+
+	if (bytes_written < 0) {
+		g_source_remove(io->read_watch);
+		return 0;
+	}
+
+	if (io->debugf == NULL)
+		return bytes_written;
+
+	for (i = 0, left = bytes_written; i < iovcnt && left > 0; i++) {
+		gsize len = MIN(left, iov[i].iov_len);
+
+		g_at_util_debug_chat(FALSE, iov[i].iov_base, len,
+					io->debugf, io->debug_data);
+		left -= len;
+	}
+
+	return bytes_written;
+}
+
 static void write_watcher_destroy_notify(gpointer user_data)
 {
 	GAtIO *io = user_data;
@@ -222,6 +327,235 @@ error:
 	return NULL;
 }
 
+#ifdef NEED_THREADS
+static void signal_eventfd(int fd)
+{
+	uint64_t one = 1;
+
+	while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void clear_eventfd(int fd)
+{
+	uint64_t count;
+
+	while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR);
+}
+
+/*
+ * Runs on its own thread and is the only producer of io->buf.  Everything
+ * else, including the debug output and the read handler, stays on the main
+ * loop, which we wake up through notify_fd whenever new data arrived.
+ */
+static gpointer reader_thread(gpointer user_data)
+{
+	GAtIO *io = user_data;
+	struct pollfd fds[2];
+	unsigned int toread;
+	ssize_t rbytes;
+
+	fds[0].fd = io->fd;
+	fds[1].fd = io->kick_fd;
+	fds[1].events = POLLIN;
+
+	while (g_atomic_int_get(&io->reader_stop) == FALSE) {
+		toread = ring_buffer_avail_no_wrap(io->buf);
+
+		/*
+		 * Announce that we are waiting before looking again, so that
+		 * the main loop either sees the flag or we see its drain
+		 */
+		if (toread == 0) {
+			g_atomic_int_set(&io->reader_waiting, TRUE);
+			toread = ring_buffer_avail_no_wrap(io->buf);
+
+			if (toread > 0)
+				g_atomic_int_set(&io->reader_waiting, FALSE);
+		}
+
+		fds[0].events = toread > 0 ? POLLIN : 0;
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (fds[1].revents & POLLIN)
+			clear_eventfd(io->kick_fd);
+
+		if (fds[0].revents & POLLIN) {
+			rbytes = read(io->fd, ring_buffer_write_ptr(io->buf, 0),
+					toread);
+
+			if (rbytes > 0) {
+				ring_buffer_write_advance(io->buf, rbytes);
+				signal_eventfd(io->notify_fd);
+				continue;
+			}
+
+			if (rbytes < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			break;
+		}
+
+		if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+			break;
+	}
+
+	g_atomic_int_set(&io->reader_hup, TRUE);
+	signal_eventfd(io->notify_fd);
+
+	return NULL;
+}
+
+static void stop_reader(GAtIO *io)
+{
+	g_atomic_int_set(&io->reader_stop, TRUE);
+	signal_eventfd(io->kick_fd);
+
+	g_thread_join(io->reader);
+	io->reader = NULL;
+
+	close(io->notify_fd);
+	close(io->kick_fd);
+}
+
+/* The new bytes sit at the end of the buffer and may wrap */
+static void debug_new_data(GAtIO *io, unsigned int len)
+{
+	unsigned int offset = ring_buffer_len(io->buf) - len;
+	unsigned char *start;
+	unsigned int run;
+
+	while (len > 0) {
+		start = ring_buffer_read_ptr(io->buf, offset);
+
+		for (run = 1; run < len; run++)
+			if (ring_buffer_read_ptr(io->buf, offset + run) !=
+					start + run)
+				break;
+
+		g_at_util_debug_chat(TRUE, (char *) start, run,
+					io->debugf, io->debug_data);
+
+		offset += run;
+		len -= run;
+	}
+}
+
+static gboolean reader_notify(GIOChannel *channel, GIOCondition cond,
+				gpointer data)
+{
+	GAtIO *io = data;
+	unsigned int len;
+	gboolean hup;
+
+	if (cond & G_IO_NVAL)
+		return FALSE;
+
+	clear_eventfd(io->notify_fd);
+
+	/* Everything the reader wrote before hanging up is visible now */
+	hup = g_atomic_int_get(&io->reader_hup);
+
+	/*
+	 * Debug output and read handler work on the same snapshot, data the
+	 * reader adds in the meantime waits for the next round
+	 */
+	len = ring_buffer_snapshot(io->buf);
+
+	if (io->debugf)
+		debug_new_data(io, len);
+
+	if (ring_buffer_len(io->buf) > 0 && io->read_handler)
+		io->read_handler(io->buf, io->read_data);
+
+	if (hup || (cond & (G_IO_HUP | G_IO_ERR)))
+		return FALSE;
+
+	/* We're overflowing the buffer, shutdown the socket */
+	if (ring_buffer_len(io->buf) == ring_buffer_capacity(io->buf))
+		return FALSE;
+
+	if (g_atomic_int_get(&io->reader_waiting)) {
+		g_atomic_int_set(&io->reader_waiting, FALSE);
+		signal_eventfd(io->kick_fd);
+	}
+
+	return TRUE;
+}
+
+static GAtIO *create_threaded_io(GIOChannel *channel)
+{
+	GIOChannel *notify;
+	GAtIO *io;
+
+	if (channel == NULL)
+		return NULL;
+
+	io = g_try_new0(GAtIO, 1);
+	if (io == NULL)
+		return io;
+
+	io->ref_count = 1;
+	io->max_read_attempts = 1;
+	io->use_write_watch = TRUE;
+	io->use_writev = TRUE;
+	io->notify_fd = -1;
+	io->kick_fd = -1;
+
+	io->buf = ring_buffer_new_shared(8192);
+	if (io->buf == NULL)
+		goto error;
+
+	if (!g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK))
+		goto error;
+
+	io->fd = g_io_channel_unix_get_fd(channel);
+
+	io->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (io->notify_fd < 0)
+		goto error;
+
+	io->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (io->kick_fd < 0)
+		goto error;
+
+	io->reader = g_thread_create(reader_thread, io, TRUE, NULL);
+	if (io->reader == NULL)
+		goto error;
+
+	/* Nothing watches the channel itself, so keep it alive ourselves */
+	io->channel = g_io_channel_ref(channel);
+
+	notify = g_io_channel_unix_new(io->notify_fd);
+	io->read_watch = g_io_add_watch_full(notify, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				reader_notify, io,
+				read_watcher_destroy_notify);
+	g_io_channel_unref(notify);
+
+	return io;
+
+error:
+	if (io->kick_fd >= 0)
+		close(io->kick_fd);
+
+	if (io->notify_fd >= 0)
+		close(io->notify_fd);
+
+	if (io->buf)
+		ring_buffer_free(io->buf);
+
+	g_free(io);
+
+	return NULL;
+}
+#endif
+
 GAtIO *g_at_io_new(GIOChannel *channel)
 {
 	return create_io(channel, G_IO_FLAG_NONBLOCK);
@@ -232,6 +566,16 @@ GAtIO *g_at_io_new_blocking(GIOChannel *channel)
 	return create_io(channel, 0);
 }
 
+GAtIO *g_at_io_new_threaded(GIOChannel *channel)
+{
+#ifdef NEED_THREADS
+	if (g_thread_supported())
+		return create_threaded_io(channel);
+#endif
+
+	return create_io(channel, G_IO_FLAG_NONBLOCK);
+}
+
 GIOChannel *g_at_io_get_channel(GAtIO *io)
 {
 	if (io == NULL)
@@ -240,6 +584,20 @@ GIOChannel *g_at_io_get_channel(GAtIO *io)
 	return io->channel;
 }
 
+gboolean g_at_io_set_use_writev(GAtIO *io, gboolean use_writev)
+{
+	if (io == NULL)
+		return FALSE;
+
+	/* writev() would go around anything held in the channel buffer */
+	if (use_writev && g_io_channel_get_buffered(io->channel))
+		return FALSE;
+
+	io->use_writev = use_writev;
+
+	return TRUE;
+}
+
 gboolean g_at_io_set_read_handler(GAtIO *io, GAtIOReadFunc read_handler,
 					gpointer user_data)
 {
@@ -33,6 +33,7 @@ struct _GAtIO;
 typedef struct _GAtIO GAtIO;
 
 struct ring_buffer;
+struct iovec;
 
 typedef void (*GAtIOReadFunc)(struct ring_buffer *buffer, gpointer user_data);
 typedef gboolean (*GAtIOWriteFunc)(gpointer user_data);
@@ -40,8 +41,25 @@ typedef gboolean (*GAtIOWriteFunc)(gpointer user_data);
 GAtIO *g_at_io_new(GIOChannel *channel);
 GAtIO *g_at_io_new_blocking(GIOChannel *channel);
 
+/*
+ * Reads the channel on a dedicated thread, so that bursts from the device
+ * are taken off the kernel queue even while the main loop is busy.  The
+ * handlers are still called from the main loop.  The channel must wrap a
+ * file descriptor, e.g. one from g_at_tty_open.  Falls back to g_at_io_new
+ * unless built with --enable-threads and g_thread_init was called.
+ */
+GAtIO *g_at_io_new_threaded(GIOChannel *channel);
+
 GIOChannel *g_at_io_get_channel(GAtIO *io);
 
+/*
+ * Lets g_at_io_writev hand all regions to writev() on the descriptor of the
+ * channel at once, instead of writing them one by one through the channel.
+ * Only for unbuffered channels wrapping a file descriptor, virtual channels
+ * such as those of GAtMux must not use it.  Threaded IO always does.
+ */
+gboolean g_at_io_set_use_writev(GAtIO *io, gboolean use_writev);
+
 GAtIO *g_at_io_ref(GAtIO *io);
 void g_at_io_unref(GAtIO *io);
 
@@ -50,6 +68,7 @@ gboolean g_at_io_set_read_handler(GAtIO *io, GAtIOReadFunc read_handler,
 gboolean g_at_io_set_write_handler(GAtIO *io, GAtIOWriteFunc write_handler,
 					gpointer user_data);
 gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count);
+gsize g_at_io_writev(GAtIO *io, const struct iovec *iov, int iovcnt);
 
 gboolean g_at_io_set_disconnect_function(GAtIO *io,
 			GAtDisconnectFunc disconnect, gpointer user_data);
@@ -49,9 +49,9 @@ typedef void (*GAtMuxWriteFrame)(GAtMux *mux, guint8 dlc, guint8 control,
  * Refer to Section 5.6 in 27.007
  */
 #define MAX_CHANNELS 61
-#define BITMAP_SIZE 8
 #define MUX_CHANNEL_BUFFER_SIZE 4096
 #define MUX_BUFFER_SIZE 4096
+#define MUX_BUFFER_COMPACT (MUX_BUFFER_SIZE / 4)
 
 struct _GAtMuxChannel
 {
@@ -59,8 +59,9 @@ struct _GAtMuxChannel
 	GAtMux *mux;
 	GIOCondition condition;
 	struct ring_buffer *buffer;
-	GSList *sources;
+	GPtrArray *sources;
 	gboolean throttled;
+	gboolean pending;		/* On the mux active list */
 	guint dlc;
 };
 
@@ -81,11 +82,13 @@ struct _GAtMux {
 	GAtDebugFunc debugf;			/* debugging output function */
 	gpointer debug_data;			/* Data to pass to debug func */
 	GAtMuxChannel *dlcs[MAX_CHANNELS];	/* DLCs opened by the MUX */
-	guint8 newdata[BITMAP_SIZE];		/* Channels that got new data */
+	guint8 active[MAX_CHANNELS];		/* Channels that got new data */
+	int num_active;				/* Entries used in active */
 	const GAtMuxDriver *driver;		/* Driver functions */
 	void *driver_data;			/* Driver data */
 	char buf[MUX_BUFFER_SIZE];		/* Buffer on the main mux */
 	int buf_used;				/* Bytes of buf being used */
+	int buf_start;				/* Start of unparsed data */
 	gboolean shutdown;
 };
 
@@ -117,64 +120,61 @@ static inline void debug(GAtMux *mux, const char *format, ...)
 static void dispatch_sources(GAtMuxChannel *channel, GIOCondition condition)
 {
 	GAtMuxWatch *source;
-	GSList *c;
-	GSList *p;
-	GSList *t;
-
-	p = NULL;
-	c = channel->sources;
-
-	while (c) {
-		gboolean destroy = FALSE;
-
-		source = c->data;
+	guint i = 0;
+
+	/*
+	 * Watches take themselves off the array once they are finalized,
+	 * which might well happen from within the dispatch
+	 */
+	while (i < channel->sources->len) {
+		gpointer user_data = NULL;
+		GSourceFunc callback = NULL;
+		GSourceCallbackFuncs *cb_funcs;
+		gpointer cb_data;
+		gboolean (*dispatch) (GSource *, GSourceFunc, gpointer);
+		gboolean destroy;
+
+		source = g_ptr_array_index(channel->sources, i);
 
 		debug(channel->mux, "checking source: %p", source);
 
-		if (condition & source->condition) {
-			gpointer user_data = NULL;
-			GSourceFunc callback = NULL;
-			GSourceCallbackFuncs *cb_funcs;
-			gpointer cb_data;
-			gboolean (*dispatch) (GSource *, GSourceFunc, gpointer);
+		if (!(condition & source->condition)) {
+			i += 1;
+			continue;
+		}
 
-			debug(channel->mux, "dispatching source: %p", source);
+		debug(channel->mux, "dispatching source: %p", source);
 
-			dispatch = source->source.source_funcs->dispatch;
-			cb_funcs = source->source.callback_funcs;
-			cb_data = source->source.callback_data;
+		g_source_ref((GSource *) source);
 
-			if (cb_funcs)
-				cb_funcs->ref(cb_data);
+		dispatch = source->source.source_funcs->dispatch;
+		cb_funcs = source->source.callback_funcs;
+		cb_data = source->source.callback_data;
 
-			if (cb_funcs)
-				cb_funcs->get(cb_data, (GSource *) source,
-						&callback, &user_data);
+		if (cb_funcs)
+			cb_funcs->ref(cb_data);
 
-			destroy = !dispatch((GSource *) source, callback,
-						user_data);
+		if (cb_funcs)
+			cb_funcs->get(cb_data, (GSource *) source,
+					&callback, &user_data);
 
-			if (cb_funcs)
-				cb_funcs->unref(cb_data);
-		}
+		destroy = !dispatch((GSource *) source, callback, user_data);
+
+		if (cb_funcs)
+			cb_funcs->unref(cb_data);
 
 		if (destroy) {
 			debug(channel->mux, "removing source: %p", source);
 
+			g_ptr_array_remove(channel->sources, source);
 			g_source_destroy((GSource *) source);
-
-			if (p)
-				p->next = c->next;
-			else
-				channel->sources = c->next;
-
-			t = c;
-			c = c->next;
-			g_slist_free_1(t);
-		} else {
-			p = c;
-			c = c->next;
 		}
+
+		g_source_unref((GSource *) source);
+
+		if (i < channel->sources->len &&
+				g_ptr_array_index(channel->sources, i) == source)
+			i += 1;
 	}
 }
 
@@ -191,6 +191,17 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 
 	debug(mux, "received data");
 
+	/*
+	 * Partial frames are left where they are and parsing resumes from
+	 * buf_start, only move them back once we are running out of room
+	 */
+	if (mux->buf_start > 0 &&
+			sizeof(mux->buf) - mux->buf_used < MUX_BUFFER_COMPACT) {
+		mux->buf_used -= mux->buf_start;
+		memmove(mux->buf, mux->buf + mux->buf_start, mux->buf_used);
+		mux->buf_start = 0;
+	}
+
 	bytes_read = 0;
 	status = g_io_channel_read_chars(mux->channel, mux->buf + mux->buf_used,
 					sizeof(mux->buf) - mux->buf_used,
@@ -201,26 +212,31 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (bytes_read > 0 && mux->driver->feed_data) {
 		int nread;
 
-		memset(mux->newdata, 0, BITMAP_SIZE);
+		nread = mux->driver->feed_data(mux, mux->buf + mux->buf_start,
+						mux->buf_used - mux->buf_start);
+		mux->buf_start += nread;
 
-		nread = mux->driver->feed_data(mux, mux->buf, mux->buf_used);
-		mux->buf_used -= nread;
-
-		if (mux->buf_used > 0)
-			memmove(mux->buf, mux->buf + nread, mux->buf_used);
+		if (mux->buf_start == mux->buf_used) {
+			mux->buf_start = 0;
+			mux->buf_used = 0;
+		}
 
-		for (i = 1; i <= MAX_CHANNELS; i++) {
-			int offset = i / 8;
-			int bit = i % 8;
+		/* Only visit the channels data was actually fed to */
+		for (i = 0; i < mux->num_active; i++) {
+			GAtMuxChannel *dlc = mux->dlcs[mux->active[i] - 1];
 
-			if (!(mux->newdata[offset] & (1 << bit)))
+			/* Closed by one of the previous dispatches */
+			if (dlc == NULL)
 				continue;
 
-			debug(mux, "dispatching sources for channel: %p",
-				mux->dlcs[i-1]);
+			dlc->pending = FALSE;
 
-			dispatch_sources(mux->dlcs[i-1], G_IO_IN);
+			debug(mux, "dispatching sources for channel: %p", dlc);
+
+			dispatch_sources(dlc, G_IO_IN);
 		}
+
+		mux->num_active = 0;
 	}
 
 	if (cond & (G_IO_HUP | G_IO_ERR))
@@ -229,7 +245,7 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN)
 		return FALSE;
 
-	if (mux->buf_used == sizeof(mux->buf))
+	if (mux->buf_used - mux->buf_start == sizeof(mux->buf))
 		return FALSE;
 
 	return TRUE;
@@ -242,6 +258,20 @@ static void write_watcher_destroy_notify(gpointer user_data)
 	mux->write_watch = 0;
 }
 
+static gboolean channel_has_writer(GAtMuxChannel *channel)
+{
+	guint i;
+
+	for (i = 0; i < channel->sources->len; i++) {
+		GAtMuxWatch *source = g_ptr_array_index(channel->sources, i);
+
+		if (source->condition & G_IO_OUT)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 				gpointer data)
 {
@@ -271,8 +301,6 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 
 	for (dlc = 0; dlc < MAX_CHANNELS; dlc += 1) {
 		GAtMuxChannel *channel = mux->dlcs[dlc];
-		GSList *l;
-		GAtMuxWatch *source;
 
 		if (channel == NULL)
 			continue;
@@ -280,12 +308,8 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 		if (channel->throttled)
 			continue;
 
-		for (l = channel->sources; l; l = l->next) {
-			source = l->data;
-
-			if (source->condition & G_IO_OUT)
-				return TRUE;
-		}
+		if (channel_has_writer(channel))
+			return TRUE;
 	}
 
 	return FALSE;
@@ -322,8 +346,6 @@ void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
 	GAtMuxChannel *channel;
 
 	int written;
-	int offset;
-	int bit;
 
 	debug(mux, "deliver_data: dlc: %hu", dlc);
 
@@ -340,10 +362,11 @@ void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
 	if (written < 0)
 		return;
 
-	offset = dlc / 8;
-	bit = dlc % 8;
+	if (channel->pending == FALSE) {
+		channel->pending = TRUE;
+		mux->active[mux->num_active++] = dlc;
+	}
 
-	mux->newdata[offset] |= 1 << bit;
 	channel->condition |= G_IO_IN;
 }
 
@@ -361,19 +384,11 @@ void g_at_mux_set_dlc_status(GAtMux *mux, guint8 dlc, int status)
 		return;
 
 	if (status & G_AT_MUX_DLC_STATUS_RTR) {
-		GSList *l;
-
 		mux->dlcs[dlc-1]->throttled = FALSE;
 		debug(mux, "setting throttled to FALSE");
 
-		for (l = mux->dlcs[dlc-1]->sources; l; l = l->next) {
-			GAtMuxWatch *source = l->data;
-
-			if (source->condition & G_IO_OUT) {
-				wakeup_writer(mux);
-				break;
-			}
-		}
+		if (channel_has_writer(channel))
+			wakeup_writer(mux);
 	} else
 		mux->dlcs[dlc-1]->throttled = TRUE;
 }
@@ -422,6 +437,9 @@ static gboolean watch_dispatch(GSource *source, GSourceFunc callback,
 static void watch_finalize(GSource *source)
 {
 	GAtMuxWatch *watch = (GAtMuxWatch *) source;
+	GAtMuxChannel *dlc = (GAtMuxChannel *) watch->channel;
+
+	g_ptr_array_remove(dlc->sources, watch);
 
 	g_io_channel_unref(watch->channel);
 }
@@ -491,6 +509,7 @@ static void channel_free(GIOChannel *channel)
 	GAtMuxChannel *mux_channel = (GAtMuxChannel *) channel;
 
 	ring_buffer_free(mux_channel->buffer);
+	g_ptr_array_free(mux_channel->sources, TRUE);
 
 	g_free(channel);
 }
@@ -519,7 +538,7 @@ static GSource *channel_create_watch(GIOChannel *channel,
 			condition & G_IO_OUT,
 			condition & G_IO_IN);
 
-	dlc->sources = g_slist_prepend(dlc->sources, watch);
+	g_ptr_array_add(dlc->sources, watch);
 
 	return source;
 }
@@ -687,6 +706,8 @@ GIOChannel *g_at_mux_create_channel(GAtMux *mux)
 	if (mux_channel == NULL)
 		return NULL;
 
+	mux_channel->sources = g_ptr_array_new();
+
 	if (mux->driver->open_dlc)
 		mux->driver->open_dlc(mux, i+1);
 
@@ -62,9 +62,12 @@ struct _GAtPPP {
 	struct pppcp_data *ipcp;
 	struct ppp_net *net;
 	struct ppp_chap *chap;
+	struct ppp_vj *vj;
 	GAtHDLC *hdlc;
 	gint mru;
 	gint mtu;
+	gboolean xmit_pfc;
+	gboolean xmit_acfc;
 	char username[256];
 	char password[256];
 	GAtPPPConnectFunc connect_cb;
@@ -74,6 +77,7 @@ struct _GAtPPP {
 	GAtPPPDisconnectReason disconnect_reason;
 	GAtDebugFunc debugf;
 	gpointer debug_data;
+	GAtPPPStats stats;
 };
 
 void ppp_debug(GAtPPP *ppp, const char *str)
@@ -99,6 +103,62 @@ struct ppp_header *ppp_packet_new(gsize infolen, guint16 protocol)
 	return ppp_packet;
 }
 
+/*
+ * Fill in the address and control fields in front of the protocol field
+ * of packet, leaving out whatever the peer agreed to do without (RFC 1661
+ * sections 6.5 and 6.6).  Returns the offset at which the frame starts
+ */
+guint ppp_header_encode(guint8 *packet, gboolean pfc, gboolean acfc)
+{
+	guint16 proto = ppp_proto(packet);
+	guint offset = 0;
+
+	/* LCP packets always go out with the full header */
+	if (proto == LCP_PROTOCOL)
+		pfc = acfc = FALSE;
+
+	/* Only protocols with a zero upper byte can be compressed */
+	if (pfc && proto < 0x100)
+		offset += 1;
+
+	if (acfc)
+		return offset + 2;
+
+	packet[offset] = PPP_ADDR_FIELD;
+	packet[offset + 1] = PPP_CTRL;
+
+	return offset;
+}
+
+/*
+ * Parse the header of a received frame.  The address and control fields
+ * may be missing and the protocol field may be a single byte, which is
+ * recognized by its odd value.  Returns the offset of the information
+ * field, or 0 if the frame is too short to have one
+ */
+guint ppp_header_decode(const guint8 *frame, gsize len, guint16 *proto)
+{
+	guint offset = 0;
+
+	if (len >= 2 && frame[0] == PPP_ADDR_FIELD && frame[1] == PPP_CTRL)
+		offset = 2;
+
+	if (offset >= len)
+		return 0;
+
+	if (frame[offset] & 0x01) {
+		*proto = frame[offset];
+		return offset + 1;
+	}
+
+	if (offset + 2 > len)
+		return 0;
+
+	*proto = get_host_short(frame + offset);
+
+	return offset + 2;
+}
+
 /*
  * Silently discard packets which are received when they shouldn't be
  */
@@ -128,18 +188,37 @@ static inline gboolean ppp_drop_packet(GAtPPP *ppp, guint16 protocol)
 	return FALSE;
 }
 
+static void ppp_receive_ip(GAtPPP *ppp, const guint8 *packet)
+{
+	ppp->stats.rx_ip_packets += 1;
+	ppp->stats.rx_ip_bytes += get_host_short(packet + 2);
+
+	ppp_net_process_packet(ppp->net, packet);
+}
+
 static void ppp_receive(const unsigned char *buf, gsize len, void *data)
 {
 	GAtPPP *ppp = data;
-	guint16 protocol = ppp_proto(buf);
-	const guint8 *packet = ppp_info(buf);
+	guint16 protocol;
+	const guint8 *packet;
+	guint offset;
 
-	if (ppp_drop_packet(ppp, protocol))
+	offset = ppp_header_decode(buf, len, &protocol);
+	if (offset == 0) {
+		ppp->stats.rx_discarded += 1;
 		return;
+	}
+
+	packet = buf + offset;
+
+	if (ppp_drop_packet(ppp, protocol)) {
+		ppp->stats.rx_discarded += 1;
+		return;
+	}
 
 	switch (protocol) {
 	case PPP_IP_PROTO:
-		ppp_net_process_packet(ppp->net, packet);
+		ppp_receive_ip(ppp, packet);
 		break;
 	case LCP_PROTOCOL:
 		pppcp_process_packet(ppp->lcp, packet);
@@ -147,6 +226,21 @@ static void ppp_receive(const unsigned char *buf, gsize len, void *data)
 	case IPCP_PROTO:
 		pppcp_process_packet(ppp->ipcp, packet);
 		break;
+	case PPP_VJ_COMP_PROTO:
+	case PPP_VJ_UNCOMP_PROTO:
+		if (ppp->vj == NULL) {
+			ppp->stats.rx_discarded += 1;
+			pppcp_send_protocol_reject(ppp->lcp, buf, len);
+			break;
+		}
+
+		packet = ppp_vj_uncompress(ppp->vj, protocol, packet,
+						len - offset);
+		if (packet)
+			ppp_receive_ip(ppp, packet);
+		else
+			ppp->stats.rx_discarded += 1;
+		break;
 	case CHAP_PROTOCOL:
 		if (ppp->chap) {
 			ppp_chap_process_packet(ppp->chap, packet);
@@ -154,6 +248,7 @@ static void ppp_receive(const unsigned char *buf, gsize len, void *data)
 		}
 		/* fall through */
 	default:
+		ppp->stats.rx_discarded += 1;
 		pppcp_send_protocol_reject(ppp->lcp, buf, len);
 		break;
 	};
@@ -171,6 +266,7 @@ void ppp_transmit(GAtPPP *ppp, guint8 *packet, guint infolen)
 	guint8 code;
 	gboolean lcp = (proto == LCP_PROTOCOL);
 	guint32 xmit_accm = 0;
+	guint offset;
 
 	/*
 	 * all LCP Link Configuration, Link Termination, and Code-Reject
@@ -186,17 +282,50 @@ void ppp_transmit(GAtPPP *ppp, guint8 *packet, guint infolen)
 		g_at_hdlc_set_xmit_accm(ppp->hdlc, ~0U);
 	}
 
-	header->address = PPP_ADDR_FIELD;
-	header->control = PPP_CTRL;
+	offset = ppp_header_encode(packet, ppp->xmit_pfc, ppp->xmit_acfc);
 
-	if (g_at_hdlc_send(ppp->hdlc, packet,
-			infolen + sizeof(*header)) == FALSE)
+	if (g_at_hdlc_send(ppp->hdlc, packet + offset,
+			infolen + sizeof(*header) - offset) == FALSE)
 		g_print("Failed to send a frame\n");
 
 	if (lcp)
 		g_at_hdlc_set_xmit_accm(ppp->hdlc, xmit_accm);
 }
 
+/*
+ * transmit an IP packet read from the network interface, compressing the
+ * TCP/IP headers if negotiated.  The PPP header is rewritten in front of
+ * wherever the compressed packet ends up starting
+ */
+void ppp_transmit_ip(GAtPPP *ppp, guint8 *packet, guint infolen)
+{
+	struct ppp_header *header = (struct ppp_header *) packet;
+	guint16 proto = PPP_IP_PROTO;
+	guint offset = 0;
+
+	ppp->stats.tx_ip_packets += 1;
+	ppp->stats.tx_ip_bytes += infolen;
+
+	if (ppp->vj)
+		proto = ppp_vj_compress(ppp->vj, header->info, &infolen,
+						&offset);
+
+	if (proto == PPP_VJ_COMP_PROTO)
+		ppp->stats.tx_vj_compressed += 1;
+
+	header = (struct ppp_header *) (packet + offset);
+	header->proto = htons(proto);
+
+	ppp_transmit(ppp, (guint8 *) header, infolen);
+}
+
+/* Whether a packet with infolen bytes of information can be queued now */
+gboolean ppp_can_transmit(GAtPPP *ppp, guint infolen)
+{
+	return g_at_hdlc_can_send(ppp->hdlc,
+					infolen + sizeof(struct ppp_header));
+}
+
 static void ppp_dead(GAtPPP *ppp)
 {
 	/* notify interested parties */
@@ -270,6 +399,9 @@ void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
 
 void ppp_ipcp_down_notify(GAtPPP *ppp)
 {
+	ppp_vj_free(ppp->vj);
+	ppp->vj = NULL;
+
 	/* Most likely we failed to create the interface */
 	if (ppp->net == NULL)
 		return;
@@ -338,6 +470,34 @@ void ppp_set_mtu(GAtPPP *ppp, const guint8 *data)
 	ppp->mtu = mtu;
 }
 
+void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc)
+{
+	ppp->xmit_pfc = pfc;
+}
+
+void ppp_set_xmit_acfc(GAtPPP *ppp, gboolean acfc)
+{
+	ppp->xmit_acfc = acfc;
+}
+
+/*
+ * Called by IPCP once it knows how many VJ slots each side agreed to,
+ * zero slots leaves that direction uncompressed
+ */
+void ppp_set_vj_compression(GAtPPP *ppp, guint xmit_slots, gboolean xmit_cid,
+				guint recv_slots)
+{
+	ppp_vj_free(ppp->vj);
+	ppp->vj = NULL;
+
+	if (xmit_slots == 0 && recv_slots == 0)
+		return;
+
+	ppp->vj = ppp_vj_new(xmit_slots, xmit_cid, recv_slots);
+	if (ppp->vj == NULL)
+		g_printerr("Unable to set up VJ compression\n");
+}
+
 static void io_disconnect(gpointer user_data)
 {
 	GAtPPP *ppp = user_data;
@@ -399,6 +559,16 @@ void g_at_ppp_set_recording(GAtPPP *ppp, const char *filename)
 	g_at_hdlc_set_recording(ppp->hdlc, filename);
 }
 
+gboolean g_at_ppp_get_stats(GAtPPP *ppp, GAtPPPStats *stats)
+{
+	if (ppp == NULL || stats == NULL)
+		return FALSE;
+
+	memcpy(stats, &ppp->stats, sizeof(*stats));
+
+	return g_at_hdlc_get_stats(ppp->hdlc, &stats->hdlc);
+}
+
 void g_at_ppp_set_connect_function(GAtPPP *ppp, GAtPPPConnectFunc func,
 							gpointer user_data)
 {
@@ -463,6 +633,8 @@ void g_at_ppp_unref(GAtPPP *ppp)
 	if (ppp->chap)
 		ppp_chap_free(ppp->chap);
 
+	ppp_vj_free(ppp->vj);
+
 	lcp_free(ppp->lcp);
 	ipcp_free(ppp->ipcp);
 
@@ -43,6 +43,16 @@ typedef enum _GAtPPPDisconnectReason {
 	G_AT_PPP_REASON_LOCAL_CLOSE,	/* Normal user close */
 } GAtPPPDisconnectReason;
 
+typedef struct _GAtPPPStats {
+	guint64 tx_ip_packets;		/* IP packets sent */
+	guint64 tx_ip_bytes;		/* Their size before compression */
+	guint64 tx_vj_compressed;	/* Sent with compressed TCP/IP headers */
+	guint64 rx_ip_packets;		/* IP packets received */
+	guint64 rx_ip_bytes;		/* Their size after decompression */
+	guint64 rx_discarded;		/* Malformed or unexpected frames */
+	GAtHDLCStats hdlc;		/* Framing level counters */
+} GAtPPPStats;
+
 typedef void (*GAtPPPConnectFunc)(const char *iface, const char *local,
 					const char *peer,
 					const char *dns1, const char *dns2,
@@ -72,6 +82,8 @@ const char *g_at_ppp_get_password(GAtPPP *ppp);
 
 void g_at_ppp_set_recording(GAtPPP *ppp, const char *filename);
 
+gboolean g_at_ppp_get_stats(GAtPPP *ppp, GAtPPPStats *stats);
+
 void g_at_ppp_set_server_info(GAtPPP *ppp, const char *remote_ip,
 				const char *dns1, const char *dns2);
 
@@ -23,29 +23,63 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdarg.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
 
 #include <glib.h>
 
 #include "ringbuffer.h"
+#include "gatutil.h"
 #include "gatrawip.h"
 
+/* Largest IP packet, a TUN read into anything smaller may truncate */
+#define RAWIP_MAX_PACKET 65535
+
+/* Room for a few maximum sized packets queued towards the modem */
+#define RAWIP_BUFFER_SIZE (4 * 65536)
+
+/* Packets taken off the TUN device per wakeup */
+#define RAWIP_MAX_BURST 32
+
 struct _GAtRawIP {
 	gint ref_count;
 	GAtIO *io;
-	GAtIO *tun_io;
+	GIOChannel *tun_channel;
+	int tun_fd;
+	guint tun_read_watch;
+	guint tun_write_watch;
 	char *ifname;
 	struct ring_buffer *write_buffer;
 	struct ring_buffer *tun_write_buffer;
+	gsize discarded;			/* Bytes skipped to resync */
 	GAtDebugFunc debugf;
 	gpointer debug_data;
 };
 
+static void debug(GAtRawIP *rawip, const char *format, ...)
+{
+	char str[256];
+	va_list ap;
+
+	if (rawip->debugf == NULL)
+		return;
+
+	va_start(ap, format);
+
+	if (vsnprintf(str, sizeof(str), format, ap) > 0)
+		rawip->debugf(str, rawip->debug_data);
+
+	va_end(ap);
+}
+
 GAtRawIP *g_at_rawip_new(GIOChannel *channel)
 {
 	GAtRawIP *rawip;
@@ -71,6 +105,7 @@ GAtRawIP *g_at_rawip_new_from_io(GAtIO *io)
 		return NULL;
 
 	rawip->ref_count = 1;
+	rawip->tun_fd = -1;
 
 	rawip->write_buffer = NULL;
 	rawip->tun_write_buffer = NULL;
@@ -109,81 +144,276 @@ void g_at_rawip_unref(GAtRawIP *rawip)
 	g_free(rawip);
 }
 
+static unsigned int read_u16(struct ring_buffer *rbuf, unsigned int offset)
+{
+	return *ring_buffer_read_ptr(rbuf, offset) << 8 |
+			*ring_buffer_read_ptr(rbuf, offset + 1);
+}
+
+/* Whether the IPv4 header at the start of the buffer sums up correctly */
+static gboolean ipv4_header_valid(struct ring_buffer *rbuf,
+					unsigned int hlen)
+{
+	guint32 sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < hlen; i += 2)
+		sum += read_u16(rbuf, i);
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum == 0xffff;
+}
+
+/*
+ * Returns the length of the IP packet at the start of the buffer, 0 if not
+ * enough of its header arrived yet or -1 if the buffer doesn't start with
+ * a plausible IP header.
+ */
+static int packet_length(struct ring_buffer *rbuf, unsigned int len)
+{
+	unsigned int total;
+	unsigned int hlen;
+
+	switch (*ring_buffer_read_ptr(rbuf, 0) >> 4) {
+	case 4:
+		hlen = (*ring_buffer_read_ptr(rbuf, 0) & 0x0f) * 4;
+		if (hlen < 20)
+			return -1;
+
+		if (len < hlen)
+			return 0;
+
+		total = read_u16(rbuf, 2);
+		if (total < hlen)
+			return -1;
+
+		if (ipv4_header_valid(rbuf, hlen) == FALSE)
+			return -1;
+
+		break;
+	case 6:
+		if (len < 6)
+			return 0;
+
+		total = 40 + read_u16(rbuf, 4);
+		break;
+	default:
+		return -1;
+	}
+
+	if (total > (unsigned int) ring_buffer_capacity(rbuf))
+		return -1;
+
+	return total;
+}
+
+static void tun_read_start(GAtRawIP *rawip);
+
 static gboolean can_write_data(gpointer data)
 {
 	GAtRawIP *rawip = data;
-	unsigned int len;
-	unsigned char *buf;
+	struct iovec iov[2];
 	gsize bytes_written;
+	int count;
 
 	if (rawip->write_buffer == NULL)
 		return FALSE;
 
-	len = ring_buffer_len_no_wrap(rawip->write_buffer);
-	buf = ring_buffer_read_ptr(rawip->write_buffer, 0);
-
-	bytes_written = g_at_io_write(rawip->io, (gchar *) buf, len);
+	count = ring_buffer_read_iov(rawip->write_buffer, iov);
+	bytes_written = g_at_io_writev(rawip->io, iov, count);
 	ring_buffer_drain(rawip->write_buffer, bytes_written);
 
+	if (rawip->tun_read_watch == 0 &&
+			ring_buffer_avail(rawip->write_buffer) >=
+				RAWIP_MAX_PACKET)
+		tun_read_start(rawip);
+
 	if (ring_buffer_len(rawip->write_buffer) > 0)
 		return TRUE;
 
-	rawip->write_buffer = NULL;
-
 	return FALSE;
 }
 
-static gboolean tun_write_data(gpointer data)
+/*
+ * The TUN device takes exactly one packet per write, so cut the stream
+ * from the modem at the boundaries given by the IP headers.  Returns TRUE
+ * if the device is busy and complete packets are still waiting.
+ */
+static gboolean tun_write_packets(GAtRawIP *rawip)
 {
-	GAtRawIP *rawip = data;
+	struct ring_buffer *rbuf = rawip->tun_write_buffer;
+	struct iovec iov[2];
+	unsigned int skipped = 0;
 	unsigned int len;
-	unsigned char *buf;
-	gsize bytes_written;
+	ssize_t written;
+	int plen;
 
-	if (rawip->tun_write_buffer == NULL)
+	if (rbuf == NULL)
 		return FALSE;
 
-	len = ring_buffer_len_no_wrap(rawip->tun_write_buffer);
-	buf = ring_buffer_read_ptr(rawip->tun_write_buffer, 0);
+	while ((len = ring_buffer_len(rbuf)) > 0) {
+		plen = packet_length(rbuf, len);
 
-	bytes_written = g_at_io_write(rawip->tun_io, (gchar *) buf, len);
-	ring_buffer_drain(rawip->tun_write_buffer, bytes_written);
+		/* Out of step, look for the next header a byte further on */
+		if (plen < 0) {
+			ring_buffer_drain(rbuf, 1);
+			skipped += 1;
+			continue;
+		}
 
-	if (ring_buffer_len(rawip->tun_write_buffer) > 0)
-		return TRUE;
+		if (skipped > 0) {
+			debug(rawip, "Skipped %u bytes of unframed data",
+					skipped);
+			rawip->discarded += skipped;
+			skipped = 0;
+		}
 
-	rawip->tun_write_buffer = NULL;
+		if (plen == 0 || (unsigned int) plen > len)
+			break;
+
+		iov[0].iov_base = ring_buffer_read_ptr(rbuf, 0);
+		iov[0].iov_len = MIN(plen, ring_buffer_len_no_wrap(rbuf));
+		iov[1].iov_base = ring_buffer_read_ptr(rbuf, iov[0].iov_len);
+		iov[1].iov_len = plen - iov[0].iov_len;
+
+		written = writev(rawip->tun_fd, iov,
+					iov[1].iov_len > 0 ? 2 : 1);
+
+		if (written < 0 && errno == EINTR)
+			continue;
+
+		if (written < 0 && errno == EAGAIN)
+			return TRUE;
+
+		/* A packet the device refuses must not hold up the rest */
+		if (written < 0)
+			debug(rawip, "Dropping %d byte packet: %s", plen,
+					strerror(errno));
+
+		ring_buffer_drain(rbuf, plen);
+	}
+
+	if (skipped > 0) {
+		debug(rawip, "Skipped %u bytes of unframed data", skipped);
+		rawip->discarded += skipped;
+	}
 
 	return FALSE;
 }
 
-static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
+static gboolean tun_write_data(GIOChannel *channel, GIOCondition cond,
+				gpointer data)
 {
-	GAtRawIP *rawip = user_data;
+	GAtRawIP *rawip = data;
 
-	rawip->tun_write_buffer = rbuf;
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		return FALSE;
+
+	return tun_write_packets(rawip);
+}
+
+static void tun_write_destroy(gpointer data)
+{
+	GAtRawIP *rawip = data;
 
-	g_at_io_set_write_handler(rawip->tun_io, tun_write_data, rawip);
+	rawip->tun_write_watch = 0;
 }
 
-static void tun_bytes(struct ring_buffer *rbuf, gpointer user_data)
+static gboolean tun_read_data(GIOChannel *channel, GIOCondition cond,
+				gpointer data)
+{
+	GAtRawIP *rawip = data;
+	struct ring_buffer *wbuf = rawip->write_buffer;
+	struct iovec iov[2];
+	unsigned int avail;
+	ssize_t rbytes;
+	int count;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		return FALSE;
+
+	/*
+	 * Each read returns a single packet, straight into the space left
+	 * in the buffer towards the modem.  Keep going while there is room
+	 * for a full sized one so that a burst goes out in one write.
+	 */
+	for (count = 0; count < RAWIP_MAX_BURST; count++) {
+		avail = ring_buffer_avail(wbuf);
+
+		if (avail < RAWIP_MAX_PACKET)
+			break;
+
+		iov[0].iov_base = ring_buffer_write_ptr(wbuf, 0);
+		iov[0].iov_len = ring_buffer_avail_no_wrap(wbuf);
+		iov[1].iov_base = ring_buffer_write_ptr(wbuf, iov[0].iov_len);
+		iov[1].iov_len = avail - iov[0].iov_len;
+
+		rbytes = readv(rawip->tun_fd, iov, 2);
+
+		if (rbytes < 0 && errno == EINTR)
+			continue;
+
+		if (rbytes <= 0)
+			break;
+
+		ring_buffer_write_advance(wbuf, rbytes);
+	}
+
+	if (ring_buffer_len(wbuf) > 0)
+		g_at_io_set_write_handler(rawip->io, can_write_data, rawip);
+
+	/* Resumed by can_write_data once the modem caught up */
+	if (ring_buffer_avail(wbuf) < RAWIP_MAX_PACKET)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void tun_read_destroy(gpointer data)
+{
+	GAtRawIP *rawip = data;
+
+	rawip->tun_read_watch = 0;
+}
+
+static void tun_read_start(GAtRawIP *rawip)
+{
+	rawip->tun_read_watch = g_io_add_watch_full(rawip->tun_channel,
+				G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				tun_read_data, rawip, tun_read_destroy);
+}
+
+static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 {
 	GAtRawIP *rawip = user_data;
 
-	rawip->write_buffer = rbuf;
+	rawip->tun_write_buffer = rbuf;
+
+	/* Still waiting for the device to take the previous packets */
+	if (rawip->tun_write_watch > 0)
+		return;
+
+	if (tun_write_packets(rawip) == FALSE)
+		return;
 
-	g_at_io_set_write_handler(rawip->io, can_write_data, rawip);
+	rawip->tun_write_watch = g_io_add_watch_full(rawip->tun_channel,
+				G_PRIORITY_HIGH,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				tun_write_data, rawip, tun_write_destroy);
 }
 
-static void create_tun(GAtRawIP *rawip)
+/* Returns the descriptor of a new TUN device and fills in its name */
+static int create_tun(char *ifname)
 {
-	GIOChannel *channel;
 	struct ifreq ifr;
 	int fd, err;
 
 	fd = open("/dev/net/tun", O_RDWR);
 	if (fd < 0)
-		return;
+		return -1;
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
@@ -192,34 +422,63 @@ static void create_tun(GAtRawIP *rawip)
 	err = ioctl(fd, TUNSETIFF, (void *) &ifr);
 	if (err < 0) {
 		close(fd);
-		return;
+		return -1;
 	}
 
-	rawip->ifname = g_strdup(ifr.ifr_name);
+	strcpy(ifname, ifr.ifr_name);
 
-	channel = g_io_channel_unix_new(fd);
-	if (channel == NULL) {
-		close(fd);
+	return fd;
+}
+
+void g_at_rawip_open(GAtRawIP *rawip)
+{
+	char ifname[IFNAMSIZ];
+	int fd;
+
+	if (rawip == NULL)
 		return;
-	}
 
-	rawip->tun_io = g_at_io_new(channel);
+	fd = create_tun(ifname);
+	if (fd < 0)
+		return;
 
-	g_io_channel_unref(channel);
+	g_at_rawip_open_fd(rawip, fd, ifname);
 }
 
-void g_at_rawip_open(GAtRawIP *rawip)
+void g_at_rawip_open_fd(GAtRawIP *rawip, int fd, const char *ifname)
 {
-	if (rawip == NULL)
+	GIOChannel *channel;
+
+	if (rawip == NULL) {
+		close(fd);
+		return;
+	}
+
+	channel = g_io_channel_unix_new(fd);
+	if (channel == NULL) {
+		close(fd);
 		return;
+	}
 
-	create_tun(rawip);
+	if (!g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK)) {
+		g_io_channel_unref(channel);
+		close(fd);
+		return;
+	}
 
-	if (rawip->tun_io == NULL)
+	rawip->write_buffer = ring_buffer_new(RAWIP_BUFFER_SIZE);
+	if (rawip->write_buffer == NULL) {
+		g_io_channel_unref(channel);
 		return;
+	}
+
+	g_free(rawip->ifname);
+	rawip->ifname = g_strdup(ifname);
+	rawip->tun_channel = channel;
+	rawip->tun_fd = fd;
 
 	g_at_io_set_read_handler(rawip->io, new_bytes, rawip);
-	g_at_io_set_read_handler(rawip->tun_io, tun_bytes, rawip);
+	tun_read_start(rawip);
 }
 
 void g_at_rawip_shutdown(GAtRawIP *rawip)
@@ -227,17 +486,24 @@ void g_at_rawip_shutdown(GAtRawIP *rawip)
 	if (rawip == NULL)
 		return;
 
-	if (rawip->tun_io == NULL)
+	if (rawip->tun_channel == NULL)
 		return;
 
 	g_at_io_set_read_handler(rawip->io, NULL, NULL);
-	g_at_io_set_read_handler(rawip->tun_io, NULL, NULL);
 
+	if (rawip->tun_read_watch > 0)
+		g_source_remove(rawip->tun_read_watch);
+
+	if (rawip->tun_write_watch > 0)
+		g_source_remove(rawip->tun_write_watch);
+
+	ring_buffer_free(rawip->write_buffer);
 	rawip->write_buffer = NULL;
 	rawip->tun_write_buffer = NULL;
 
-	g_at_io_unref(rawip->tun_io);
-	rawip->tun_io = NULL;
+	g_io_channel_unref(rawip->tun_channel);
+	rawip->tun_channel = NULL;
+	rawip->tun_fd = -1;
 }
 
 const char *g_at_rawip_get_interface(GAtRawIP *rawip)
@@ -248,6 +514,14 @@ const char *g_at_rawip_get_interface(GAtRawIP *rawip)
 	return rawip->ifname;
 }
 
+gsize g_at_rawip_get_discarded(GAtRawIP *rawip)
+{
+	if (rawip == NULL)
+		return 0;
+
+	return rawip->discarded;
+}
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data)
 {
@@ -40,10 +40,19 @@ GAtRawIP *g_at_rawip_ref(GAtRawIP *rawip);
 void g_at_rawip_unref(GAtRawIP *rawip);
 
 void g_at_rawip_open(GAtRawIP *rawip);
+
+/*
+ * Same as g_at_rawip_open, but on a TUN device that is already set up, e.g.
+ * one handed over by a more privileged process.  Takes over fd in any case.
+ */
+void g_at_rawip_open_fd(GAtRawIP *rawip, int fd, const char *ifname);
 void g_at_rawip_shutdown(GAtRawIP *rawip);
 
 const char *g_at_rawip_get_interface(GAtRawIP *rawip);
 
+/* Bytes from the modem skipped because they didn't start an IP packet */
+gsize g_at_rawip_get_discarded(GAtRawIP *rawip);
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data);
 
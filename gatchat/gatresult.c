@@ -37,44 +37,41 @@ void g_at_result_iter_init(GAtResultIter *iter, GAtResult *result)
 	iter->pre.data = NULL;
 	iter->l = &iter->pre;
 	iter->line_pos = 0;
+	iter->line_len = 0;
 }
 
 gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
 {
 	char *line;
 	int prefix_len = prefix ? strlen(prefix) : 0;
-	int linelen;
+	unsigned int linelen;
 
 	while ((iter->l = iter->l->next)) {
 		line = iter->l->data;
-		linelen = strlen(line);
 
-		if (linelen > G_AT_RESULT_LINE_LENGTH_MAX)
+		if (prefix_len && strncmp(line, prefix, prefix_len) != 0)
 			continue;
 
-		if (prefix_len == 0) {
-			iter->line_pos = 0;
-			goto out;
-		}
+		linelen = strlen(line);
 
-		if (g_str_has_prefix(line, prefix) == FALSE)
+		/* Fields are copied out at their offset into iter->buf */
+		if (linelen > G_AT_RESULT_LINE_LENGTH_MAX)
 			continue;
 
+		iter->line_len = linelen;
 		iter->line_pos = prefix_len;
 
-		while (iter->line_pos < strlen(line) &&
+		if (prefix_len == 0)
+			return TRUE;
+
+		while (iter->line_pos < linelen &&
 			line[iter->line_pos] == ' ')
 			iter->line_pos += 1;
 
-		goto out;
+		return TRUE;
 	}
 
 	return FALSE;
-
-out:
-	/* Already checked the length to be no more than buflen */
-	strcpy(iter->buf, line);
-	return TRUE;
 }
 
 const char *g_at_result_iter_raw_line(GAtResultIter *iter)
@@ -105,6 +102,16 @@ static inline int skip_to_next_field(const char *line, int pos, int len)
 	return pos;
 }
 
+/* Copy a field out of the line so that it can be terminated */
+static const char *terminate_field(GAtResultIter *iter, const char *line,
+					unsigned int pos, unsigned int end)
+{
+	memcpy(iter->buf + pos, line + pos, end - pos);
+	iter->buf[end] = '\0';
+
+	return iter->buf + pos;
+}
+
 gboolean g_at_result_iter_next_unquoted_string(GAtResultIter *iter,
 						const char **str)
 {
@@ -120,14 +127,13 @@ gboolean g_at_result_iter_next_unquoted_string(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
 	/* Omitted string */
 	if (line[pos] == ',') {
 		end = pos;
-		iter->buf[pos] = '\0';
 		goto out;
 	}
 
@@ -139,21 +145,21 @@ gboolean g_at_result_iter_next_unquoted_string(GAtResultIter *iter,
 	while (end < len && line[end] != ',' && line[end] != ')')
 		end += 1;
 
-	iter->buf[end] = '\0';
-
 out:
 	iter->line_pos = skip_to_next_field(line, end, len);
 
 	if (str)
-		*str = iter->buf + pos;
+		*str = terminate_field(iter, line, pos, end);
 
 	return TRUE;
 }
 
-gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
+gboolean g_at_result_iter_next_string_span(GAtResultIter *iter,
+						const char **str, gint *length)
 {
 	unsigned int pos;
 	unsigned int end;
+	unsigned int next;
 	unsigned int len;
 	char *line;
 
@@ -164,14 +170,14 @@ gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
 	/* Omitted string */
 	if (line[pos] == ',') {
 		end = pos;
-		iter->buf[pos] = '\0';
+		next = pos;
 		goto out;
 	}
 
@@ -186,28 +192,47 @@ gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
 	if (line[end] != '"')
 		return FALSE;
 
-	iter->buf[end] = '\0';
-
 	/* Skip " */
-	end += 1;
+	next = end + 1;
 
 out:
-	iter->line_pos = skip_to_next_field(line, end, len);
+	iter->line_pos = skip_to_next_field(line, next, len);
 
 	if (str)
-		*str = iter->buf + pos;
+		*str = line + pos;
+
+	if (length)
+		*length = end - pos;
 
 	return TRUE;
 }
 
-gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
-		const guint8 **str, gint *length)
+gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
+{
+	const char *span;
+	gint length;
+
+	if (g_at_result_iter_next_string_span(iter, &span, &length) == FALSE)
+		return FALSE;
+
+	if (str) {
+		char *line = iter->l->data;
+		unsigned int pos = span - line;
+
+		*str = terminate_field(iter, line, pos, pos + length);
+	}
+
+	return TRUE;
+}
+
+gboolean g_at_result_iter_next_hexstring_span(GAtResultIter *iter,
+						const char **str, gint *length)
 {
 	unsigned int pos;
 	unsigned int end;
+	unsigned int next;
 	unsigned int len;
 	char *line;
-	char *bufpos;
 
 	if (iter == NULL)
 		return FALSE;
@@ -216,15 +241,14 @@ gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
-	bufpos = iter->buf + pos;
 
 	/* Omitted string */
 	if (line[pos] == ',') {
 		end = pos;
-		iter->buf[pos] = '\0';
+		next = pos;
 		goto out;
 	}
 
@@ -239,19 +263,46 @@ gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 	if ((end - pos) & 1)
 		return FALSE;
 
-	*length = (end - pos) / 2;
-
-	for (; pos < end; pos += 2)
-		sscanf(line + pos, "%02hhx", bufpos++);
+	next = end;
 
-	if (line[end] == '"')
-		end += 1;
+	if (line[next] == '"')
+		next += 1;
 
 out:
-	iter->line_pos = skip_to_next_field(line, end, len);
+	iter->line_pos = skip_to_next_field(line, next, len);
+
+	if (str)
+		*str = line + pos;
+
+	if (length)
+		*length = end - pos;
+
+	return TRUE;
+}
+
+gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
+		const guint8 **str, gint *length)
+{
+	const char *hex;
+	gint digits;
+	guint8 *bufpos;
+	gint i;
+
+	if (g_at_result_iter_next_hexstring_span(iter, &hex, &digits) == FALSE)
+		return FALSE;
+
+	/* Decode into the buffer at the offset of the field */
+	bufpos = (guint8 *) iter->buf + (hex - (char *) iter->l->data);
+
+	for (i = 0; i < digits; i += 2)
+		bufpos[i / 2] = g_ascii_xdigit_value(hex[i]) << 4 |
+				g_ascii_xdigit_value(hex[i + 1]);
+
+	if (length)
+		*length = digits / 2;
 
 	if (str)
-		*str = (guint8 *) bufpos - *length;
+		*str = bufpos;
 
 	return TRUE;
 }
@@ -271,7 +322,7 @@ gboolean g_at_result_iter_next_number(GAtResultIter *iter, gint *number)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 	end = pos;
@@ -308,7 +359,7 @@ gboolean g_at_result_iter_next_range(GAtResultIter *iter, gint *min, gint *max)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -352,9 +403,9 @@ out:
 	return TRUE;
 }
 
-static gint skip_until(const char *line, int start, const char delim)
+static gint skip_until(const char *line, int start, int len,
+			const char delim)
 {
-	int len = strlen(line);
 	int i = start;
 
 	while (i < len) {
@@ -377,7 +428,7 @@ static gint skip_until(const char *line, int start, const char delim)
 			continue;
 		}
 
-		i = skip_until(line, i+1, ')');
+		i = skip_until(line, i+1, len, ')');
 
 		if (i < len)
 			i += 1;
@@ -399,12 +450,13 @@ gboolean g_at_result_iter_skip_next(GAtResultIter *iter)
 
 	line = iter->l->data;
 
-	skipped_to = skip_until(line, iter->line_pos, ',');
+	skipped_to = skip_until(line, iter->line_pos, iter->line_len, ',');
 
 	if (skipped_to == iter->line_pos && line[skipped_to] != ',')
 		return FALSE;
 
-	iter->line_pos = skip_to_next_field(line, skipped_to, strlen(line));
+	iter->line_pos = skip_to_next_field(line, skipped_to,
+						iter->line_len);
 
 	return TRUE;
 }
@@ -421,7 +473,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
@@ -431,7 +483,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 
 	iter->line_pos += 1;
 
-	while (iter->line_pos < strlen(line) &&
+	while (iter->line_pos < len &&
 		line[iter->line_pos] == ' ')
 		iter->line_pos += 1;
 
@@ -450,7 +502,7 @@ gboolean g_at_result_iter_close_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
@@ -40,6 +40,7 @@ struct _GAtResultIter {
 	GSList *l;
 	char buf[G_AT_RESULT_LINE_LENGTH_MAX + 1];
 	unsigned int line_pos;
+	unsigned int line_len;
 	GSList pre;
 };
 
@@ -61,6 +62,14 @@ gboolean g_at_result_iter_next_number(GAtResultIter *iter, gint *number);
 gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 		const guint8 **str, gint *length);
 
+/* Like the above, but the result points into the line and is not
+ * terminated.  The hexstring variant returns the undecoded hex digits.
+ */
+gboolean g_at_result_iter_next_string_span(GAtResultIter *iter,
+						const char **str, gint *length);
+gboolean g_at_result_iter_next_hexstring_span(GAtResultIter *iter,
+						const char **str, gint *length);
+
 const char *g_at_result_iter_raw_line(GAtResultIter *iter);
 
 const char *g_at_result_final_response(GAtResult *result);
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -34,8 +35,14 @@
 #include "gatio.h"
 
 #define BUF_SIZE 4096
+/* The max length of information text */
+#define MAX_INFO_SIZE 2048
 /* <cr><lf> + the max length of information text + <cr><lf> */
-#define MAX_TEXT_SIZE 2052
+#define MAX_TEXT_SIZE (MAX_INFO_SIZE + 4)
+/* Maximum number of buffer regions handed to a single writev */
+#define MAX_WRITE_IOV 16
+/* Drained write buffers kept around for reuse */
+#define MAX_SPARE_BUFFERS 4
 /* #define WRITE_SCHEDULER_DEBUG 1 */
 
 enum ParserState {
@@ -110,6 +117,8 @@ struct _GAtServer {
 	gpointer debug_data;			/* Data to pass to debug func */
 	GHashTable *command_list;		/* List of AT commands */
 	GQueue *write_queue;			/* Write buffer queue */
+	GSList *spare_buffers;			/* Drained buffers to reuse */
+	guint num_spare;			/* Length of spare_buffers */
 	guint max_read_attempts;		/* Max reads per select */
 	enum ParserState parser_state;
 	gboolean destroyed;			/* Re-entrancy guard */
@@ -127,17 +136,42 @@ static void server_parse_line(GAtServer *server);
 
 static struct ring_buffer *allocate_next(GAtServer *server)
 {
-	struct ring_buffer *buf = ring_buffer_new(BUF_SIZE);
+	struct ring_buffer *buf;
 
-	if (buf == NULL)
-		return NULL;
+	if (server->spare_buffers) {
+		buf = server->spare_buffers->data;
+		server->spare_buffers = g_slist_delete_link(
+						server->spare_buffers,
+						server->spare_buffers);
+		server->num_spare -= 1;
+
+		ring_buffer_reset(buf);
+	} else {
+		buf = ring_buffer_new(BUF_SIZE);
+
+		if (buf == NULL)
+			return NULL;
+	}
 
 	g_queue_push_tail(server->write_queue, buf);
 
 	return buf;
 }
 
-static void send_common(GAtServer *server, const char *buf, unsigned int len)
+/* Keep a few drained buffers so a burst of output doesn't hit malloc */
+static void release_buffer(GAtServer *server, struct ring_buffer *buf)
+{
+	if (server->num_spare >= MAX_SPARE_BUFFERS) {
+		ring_buffer_free(buf);
+		return;
+	}
+
+	server->spare_buffers = g_slist_prepend(server->spare_buffers, buf);
+	server->num_spare += 1;
+}
+
+/* Append to the write queue without waking up the writer */
+static void queue_data(GAtServer *server, const char *buf, unsigned int len)
 {
 	gsize towrite = len;
 	gsize bytes_written = 0;
@@ -160,8 +194,15 @@ static void send_common(GAtServer *server, const char *buf, unsigned int len)
 		if (ring_buffer_avail(write_buf) == 0 &&
 				bytes_written < towrite)
 			write_buf = allocate_next(server);
+
+		if (write_buf == NULL)
+			break;
 	}
+}
 
+static void send_common(GAtServer *server, const char *buf, unsigned int len)
+{
+	queue_data(server, buf, len);
 	server_wakeup_writer(server);
 }
 
@@ -180,7 +221,7 @@ static void send_result_common(GAtServer *server, const char *result)
 	if (result == NULL)
 		return;
 
-	if (strlen(result) > 2048)
+	if (strlen(result) > MAX_INFO_SIZE)
 		return;
 
 	if (v250.is_v1)
@@ -241,7 +282,7 @@ void g_at_server_send_info(GAtServer *server, const char *line, gboolean last)
 	char r = server->v250.s4;
 	unsigned int len;
 
-	if (strlen(line) > 2048)
+	if (strlen(line) > MAX_INFO_SIZE)
 		return;
 
 	if (last)
@@ -252,6 +293,30 @@ void g_at_server_send_info(GAtServer *server, const char *line, gboolean last)
 	send_common(server, buf, len);
 }
 
+void g_at_server_send_info_batch(GAtServer *server, GSList *lines,
+					gboolean last)
+{
+	char sep[2] = { server->v250.s3, server->v250.s4 };
+	GSList *l;
+
+	for (l = lines; l; l = l->next) {
+		const char *line = l->data;
+		unsigned int len = strlen(line);
+
+		if (len > MAX_INFO_SIZE)
+			continue;
+
+		queue_data(server, sep, sizeof(sep));
+		queue_data(server, line, len);
+
+		/* Like g_at_server_send_info, only a line sent ends it */
+		if (last && l->next == NULL)
+			queue_data(server, sep, sizeof(sep));
+	}
+
+	server_wakeup_writer(server);
+}
+
 static gboolean get_result_value(GAtServer *server, GAtResult *result,
 						const char *command,
 						int min, int max, int *value)
@@ -452,7 +517,9 @@ static void at_command_notify(GAtServer *server, char *command,
 {
 	struct at_command *node;
 	GAtResult result;
+	GSList line;
 
+	/* prefix lives on the caller's stack, the lookup doesn't allocate */
 	node = g_hash_table_lookup(server->command_list, prefix);
 
 	if (node == NULL) {
@@ -460,12 +527,17 @@ static void at_command_notify(GAtServer *server, char *command,
 		return;
 	}
 
-	result.lines = g_slist_prepend(NULL, command);
+	/*
+	 * The result only lives for the duration of the callback, so its
+	 * single line can live on the stack as well
+	 */
+	line.data = command;
+	line.next = NULL;
+
+	result.lines = &line;
 	result.final_or_pdu = 0;
 
 	node->notify(type, &result, node->user_data);
-
-	g_slist_free(result.lines);
 }
 
 static unsigned int parse_extended_command(GAtServer *server, char *buf)
@@ -944,55 +1016,55 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 static gboolean can_write_data(gpointer data)
 {
 	GAtServer *server = data;
-	gsize bytes_written;
-	gsize towrite;
+	struct iovec iov[MAX_WRITE_IOV];
 	struct ring_buffer *write_buf;
-	unsigned char *buf;
-#ifdef WRITE_SCHEDULER_DEBUG
-	int limiter;
-#endif
+	gsize bytes_written;
+	int count = 0;
+	GList *l;
 
 	if (!server->write_queue)
 		return FALSE;
 
-	/* Write data out from the head of the queue */
-	write_buf = g_queue_peek_head(server->write_queue);
+	/* Gather data from as many queued buffers as fit in one write */
+	for (l = server->write_queue->head; l; l = l->next) {
+		if (count + 2 > MAX_WRITE_IOV)
+			break;
 
-	buf = ring_buffer_read_ptr(write_buf, 0);
+		count += ring_buffer_read_iov(l->data, iov + count);
+	}
 
-	towrite = ring_buffer_len_no_wrap(write_buf);
+	if (count == 0)
+		return FALSE;
 
 #ifdef WRITE_SCHEDULER_DEBUG
-	limiter = towrite;
+	count = 1;
 
-	if (limiter > 5)
-		limiter = 5;
+	if (iov[0].iov_len > 5)
+		iov[0].iov_len = 5;
 #endif
 
-	bytes_written = g_at_io_write(server->io,
-			(char *)buf,
-#ifdef WRITE_SCHEDULER_DEBUG
-			limiter
-#else
-			towrite
-#endif
-			);
+	bytes_written = g_at_io_writev(server->io, iov, count);
 
 	if (bytes_written == 0)
 		return FALSE;
 
-	ring_buffer_drain(write_buf, bytes_written);
-
-	/* All data in current buffer is written, free it
-	 * unless it's the last buffer in the queue.
+	/* Free every buffer written out completely, unless it's the last
+	 * buffer in the queue.
 	 */
-	if ((ring_buffer_len(write_buf) == 0) &&
-			(g_queue_get_length(server->write_queue) > 1)) {
-		write_buf = g_queue_pop_head(server->write_queue);
-		ring_buffer_free(write_buf);
+	while (bytes_written > 0) {
 		write_buf = g_queue_peek_head(server->write_queue);
+		bytes_written -= ring_buffer_drain(write_buf, bytes_written);
+
+		if (ring_buffer_len(write_buf) > 0 ||
+				g_queue_get_length(server->write_queue) == 1)
+			break;
+
+		g_queue_pop_head(server->write_queue);
+		release_buffer(server, write_buf);
 	}
 
+	write_buf = g_queue_peek_head(server->write_queue);
+
 	if (ring_buffer_len(write_buf) > 0)
 		return TRUE;
 
@@ -1014,6 +1086,11 @@ static void g_at_server_cleanup(GAtServer *server)
 	/* Cleanup pending data to write */
 	write_queue_free(server->write_queue);
 
+	g_slist_foreach(server->spare_buffers, (GFunc) ring_buffer_free, NULL);
+	g_slist_free(server->spare_buffers);
+	server->spare_buffers = NULL;
+	server->num_spare = 0;
+
 	g_hash_table_destroy(server->command_list);
 	server->command_list = NULL;
 
@@ -113,6 +113,14 @@ void g_at_server_send_unsolicited(GAtServer *server, const char *result);
  */
 void g_at_server_send_info(GAtServer *server, const char *line, gboolean last);
 
+/*
+ * Send several response lines at once, the same as calling
+ * g_at_server_send_info for each of them with 'last' set only for the final
+ * one.  Lines longer than 2048 characters are skipped.
+ */
+void g_at_server_send_info_batch(GAtServer *server, GSList *lines,
+					gboolean last);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <glib.h>
 
 #include "gatsyntax.h"
@@ -55,6 +57,56 @@ enum GSM_PERMISSIVE_STATE {
 	GSM_PERMISSIVE_STATE_PROMPT,
 };
 
+/*
+ * Index of the first of c1 or c2 at or after start, len if there is none.
+ * Lets the feed functions skip over the body of a line in bulk.
+ */
+static gsize find_either(const char *bytes, gsize start, gsize len,
+				char c1, char c2)
+{
+	const char *p = memchr(bytes + start, c1, len - start);
+	gsize end = p ? (gsize) (p - bytes) : len;
+
+	if (c2 == c1)
+		return end;
+
+	p = memchr(bytes + start, c2, end - start);
+
+	return p ? (gsize) (p - bytes) : end;
+}
+
+/* Count the bytes fed, line_end is relative to the previous result */
+static GAtSyntaxResult syntax_result(GAtSyntax *syntax, GAtSyntaxResult res,
+					gsize consumed)
+{
+	if (res == G_AT_SYNTAX_RESULT_UNSURE)
+		syntax->fed += consumed;
+	else
+		syntax->fed = 0;
+
+	return res;
+}
+
+static gsize gsmv1_skip(GAtSyntax *syntax, const char *bytes,
+				gsize i, gsize len)
+{
+	switch (syntax->state) {
+	case GSMV1_STATE_RESPONSE:
+		return find_either(bytes, i, len, '\r', '"');
+	case GSMV1_STATE_RESPONSE_STRING:
+		return find_either(bytes, i, len, '"', '"');
+	case GSMV1_STATE_MULTILINE_RESPONSE:
+	case GSMV1_STATE_PDU:
+		return find_either(bytes, i, len, '\r', '\r');
+	case GSMV1_STATE_ECHO:
+		return find_either(bytes, i, len, '\r', 26);
+	case GSMV1_PPP_DATA:
+		return find_either(bytes, i, len, '~', '~');
+	default:
+		return i;
+	}
+}
+
 static void gsmv1_hint(GAtSyntax *syntax, GAtSyntaxExpectHint hint)
 {
 	switch (hint) {
@@ -76,7 +128,13 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 	GAtSyntaxResult res = G_AT_SYNTAX_RESULT_UNSURE;
 
 	while (i < *len) {
-		char byte = bytes[i];
+		char byte;
+
+		i = gsmv1_skip(syntax, bytes, i, *len);
+		if (i == *len)
+			break;
+
+		byte = bytes[i];
 
 		switch (syntax->state) {
 		case GSMV1_STATE_IDLE:
@@ -122,6 +180,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 			syntax->state = GSMV1_STATE_IDLE;
 
 			if (byte == '\n') {
+				/* The CR was the byte before this one */
+				syntax->line_end = syntax->fed + i - 1;
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_LINE;
 			} else
@@ -145,6 +205,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 			syntax->state = GSMV1_STATE_IDLE;
 
 			if (byte == '\n') {
+				/* The CR was the byte before this one */
+				syntax->line_end = syntax->fed + i - 1;
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_MULTILINE;
 			} else
@@ -182,6 +244,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 			syntax->state = GSMV1_STATE_IDLE;
 
 			if (byte == '\n') {
+				/* The CR was the byte before this one */
+				syntax->line_end = syntax->fed + i - 1;
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_PDU;
 			} else
@@ -198,7 +262,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 			}
 
 			syntax->state = GSMV1_STATE_RESPONSE;
-			return G_AT_SYNTAX_RESULT_UNSURE;
+			return syntax_result(syntax, G_AT_SYNTAX_RESULT_UNSURE,
+						*len);
 
 		case GSMV1_STATE_ECHO:
 			/* This handles the case of echo of the PDU terminated
@@ -232,7 +297,22 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 
 out:
 	*len = i;
-	return res;
+	return syntax_result(syntax, res, i);
+}
+
+static gsize gsm_permissive_skip(GAtSyntax *syntax, const char *bytes,
+					gsize i, gsize len)
+{
+	switch (syntax->state) {
+	case GSM_PERMISSIVE_STATE_RESPONSE:
+		return find_either(bytes, i, len, '\r', '"');
+	case GSM_PERMISSIVE_STATE_RESPONSE_STRING:
+		return find_either(bytes, i, len, '"', '"');
+	case GSM_PERMISSIVE_STATE_PDU:
+		return find_either(bytes, i, len, '\r', '\r');
+	default:
+		return i;
+	}
 }
 
 static void gsm_permissive_hint(GAtSyntax *syntax, GAtSyntaxExpectHint hint)
@@ -248,7 +328,13 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 	GAtSyntaxResult res = G_AT_SYNTAX_RESULT_UNSURE;
 
 	while (i < *len) {
-		char byte = bytes[i];
+		char byte;
+
+		i = gsm_permissive_skip(syntax, bytes, i, *len);
+		if (i == *len)
+			break;
+
+		byte = bytes[i];
 
 		switch (syntax->state) {
 		case GSM_PERMISSIVE_STATE_IDLE:
@@ -264,6 +350,7 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 			if (byte == '\r') {
 				syntax->state = GSM_PERMISSIVE_STATE_IDLE;
 
+				syntax->line_end = syntax->fed + i;
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_LINE;
 				goto out;
@@ -286,6 +373,7 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 			if (byte == '\r') {
 				syntax->state = GSM_PERMISSIVE_STATE_IDLE;
 
+				syntax->line_end = syntax->fed + i;
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_PDU;
 				goto out;
@@ -301,7 +389,8 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 			}
 
 			syntax->state = GSM_PERMISSIVE_STATE_RESPONSE;
-			return G_AT_SYNTAX_RESULT_UNSURE;
+			return syntax_result(syntax, G_AT_SYNTAX_RESULT_UNSURE,
+						*len);
 
 		default:
 			break;
@@ -312,7 +401,7 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 
 out:
 	*len = i;
-	return res;
+	return syntax_result(syntax, res, i);
 }
 
 GAtSyntax *g_at_syntax_new_full(GAtSyntaxFeedFunc feed,
@@ -326,6 +415,7 @@ GAtSyntax *g_at_syntax_new_full(GAtSyntaxFeedFunc feed,
 	syntax->feed = feed;
 	syntax->set_hint = hint;
 	syntax->state = initial_state;
+	syntax->line_end = -1;
 	syntax->ref_count = 1;
 
 	return syntax;
@@ -57,6 +57,8 @@ struct _GAtSyntax {
 	int state;
 	GAtSyntaxSetHintFunc set_hint;
 	GAtSyntaxFeedFunc feed;
+	gsize fed;		/* Bytes fed since the previous result */
+	gssize line_end;	/* Offset of the line terminator, -1 if unknown */
 };
 
 
@@ -94,6 +94,39 @@ static inline gboolean gsm0710_check_fcs(const guint8 *data, int len,
 	return FALSE;
 }
 
+/*
+ * Undo control byte quoting in place, moving the runs between escapes
+ * down in one go.  Returns the unquoted length.
+ */
+static int gsm0710_advanced_unquote(guint8 *buf, int start, int end)
+{
+	int posn = start;
+	int posn2 = 0;
+	const guint8 *esc;
+	int run;
+
+	while (posn < end) {
+		esc = memchr(buf + posn, 0x7D, end - posn);
+		run = (esc ? esc - buf : end) - posn;
+
+		memmove(buf + posn2, buf + posn, run);
+		posn2 += run;
+		posn += run;
+
+		if (esc == NULL)
+			break;
+
+		++posn;
+
+		if (posn >= end)
+			break;
+
+		buf[posn2++] = buf[posn++] ^ 0x20;
+	}
+
+	return posn2;
+}
+
 int gsm0710_advanced_extract_frame(guint8 *buf, int len,
 					guint8 *out_dlc, guint8 *out_control,
 					guint8 **out_frame, int *out_len)
@@ -101,47 +134,41 @@ int gsm0710_advanced_extract_frame(guint8 *buf, int len,
 	int posn = 0;
 	int posn2;
 	int framelen;
+	guint8 *flag;
 	guint8 dlc;
 	guint8 control;
 
 	while (posn < len) {
-		if (buf[posn] != 0x7E) {
-			posn += 1;
-			continue;
+		flag = memchr(buf + posn, 0x7E, len - posn);
+		if (flag == NULL) {
+			posn = len;
+			break;
 		}
 
+		posn = flag - buf;
+
 		/* Skip additional 0x7E bytes between frames */
 		while ((posn + 1) < len && buf[posn + 1] == 0x7E)
 			posn += 1;
 
 		/* Search for the end of the packet (the next 0x7E byte) */
-		framelen = posn + 1;
-		while (framelen < len && buf[framelen] != 0x7E)
-			framelen += 1;
-
-		if (framelen >= len)
+		flag = memchr(buf + posn + 1, 0x7E, len - posn - 1);
+		if (flag == NULL)
 			break;
 
+		framelen = flag - buf;
+
 		if (framelen < 4) {
 			posn = framelen;
 			continue;
 		}
 
-		/* Undo control byte quoting in the packet */
-		posn2 = 0;
-		++posn;
-		while (posn < framelen) {
-			if (buf[posn] == 0x7D) {
-				++posn;
-
-				if (posn >= framelen)
-					break;
+		posn2 = gsm0710_advanced_unquote(buf, posn + 1, framelen);
+		posn = framelen;
 
-				buf[posn2++] = buf[posn++] ^ 0x20;
-			} else {
-				buf[posn2++] = buf[posn++];
-			}
-		}
+		/* Address, control and FCS at the very least */
+		if (posn2 < 3)
+			continue;
 
 		/* Validate the checksum on the packet header */
 		if (!gsm0710_check_fcs(buf, 2, buf[posn2 - 1]))
@@ -270,9 +270,45 @@ static void no_carrier_notify(GAtResult *result, gpointer user_data)
 	g_at_chat_send(control, buf, none_prefix, power_down, NULL, NULL);
 }
 
+static void print_ppp_stats(GAtPPP *ppp)
+{
+	GAtPPPStats stats;
+
+	if (g_at_ppp_get_stats(ppp, &stats) == FALSE)
+		return;
+
+	g_print("IP packets sent: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT
+		" bytes, %" G_GUINT64_FORMAT " VJ compressed)\n",
+		stats.tx_ip_packets, stats.tx_ip_bytes,
+		stats.tx_vj_compressed);
+	g_print("IP packets received: %" G_GUINT64_FORMAT " (%"
+		G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT
+		" frames discarded)\n", stats.rx_ip_packets,
+		stats.rx_ip_bytes, stats.rx_discarded);
+	g_print("HDLC sent: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+		" bytes on the wire, %" G_GUINT64_FORMAT " escapes, %"
+		G_GUINT64_FORMAT " overruns\n", stats.hdlc.tx_frames,
+		stats.hdlc.tx_wire_bytes, stats.hdlc.tx_escapes,
+		stats.hdlc.tx_overruns);
+	g_print("HDLC received: %" G_GUINT64_FORMAT " frames, %"
+		G_GUINT64_FORMAT " bytes on the wire, %" G_GUINT64_FORMAT
+		" FCS errors, %" G_GUINT64_FORMAT " short, %" G_GUINT64_FORMAT
+		" overruns\n", stats.hdlc.rx_frames,
+		stats.hdlc.rx_wire_bytes, stats.hdlc.rx_fcs_errors,
+		stats.hdlc.rx_short_frames, stats.hdlc.rx_overruns);
+
+	if (stats.hdlc.tx_queue_samples > 0)
+		g_print("Write queue delay: %" G_GUINT64_FORMAT " us average, %"
+			G_GUINT64_FORMAT " us max\n",
+			stats.hdlc.tx_queue_delay_total /
+				stats.hdlc.tx_queue_samples,
+			stats.hdlc.tx_queue_delay_max);
+}
+
 static void ppp_disconnect(GAtPPPDisconnectReason reason, gpointer user_data)
 {
 	g_print("PPP Link down: %d\n", reason);
+	print_ppp_stats(ppp);
 
 	g_at_ppp_unref(ppp);
 	ppp = NULL;
@@ -548,6 +584,9 @@ static int open_serial(void)
 		g_at_chat_set_debug(modem, gsmdial_debug, "Modem");
 	}
 
+	/* Serial ports are plain descriptors, PPP gets to use writev() */
+	g_at_io_set_use_writev(g_at_chat_get_io(modem), TRUE);
+
 	return 0;
 }
 
@@ -590,6 +629,7 @@ static int open_ip(void)
 	g_at_chat_ref(control);
 	modem = control;
 	g_at_chat_set_debug(control, gsmdial_debug, "");
+	g_at_io_set_use_writev(g_at_chat_get_io(modem), TRUE);
 
 	return 0;
 }
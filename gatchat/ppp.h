@@ -25,10 +25,13 @@
 #define CHAP_PROTOCOL	0xc223
 #define IPCP_PROTO	0x8021
 #define PPP_IP_PROTO	0x0021
+#define PPP_VJ_COMP_PROTO	0x002d
+#define PPP_VJ_UNCOMP_PROTO	0x002f
 #define MD5		5
 
 struct ppp_chap;
 struct ppp_net;
+struct ppp_vj;
 
 struct ppp_header {
 	guint8 address;
@@ -101,9 +104,20 @@ void ppp_net_process_packet(struct ppp_net *net, const guint8 *packet);
 void ppp_net_free(struct ppp_net *net);
 gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu);
 
+/* VJ TCP/IP header compression related functions */
+struct ppp_vj *ppp_vj_new(guint xmit_slots, gboolean xmit_cid,
+				guint recv_slots);
+void ppp_vj_free(struct ppp_vj *vj);
+guint16 ppp_vj_compress(struct ppp_vj *vj, guint8 *packet, guint *len,
+				guint *offset);
+const guint8 *ppp_vj_uncompress(struct ppp_vj *vj, guint16 proto,
+					const guint8 *data, gsize len);
+
 /* PPP functions related to main GAtPPP object */
 void ppp_debug(GAtPPP *ppp, const char *str);
 void ppp_transmit(GAtPPP *ppp, guint8 *packet, guint infolen);
+void ppp_transmit_ip(GAtPPP *ppp, guint8 *packet, guint infolen);
+gboolean ppp_can_transmit(GAtPPP *ppp, guint infolen);
 void ppp_set_auth(GAtPPP *ppp, const guint8 *auth_data);
 void ppp_auth_notify(GAtPPP *ppp, gboolean success);
 void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
@@ -116,4 +130,10 @@ void ppp_lcp_finished_notify(GAtPPP *ppp);
 void ppp_set_recv_accm(GAtPPP *ppp, guint32 accm);
 void ppp_set_xmit_accm(GAtPPP *ppp, guint32 accm);
 void ppp_set_mtu(GAtPPP *ppp, const guint8 *data);
+void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc);
+void ppp_set_xmit_acfc(GAtPPP *ppp, gboolean acfc);
+void ppp_set_vj_compression(GAtPPP *ppp, guint xmit_slots, gboolean xmit_cid,
+				guint recv_slots);
 struct ppp_header *ppp_packet_new(gsize infolen, guint16 protocol);
+guint ppp_header_encode(guint8 *packet, gboolean pfc, gboolean acfc);
+guint ppp_header_decode(const guint8 *frame, gsize len, guint16 *proto);
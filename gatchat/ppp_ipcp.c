@@ -54,14 +54,18 @@ enum ipcp_option_types {
 	SECONDARY_NBNS_SERVER	= 132,
 };
 
-/* We request IP_ADDRESS, PRIMARY/SECONDARY DNS & NBNS */
-#define MAX_CONFIG_OPTION_SIZE 5*6
+/* We request IP_ADDRESS, PRIMARY/SECONDARY DNS & NBNS and VJ compression */
+#define MAX_CONFIG_OPTION_SIZE 6*6
 
 #define REQ_OPTION_IPADDR	0x01
 #define REQ_OPTION_DNS1		0x02
 #define REQ_OPTION_DNS2		0x04
 #define REQ_OPTION_NBNS1	0x08
 #define REQ_OPTION_NBNS2	0x10
+#define REQ_OPTION_VJ		0x20
+
+/* Highest VJ slot id we offer, i.e. 16 concurrent TCP connections */
+#define VJ_MAX_SLOT_ID		15
 
 #define MAX_IPCP_FAILURE	100
 
@@ -75,6 +79,11 @@ struct ipcp_data {
 	guint32 dns2;
 	guint32 nbns1;
 	guint32 nbns2;
+	guint8 vj_max_slot;
+	guint8 vj_comp_slot;
+	gboolean peer_vj;
+	guint8 peer_vj_max_slot;
+	guint8 peer_vj_comp_slot;
 	gboolean is_server;
 };
 
@@ -102,14 +111,31 @@ static void ipcp_generate_config_options(struct ipcp_data *ipcp)
 	FILL_IP(ipcp->options, ipcp->req_options & REQ_OPTION_NBNS2,
 					SECONDARY_NBNS_SERVER, &ipcp->nbns2);
 
+	if (ipcp->req_options & REQ_OPTION_VJ) {
+		ipcp->options[len] = IP_COMPRESSION_PROTO;
+		ipcp->options[len + 1] = 6;
+		put_network_short(ipcp->options + len + 2, PPP_VJ_COMP_PROTO);
+		ipcp->options[len + 4] = ipcp->vj_max_slot;
+		ipcp->options[len + 5] = ipcp->vj_comp_slot;
+
+		len += 6;
+	}
+
 	ipcp->options_len = len;
 }
 
+static void ipcp_reset_vj_options(struct ipcp_data *ipcp)
+{
+	ipcp->vj_max_slot = VJ_MAX_SLOT_ID;
+	ipcp->vj_comp_slot = 1;
+	ipcp->peer_vj = FALSE;
+}
+
 static void ipcp_reset_client_config_options(struct ipcp_data *ipcp)
 {
 	ipcp->req_options = REQ_OPTION_IPADDR | REQ_OPTION_DNS1 |
 				REQ_OPTION_DNS2 | REQ_OPTION_NBNS1 |
-				REQ_OPTION_NBNS2;
+				REQ_OPTION_NBNS2 | REQ_OPTION_VJ;
 
 	ipcp->local_addr = 0;
 	ipcp->peer_addr = 0;
@@ -118,16 +144,18 @@ static void ipcp_reset_client_config_options(struct ipcp_data *ipcp)
 	ipcp->nbns1 = 0;
 	ipcp->nbns2 = 0;
 
+	ipcp_reset_vj_options(ipcp);
 	ipcp_generate_config_options(ipcp);
 }
 
 static void ipcp_reset_server_config_options(struct ipcp_data *ipcp)
 {
 	if (ipcp->local_addr != 0)
-		ipcp->req_options = REQ_OPTION_IPADDR;
+		ipcp->req_options = REQ_OPTION_IPADDR | REQ_OPTION_VJ;
 	else
-		ipcp->req_options = 0;
+		ipcp->req_options = REQ_OPTION_VJ;
 
+	ipcp_reset_vj_options(ipcp);
 	ipcp_generate_config_options(ipcp);
 }
 
@@ -166,6 +194,16 @@ static void ipcp_up(struct pppcp_data *pppcp)
 	addr.s_addr = ipcp->dns2;
 	inet_ntop(AF_INET, &addr, dns2, INET_ADDRSTRLEN);
 
+	/*
+	 * We may compress what we send if the peer asked for VJ, and have
+	 * to expect compressed packets if the peer acked our request
+	 */
+	ppp_set_vj_compression(pppcp_get_ppp(pppcp),
+			ipcp->peer_vj ? ipcp->peer_vj_max_slot + 1 : 0,
+			ipcp->peer_vj_comp_slot,
+			ipcp->req_options & REQ_OPTION_VJ ?
+				ipcp->vj_max_slot + 1 : 0);
+
 	ppp_ipcp_up_notify(pppcp_get_ppp(pppcp), local[0] ? local : NULL,
 					peer[0] ? peer : NULL,
 					dns1[0] ? dns1 : NULL,
@@ -232,17 +270,31 @@ static void ipcp_rcn_nak(struct pppcp_data *pppcp,
 	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
 	struct ppp_option_iter iter;
 
-	if (ipcp->is_server)
-		return;
-
 	g_print("Received IPCP NAK\n");
 
 	ppp_option_iter_init(&iter, packet);
 
 	while (ppp_option_iter_next(&iter) == TRUE) {
 		const guint8 *data = ppp_option_iter_get_data(&iter);
+		guint8 type = ppp_option_iter_get_type(&iter);
 
-		switch (ppp_option_iter_get_type(&iter)) {
+		/* The peer would rather have other VJ parameters, or none */
+		if (type == IP_COMPRESSION_PROTO) {
+			if (ppp_option_iter_get_length(&iter) == 4 &&
+				get_host_short(data) == PPP_VJ_COMP_PROTO) {
+				ipcp->req_options |= REQ_OPTION_VJ;
+				ipcp->vj_max_slot = data[2];
+				ipcp->vj_comp_slot = data[3];
+			} else
+				ipcp->req_options &= ~REQ_OPTION_VJ;
+
+			continue;
+		}
+
+		if (ipcp->is_server)
+			continue;
+
+		switch (type) {
 		case IP_ADDRESS:
 			g_print("Setting suggested ip addr\n");
 			ipcp->req_options |= REQ_OPTION_IPADDR;
@@ -302,6 +354,9 @@ static void ipcp_rcn_rej(struct pppcp_data *pppcp,
 		case SECONDARY_NBNS_SERVER:
 			ipcp->req_options &= ~REQ_OPTION_NBNS2;
 			break;
+		case IP_COMPRESSION_PROTO:
+			ipcp->req_options &= ~REQ_OPTION_VJ;
+			break;
 		default:
 			break;
 		}
@@ -311,6 +366,28 @@ static void ipcp_rcn_rej(struct pppcp_data *pppcp,
 	pppcp_set_local_options(pppcp, ipcp->options, ipcp->options_len);
 }
 
+/*
+ * Accept the peer's request to receive VJ compressed packets, anything
+ * else it asks for under IP_COMPRESSION_PROTO gets rejected
+ */
+static gboolean ipcp_peer_vj(struct ipcp_data *ipcp,
+				struct ppp_option_iter *iter)
+{
+	const guint8 *data = ppp_option_iter_get_data(iter);
+
+	if (ppp_option_iter_get_length(iter) != 4)
+		return FALSE;
+
+	if (get_host_short(data) != PPP_VJ_COMP_PROTO)
+		return FALSE;
+
+	ipcp->peer_vj = TRUE;
+	ipcp->peer_vj_max_slot = data[2];
+	ipcp->peer_vj_comp_slot = data[3];
+
+	return TRUE;
+}
+
 static enum rcr_result ipcp_server_rcr(struct ipcp_data *ipcp,
 					const struct pppcp_packet *packet,
 					guint8 **new_options, guint16 *new_len)
@@ -328,6 +405,10 @@ static enum rcr_result ipcp_server_rcr(struct ipcp_data *ipcp,
 		const guint8 *data = ppp_option_iter_get_data(&iter);
 		guint8 type = ppp_option_iter_get_type(&iter);
 
+		if (type == IP_COMPRESSION_PROTO &&
+				ipcp_peer_vj(ipcp, &iter) == TRUE)
+			continue;
+
 		switch (type) {
 		case IP_ADDRESS:
 			memcpy(&addr, data, 4);
@@ -400,6 +481,10 @@ static enum rcr_result ipcp_client_rcr(struct ipcp_data *ipcp,
 		const guint8 *data = ppp_option_iter_get_data(&iter);
 		guint8 type = ppp_option_iter_get_type(&iter);
 
+		if (type == IP_COMPRESSION_PROTO &&
+				ipcp_peer_vj(ipcp, &iter) == TRUE)
+			continue;
+
 		switch (type) {
 		case IP_ADDRESS:
 			memcpy(&ipcp->peer_addr, data, 4);
@@ -446,6 +531,9 @@ static enum rcr_result ipcp_rcr(struct pppcp_data *pppcp,
 {
 	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
 
+	/* Only what the peer asks for in its latest request counts */
+	ipcp->peer_vj = FALSE;
+
 	if (ipcp->is_server)
 		return ipcp_server_rcr(ipcp, packet, new_options, new_len);
 	else
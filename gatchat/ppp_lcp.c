@@ -58,11 +58,13 @@ enum lcp_options {
 	ACFC			= 8,
 };
 
-/* Maximum size of all options, we only ever request ACCM and MRU */ 
-#define MAX_CONFIG_OPTION_SIZE 10
+/* Maximum size of all options, we only ever request ACCM, MRU, PFC & ACFC */
+#define MAX_CONFIG_OPTION_SIZE 14
 
 #define REQ_OPTION_ACCM	0x1
 #define REQ_OPTION_MRU	0x2
+#define REQ_OPTION_PFC	0x4
+#define REQ_OPTION_ACFC	0x8
 
 struct lcp_data {
 	guint8 options[MAX_CONFIG_OPTION_SIZE];
@@ -100,12 +102,27 @@ static void lcp_generate_config_options(struct lcp_data *lcp)
 		len += 4;
 	}
 
+	/* PFC and ACFC are flags, they carry no data */
+	if (lcp->req_options & REQ_OPTION_PFC) {
+		lcp->options[len] = PFC;
+		lcp->options[len + 1] = 2;
+
+		len += 2;
+	}
+
+	if (lcp->req_options & REQ_OPTION_ACFC) {
+		lcp->options[len] = ACFC;
+		lcp->options[len + 1] = 2;
+
+		len += 2;
+	}
+
 	lcp->options_len = len;
 }
 
 static void lcp_reset_config_options(struct lcp_data *lcp)
 {
-	lcp->req_options = REQ_OPTION_ACCM;
+	lcp->req_options = REQ_OPTION_ACCM | REQ_OPTION_PFC | REQ_OPTION_ACFC;
 	lcp->accm = 0;
 
 	lcp_generate_config_options(lcp);
@@ -125,10 +142,15 @@ static void lcp_up(struct pppcp_data *pppcp)
 static void lcp_down(struct pppcp_data *pppcp)
 {
 	struct lcp_data *lcp = pppcp_get_data(pppcp);
+	GAtPPP *ppp = pppcp_get_ppp(pppcp);
 
 	lcp_reset_config_options(lcp);
 	pppcp_set_local_options(pppcp, lcp->options, lcp->options_len);
-	ppp_lcp_down_notify(pppcp_get_ppp(pppcp));
+
+	ppp_set_xmit_pfc(ppp, FALSE);
+	ppp_set_xmit_acfc(ppp, FALSE);
+
+	ppp_lcp_down_notify(ppp);
 }
 
 /*
@@ -194,7 +216,32 @@ static void lcp_rcn_nak(struct pppcp_data *pppcp,
 static void lcp_rcn_rej(struct pppcp_data *pppcp,
 				const struct pppcp_packet *packet)
 {
+	struct lcp_data *lcp = pppcp_get_data(pppcp);
+	struct ppp_option_iter iter;
 
+	ppp_option_iter_init(&iter, packet);
+
+	while (ppp_option_iter_next(&iter) == TRUE) {
+		switch (ppp_option_iter_get_type(&iter)) {
+		case ACCM:
+			lcp->req_options &= ~REQ_OPTION_ACCM;
+			break;
+		case MRU:
+			lcp->req_options &= ~REQ_OPTION_MRU;
+			break;
+		case PFC:
+			lcp->req_options &= ~REQ_OPTION_PFC;
+			break;
+		case ACFC:
+			lcp->req_options &= ~REQ_OPTION_ACFC;
+			break;
+		default:
+			break;
+		}
+	}
+
+	lcp_generate_config_options(lcp);
+	pppcp_set_local_options(pppcp, lcp->options, lcp->options_len);
 }
 
 static enum rcr_result lcp_rcr(struct pppcp_data *pppcp,
@@ -203,6 +250,8 @@ static enum rcr_result lcp_rcr(struct pppcp_data *pppcp,
 {
 	GAtPPP *ppp = pppcp_get_ppp(pppcp);
 	struct ppp_option_iter iter;
+	gboolean pfc = FALSE;
+	gboolean acfc = FALSE;
 
 	ppp_option_iter_init(&iter, packet);
 
@@ -272,14 +321,22 @@ static enum rcr_result lcp_rcr(struct pppcp_data *pppcp,
 		case MRU:
 			ppp_set_mtu(ppp, ppp_option_iter_get_data(&iter));
 			break;
-		case MAGIC_NUMBER:
 		case PFC:
+			pfc = TRUE;
+			break;
 		case ACFC:
+			acfc = TRUE;
+			break;
+		case MAGIC_NUMBER:
 			/* don't care */
 			break;
 		}
 	}
 
+	/* The peer asked to receive compressed headers, so we may send them */
+	ppp_set_xmit_pfc(ppp, pfc);
+	ppp_set_xmit_acfc(ppp, acfc);
+
 	return RCR_ACCEPT;
 }
 
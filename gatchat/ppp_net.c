@@ -24,6 +24,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -39,11 +40,13 @@
 #include "ppp.h"
 
 #define MAX_PACKET 1500
+#define MAX_BURST 16
 
 struct ppp_net {
 	GAtPPP *ppp;
 	char *if_name;
 	GIOChannel *channel;
+	int fd;
 	guint watch;
 	gint mtu;
 	struct ppp_header *ppp_packet;
@@ -77,44 +80,65 @@ gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu)
 	return TRUE;
 }
 
+/*
+ * The tun device takes exactly one packet per write, so write straight to
+ * the fd rather than going through the GIOChannel
+ */
 void ppp_net_process_packet(struct ppp_net *net, const guint8 *packet)
 {
-	GIOStatus status;
-	gsize bytes_written;
 	guint16 len;
+	ssize_t written;
 
 	/* find the length of the packet to transmit */
 	len = get_host_short(&packet[2]);
-	status = g_io_channel_write_chars(net->channel, (gchar *) packet,
-						len, &bytes_written, NULL);
+
+	do {
+		written = write(net->fd, packet, len);
+	} while (written < 0 && errno == EINTR);
 }
 
 /*
  * packets received by the tun interface need to be written to
- * the modem.  So, just read a packet, write out to the modem
+ * the modem.  Drain as many as the HDLC layer can take in one go, each is
+ * read right behind the PPP header and encoded from there
  */
 static gboolean ppp_net_callback(GIOChannel *channel, GIOCondition cond,
 				gpointer userdata)
 {
 	struct ppp_net *net = (struct ppp_net *) userdata;
-	GIOStatus status;
-	gsize bytes_read;
-	gchar *buf = (gchar *) net->ppp_packet->info;
+	guint8 *buf = net->ppp_packet->info;
+	ssize_t bytes_read;
+	int i;
 
 	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
 		return FALSE;
 
-	if (cond & G_IO_IN) {
+	if (!(cond & G_IO_IN))
+		return TRUE;
+
+	for (i = 0; i < MAX_BURST; i++) {
+		/* Always take the first one, or the watch fires right away */
+		if (i > 0 && !ppp_can_transmit(net->ppp, net->mtu))
+			break;
+
 		/* leave space to add PPP protocol field */
-		status = g_io_channel_read_chars(channel, buf, net->mtu,
-							&bytes_read, NULL);
-		if (bytes_read > 0)
-			ppp_transmit(net->ppp, (guint8 *) net->ppp_packet,
+		bytes_read = read(net->fd, buf, net->mtu);
+
+		if (bytes_read > 0) {
+			ppp_transmit_ip(net->ppp, (guint8 *) net->ppp_packet,
 					bytes_read);
+			continue;
+		}
+
+		if (bytes_read < 0 && errno == EINTR)
+			continue;
+
+		if (bytes_read < 0 && errno == EAGAIN)
+			break;
 
-		if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN)
-			return FALSE;
+		return FALSE;
 	}
+
 	return TRUE;
 }
 
@@ -160,12 +184,14 @@ struct ppp_net *ppp_net_new(GAtPPP *ppp)
 	if (channel == NULL)
 		goto error;
 
-	if (!g_at_util_setup_io(channel, 0))
+	/* The read side drains the device until it would block */
+	if (!g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK))
 		goto error;
 
 	g_io_channel_set_buffered(channel, FALSE);
 
 	net->channel = channel;
+	net->fd = fd;
 	net->watch = g_io_add_watch(channel,
 			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 			ppp_net_callback, net);
@@ -0,0 +1,592 @@
+/*
+ *
+ *  PPP library with GLib integration
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "gatppp.h"
+#include "ppp.h"
+
+/*
+ * Van Jacobson TCP/IP header compression, RFC 1144.  Each direction keeps
+ * the last header seen on up to 256 TCP connections ("slots") and only
+ * the fields that changed since then are sent over the link.
+ */
+
+/* Largest IP header plus largest TCP header */
+#define VJ_MAX_HDR	120
+#define VJ_MAX_PACKET	2048
+
+/* Bits in the change mask of a compressed header */
+#define NEW_C		0x40
+#define NEW_I		0x20
+#define NEW_S		0x08
+#define NEW_A		0x04
+#define NEW_W		0x02
+#define NEW_U		0x01
+#define TCP_PUSH_BIT	0x10
+
+/* Combinations that can't happen for real and encode common cases */
+#define SPECIAL_I	(NEW_S | NEW_W | NEW_U)
+#define SPECIAL_D	(NEW_S | NEW_A | NEW_W | NEW_U)
+#define SPECIALS_MASK	(NEW_S | NEW_A | NEW_W | NEW_U)
+
+#define TH_FIN		0x01
+#define TH_SYN		0x02
+#define TH_RST		0x04
+#define TH_PUSH		0x08
+#define TH_ACK		0x10
+#define TH_URG		0x20
+
+struct vj_slot {
+	guint8 hdr[VJ_MAX_HDR];
+	guint8 hlen;
+	guint32 stamp;
+};
+
+struct ppp_vj {
+	struct vj_slot *xmit;
+	guint xmit_slots;
+	guint xmit_used;
+	gboolean xmit_cid;
+	gint last_xmit;
+	guint32 clock;
+	struct vj_slot *recv;
+	guint recv_slots;
+	gint last_recv;
+	gboolean toss;
+	guint8 buf[VJ_MAX_PACKET];
+};
+
+static inline void put_network_long(guint8 *p, guint32 val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+#define ip_hdr_len(ip) \
+	(((ip)[0] & 0x0f) * 4)
+
+#define tcp_hdr_len(th) \
+	(((th)[12] >> 4) * 4)
+
+/*
+ * Returns the length of the IP and TCP headers of a packet we can compress
+ * or recover state from, or 0 if the packet is not a plain TCP segment
+ */
+static guint vj_tcp_hdr_len(const guint8 *ip, guint len)
+{
+	guint ihl;
+	guint thl;
+
+	if (len < 40 || (ip[0] >> 4) != 4)
+		return 0;
+
+	ihl = ip_hdr_len(ip);
+	if (ihl < 20 || len < ihl + 20)
+		return 0;
+
+	thl = tcp_hdr_len(ip + ihl);
+	if (thl < 20 || len < ihl + thl)
+		return 0;
+
+	return ihl + thl;
+}
+
+static guint16 ip_checksum(const guint8 *ip, guint len)
+{
+	guint32 sum = 0;
+	guint i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (ip[i] << 8) | ip[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/* Anything above 255 is sent as a zero followed by 16 bits */
+static guint8 *vj_encode(guint8 *cp, guint16 n)
+{
+	if (n >= 256) {
+		*cp++ = 0;
+		*cp++ = n >> 8;
+	}
+
+	*cp++ = n;
+
+	return cp;
+}
+
+/*
+ * Same as above for fields where zero is a valid value, a lone zero would
+ * read as the escape so it goes out in 16 bits as well
+ */
+static guint8 *vj_encodez(guint8 *cp, guint16 n)
+{
+	if (n == 0 || n >= 256) {
+		*cp++ = 0;
+		*cp++ = n >> 8;
+	}
+
+	*cp++ = n;
+
+	return cp;
+}
+
+static gboolean vj_decode(const guint8 **cp, const guint8 *end, guint16 *n)
+{
+	const guint8 *p = *cp;
+
+	if (p >= end)
+		return FALSE;
+
+	if (*p != 0) {
+		*n = *p;
+		*cp = p + 1;
+		return TRUE;
+	}
+
+	if (end - p < 3)
+		return FALSE;
+
+	*n = (p[1] << 8) | p[2];
+	*cp = p + 3;
+
+	return TRUE;
+}
+
+static gint vj_find_slot(struct ppp_vj *vj, const guint8 *ip)
+{
+	const guint8 *th = ip + ip_hdr_len(ip);
+	gint oldest = 0;
+	guint i;
+
+	for (i = 0; i < vj->xmit_used; i++) {
+		const guint8 *oip = vj->xmit[i].hdr;
+		const guint8 *oth = oip + ip_hdr_len(oip);
+
+		/* Addresses and ports identify the connection */
+		if (memcmp(ip + 12, oip + 12, 8) == 0 &&
+				memcmp(th, oth, 4) == 0)
+			return i;
+
+		if (vj->xmit[i].stamp < vj->xmit[oldest].stamp)
+			oldest = i;
+	}
+
+	if (vj->xmit_used < vj->xmit_slots)
+		return -(gint) vj->xmit_used++ - 1;
+
+	/* Reuse the least recently used slot */
+	return -oldest - 1;
+}
+
+/*
+ * Compress the TCP/IP headers of an outgoing IP packet in place.  Returns
+ * the PPP protocol to send it with; if the headers were compressed the
+ * packet now starts offset bytes further in and len is adjusted to match
+ */
+guint16 ppp_vj_compress(struct ppp_vj *vj, guint8 *packet, guint *len,
+				guint *offset)
+{
+	guint8 *ip = packet;
+	guint8 *th;
+	guint8 *oip;
+	guint8 *oth;
+	guint8 deltas[16];
+	guint8 *cp = deltas;
+	guint8 changes = 0;
+	guint8 sum[2];
+	guint32 delta_a;
+	guint32 delta_s;
+	guint16 delta;
+	guint16 olen;
+	guint hlen;
+	guint clen;
+	gint slot;
+	guint8 *out;
+
+	*offset = 0;
+
+	if (vj->xmit == NULL || *len < 40 || ip[9] != IPPROTO_TCP)
+		return PPP_IP_PROTO;
+
+	/* Fragments can't be compressed */
+	if (get_host_short(ip + 6) & 0x3fff)
+		return PPP_IP_PROTO;
+
+	hlen = vj_tcp_hdr_len(ip, *len);
+	if (hlen == 0)
+		return PPP_IP_PROTO;
+
+	th = ip + ip_hdr_len(ip);
+
+	/* Connection setup and teardown always goes out as plain IP */
+	if ((th[13] & (TH_SYN | TH_FIN | TH_RST | TH_ACK)) != TH_ACK)
+		return PPP_IP_PROTO;
+
+	slot = vj_find_slot(vj, ip);
+	if (slot < 0) {
+		slot = -slot - 1;
+		goto uncompressed;
+	}
+
+	oip = vj->xmit[slot].hdr;
+	oth = oip + ip_hdr_len(oip);
+
+	/*
+	 * Version, header length, TOS, fragment bits, TTL, protocol,
+	 * TCP header length and options must all be the same as before
+	 */
+	if (memcmp(ip, oip, 2) != 0 || memcmp(ip + 6, oip + 6, 4) != 0 ||
+			tcp_hdr_len(th) != tcp_hdr_len(oth) ||
+			memcmp(ip + 20, oip + 20, ip_hdr_len(ip) - 20) != 0 ||
+			memcmp(th + 20, oth + 20, tcp_hdr_len(th) - 20) != 0)
+		goto uncompressed;
+
+	if (th[13] & TH_URG) {
+		cp = vj_encodez(cp, get_host_short(th + 18));
+		changes |= NEW_U;
+	} else if (memcmp(th + 18, oth + 18, 2) != 0)
+		goto uncompressed;
+
+	delta = get_host_short(th + 14) - get_host_short(oth + 14);
+	if (delta) {
+		cp = vj_encode(cp, delta);
+		changes |= NEW_W;
+	}
+
+	delta_a = get_host_long(th + 8) - get_host_long(oth + 8);
+	if (delta_a) {
+		if (delta_a > 0xffff)
+			goto uncompressed;
+
+		cp = vj_encode(cp, delta_a);
+		changes |= NEW_A;
+	}
+
+	delta_s = get_host_long(th + 4) - get_host_long(oth + 4);
+	if (delta_s) {
+		if (delta_s > 0xffff)
+			goto uncompressed;
+
+		cp = vj_encode(cp, delta_s);
+		changes |= NEW_S;
+	}
+
+	olen = get_host_short(oip + 2);
+
+	switch (changes) {
+	case 0:
+		/*
+		 * Nothing changed.  Data right after a bare ACK is normal on
+		 * an interactive connection, anything else is most likely a
+		 * retransmission and the peer may have missed the original
+		 */
+		if (get_host_short(ip + 2) != olen && olen == hlen)
+			break;
+
+		goto uncompressed;
+	case SPECIAL_I:
+	case SPECIAL_D:
+		/* The real changes look like a special case encoding */
+		goto uncompressed;
+	case NEW_S | NEW_A:
+		/* Echoed terminal traffic */
+		if (delta_s == delta_a && delta_s == (guint) (olen - hlen)) {
+			changes = SPECIAL_I;
+			cp = deltas;
+		}
+		break;
+	case NEW_S:
+		/* Unidirectional data transfer */
+		if (delta_s == (guint) (olen - hlen)) {
+			changes = SPECIAL_D;
+			cp = deltas;
+		}
+		break;
+	}
+
+	delta = get_host_short(ip + 4) - get_host_short(oip + 4);
+	if (delta != 1) {
+		cp = vj_encodez(cp, delta);
+		changes |= NEW_I;
+	}
+
+	if (th[13] & TH_PUSH)
+		changes |= TCP_PUSH_BIT;
+
+	memcpy(sum, th + 16, 2);
+	memcpy(oip, ip, hlen);
+	vj->xmit[slot].hlen = hlen;
+	vj->xmit[slot].stamp = ++vj->clock;
+
+	clen = cp - deltas + 3;
+
+	if (vj->xmit_cid == FALSE || vj->last_xmit != slot) {
+		changes |= NEW_C;
+		clen += 1;
+	}
+
+	/* The compressed header ends right where the payload starts */
+	out = packet + hlen - clen;
+	*out++ = changes;
+
+	if (changes & NEW_C)
+		*out++ = slot;
+
+	*out++ = sum[0];
+	*out++ = sum[1];
+	memcpy(out, deltas, cp - deltas);
+
+	vj->last_xmit = slot;
+	*offset = hlen - clen;
+	*len -= hlen - clen;
+
+	return PPP_VJ_COMP_PROTO;
+
+uncompressed:
+	memcpy(vj->xmit[slot].hdr, ip, hlen);
+	vj->xmit[slot].hlen = hlen;
+	vj->xmit[slot].stamp = ++vj->clock;
+	vj->last_xmit = slot;
+
+	/* The protocol field carries the slot, the peer puts TCP back */
+	ip[9] = slot;
+
+	return PPP_VJ_UNCOMP_PROTO;
+}
+
+static const guint8 *vj_uncompress_tcp(struct ppp_vj *vj,
+					const guint8 *data, gsize len)
+{
+	guint hlen = vj_tcp_hdr_len(data, len);
+	guint8 slot = data[9];
+
+	if (hlen == 0 || slot >= vj->recv_slots)
+		return NULL;
+
+	if (len > sizeof(vj->buf) || get_host_short(data + 2) > len)
+		return NULL;
+
+	memcpy(vj->buf, data, len);
+	vj->buf[9] = IPPROTO_TCP;
+
+	memcpy(vj->recv[slot].hdr, vj->buf, hlen);
+	vj->recv[slot].hlen = hlen;
+	vj->last_recv = slot;
+	vj->toss = FALSE;
+
+	return vj->buf;
+}
+
+static const guint8 *vj_uncompress_comp(struct ppp_vj *vj,
+					const guint8 *data, gsize len)
+{
+	const guint8 *cp = data;
+	const guint8 *end = data + len;
+	guint8 changes;
+	guint8 *ip;
+	guint8 *th;
+	guint16 hlen;
+	guint16 total;
+	guint16 delta;
+
+	if (len < 3)
+		return NULL;
+
+	changes = *cp++;
+
+	if (changes & NEW_C) {
+		/* The slot must have been set up by an uncompressed frame */
+		if (*cp >= vj->recv_slots || vj->recv[*cp].hlen == 0)
+			return NULL;
+
+		vj->last_recv = *cp++;
+		vj->toss = FALSE;
+	} else if (vj->toss || vj->last_recv < 0)
+		return NULL;
+
+	ip = vj->recv[vj->last_recv].hdr;
+	hlen = vj->recv[vj->last_recv].hlen;
+	th = ip + ip_hdr_len(ip);
+
+	if (end - cp < 2)
+		return NULL;
+
+	memcpy(th + 16, cp, 2);
+	cp += 2;
+
+	if (changes & TCP_PUSH_BIT)
+		th[13] |= TH_PUSH;
+	else
+		th[13] &= ~TH_PUSH;
+
+	switch (changes & SPECIALS_MASK) {
+	case SPECIAL_I:
+		delta = get_host_short(ip + 2) - hlen;
+		put_network_long(th + 8, get_host_long(th + 8) + delta);
+		put_network_long(th + 4, get_host_long(th + 4) + delta);
+		break;
+	case SPECIAL_D:
+		delta = get_host_short(ip + 2) - hlen;
+		put_network_long(th + 4, get_host_long(th + 4) + delta);
+		break;
+	default:
+		if (changes & NEW_U) {
+			if (vj_decode(&cp, end, &delta) == FALSE)
+				return NULL;
+
+			th[13] |= TH_URG;
+			put_network_short(th + 18, delta);
+		} else
+			th[13] &= ~TH_URG;
+
+		if (changes & NEW_W) {
+			if (vj_decode(&cp, end, &delta) == FALSE)
+				return NULL;
+
+			put_network_short(th + 14,
+					get_host_short(th + 14) + delta);
+		}
+
+		if (changes & NEW_A) {
+			if (vj_decode(&cp, end, &delta) == FALSE)
+				return NULL;
+
+			put_network_long(th + 8, get_host_long(th + 8) + delta);
+		}
+
+		if (changes & NEW_S) {
+			if (vj_decode(&cp, end, &delta) == FALSE)
+				return NULL;
+
+			put_network_long(th + 4, get_host_long(th + 4) + delta);
+		}
+
+		break;
+	}
+
+	if (changes & NEW_I) {
+		if (vj_decode(&cp, end, &delta) == FALSE)
+			return NULL;
+	} else
+		delta = 1;
+
+	put_network_short(ip + 4, get_host_short(ip + 4) + delta);
+
+	if (hlen + (gsize) (end - cp) > sizeof(vj->buf))
+		return NULL;
+
+	total = hlen + (end - cp);
+
+	put_network_short(ip + 2, total);
+	ip[10] = 0;
+	ip[11] = 0;
+	put_network_short(ip + 10, ip_checksum(ip, ip_hdr_len(ip)));
+
+	memcpy(vj->buf, ip, hlen);
+	memcpy(vj->buf + hlen, cp, end - cp);
+
+	return vj->buf;
+}
+
+/*
+ * Rebuild the IP packet carried in a VJ compressed or uncompressed TCP
+ * frame.  Returns NULL if the frame has to be dropped, in which case
+ * compressed frames are ignored until the peer refreshes the slot
+ */
+const guint8 *ppp_vj_uncompress(struct ppp_vj *vj, guint16 proto,
+					const guint8 *data, gsize len)
+{
+	const guint8 *packet = NULL;
+
+	if (vj->recv == NULL)
+		return NULL;
+
+	if (proto == PPP_VJ_UNCOMP_PROTO)
+		packet = vj_uncompress_tcp(vj, data, len);
+	else if (proto == PPP_VJ_COMP_PROTO)
+		packet = vj_uncompress_comp(vj, data, len);
+
+	if (packet == NULL)
+		vj->toss = TRUE;
+
+	return packet;
+}
+
+struct ppp_vj *ppp_vj_new(guint xmit_slots, gboolean xmit_cid,
+				guint recv_slots)
+{
+	struct ppp_vj *vj;
+
+	vj = g_try_new0(struct ppp_vj, 1);
+	if (vj == NULL)
+		return NULL;
+
+	if (xmit_slots > 0) {
+		vj->xmit = g_try_new0(struct vj_slot, xmit_slots);
+		if (vj->xmit == NULL)
+			goto error;
+	}
+
+	if (recv_slots > 0) {
+		vj->recv = g_try_new0(struct vj_slot, recv_slots);
+		if (vj->recv == NULL)
+			goto error;
+	}
+
+	vj->xmit_slots = xmit_slots;
+	vj->xmit_cid = xmit_cid;
+	vj->last_xmit = -1;
+	vj->recv_slots = recv_slots;
+	vj->last_recv = -1;
+
+	return vj;
+
+error:
+	g_free(vj->xmit);
+	g_free(vj);
+
+	return NULL;
+}
+
+void ppp_vj_free(struct ppp_vj *vj)
+{
+	if (vj == NULL)
+		return;
+
+	g_free(vj->xmit);
+	g_free(vj->recv);
+	g_free(vj);
+}
@@ -24,6 +24,7 @@
 #endif
 
 #include <string.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -31,14 +32,28 @@
 
 #define MAX_SIZE 262144
 
+/*
+ * The producer owns in and the consumer owns out.  Each side publishes its
+ * own index with release semantics and reads the other one with acquire
+ * semantics, so the data copied before an index update is visible to the
+ * other thread once it sees the new index.  The consumer of a shared buffer
+ * only looks at its own copy of in, taken by ring_buffer_snapshot, so that
+ * its view doesn't change under it while it works through the data.
+ */
+#define load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
 struct ring_buffer {
 	unsigned char *buffer;
 	unsigned int size;
+	unsigned int mask;
 	unsigned int in;
 	unsigned int out;
+	unsigned int visible;
+	gboolean shared;
 };
 
-struct ring_buffer *ring_buffer_new(unsigned int size)
+static struct ring_buffer *buffer_new(unsigned int size, gboolean shared)
 {
 	unsigned int real_size = 1;
 	struct ring_buffer *buffer;
@@ -61,31 +76,81 @@ struct ring_buffer *ring_buffer_new(unsigned int size)
 	}
 
 	buffer->size = real_size;
+	buffer->mask = real_size - 1;
 	buffer->in = 0;
 	buffer->out = 0;
+	buffer->visible = 0;
+	buffer->shared = shared;
 
 	return buffer;
 }
 
+struct ring_buffer *ring_buffer_new(unsigned int size)
+{
+	return buffer_new(size, FALSE);
+}
+
+struct ring_buffer *ring_buffer_new_shared(unsigned int size)
+{
+	return buffer_new(size, TRUE);
+}
+
+/* The end of the data as far as the consumer is concerned */
+static inline unsigned int consumer_in(struct ring_buffer *buf)
+{
+	if (buf->shared)
+		return buf->visible;
+
+	return buf->in;
+}
+
+int ring_buffer_snapshot(struct ring_buffer *buf)
+{
+	unsigned int in;
+	unsigned int len;
+
+	if (buf == NULL)
+		return -1;
+
+	if (buf->shared == FALSE)
+		return 0;
+
+	in = load_acquire(&buf->in);
+	len = in - buf->visible;
+	buf->visible = in;
+
+	return len;
+}
+
+/* Only the consumer of a buffer private to one thread may rewind it */
+static inline void drained(struct ring_buffer *buf, unsigned int out)
+{
+	if (buf->shared == FALSE && out == buf->in)
+		buf->out = buf->in = 0;
+	else
+		store_release(&buf->out, out);
+}
+
 int ring_buffer_write(struct ring_buffer *buf, const void *data,
 			unsigned int len)
 {
 	unsigned int end;
 	unsigned int offset;
 	const unsigned char *d = data; /* Needed to satisfy non-gcc compilers */
+	unsigned int out = load_acquire(&buf->out);
 
 	/* Determine how much we can actually write */
-	len = MIN(len, buf->size - buf->in + buf->out);
+	len = MIN(len, buf->size - buf->in + out);
 
 	/* Determine how much to write before wrapping */
-	offset = buf->in % buf->size;
+	offset = buf->in & buf->mask;
 	end = MIN(len, buf->size - offset);
 	memcpy(buf->buffer+offset, d, end);
 
 	/* Now put the remainder on the beginning of the buffer */
 	memcpy(buf->buffer, d + end, len - end);
 
-	buf->in += len;
+	store_release(&buf->in, buf->in + len);
 
 	return len;
 }
@@ -93,21 +158,23 @@ int ring_buffer_write(struct ring_buffer *buf, const void *data,
 unsigned char *ring_buffer_write_ptr(struct ring_buffer *buf,
 					unsigned int offset)
 {
-	return buf->buffer + (buf->in + offset) % buf->size;
+	return buf->buffer + ((buf->in + offset) & buf->mask);
 }
 
 int ring_buffer_avail_no_wrap(struct ring_buffer *buf)
 {
-	unsigned int offset = buf->in % buf->size;
-	unsigned int len = buf->size - buf->in + buf->out;
+	unsigned int offset = buf->in & buf->mask;
+	unsigned int len = buf->size - buf->in + load_acquire(&buf->out);
 
 	return MIN(len, buf->size - offset);
 }
 
 int ring_buffer_write_advance(struct ring_buffer *buf, unsigned int len)
 {
-	len = MIN(len, buf->size - buf->in + buf->out);
-	buf->in += len;
+	unsigned int out = load_acquire(&buf->out);
+
+	len = MIN(len, buf->size - buf->in + out);
+	store_release(&buf->in, buf->in + len);
 
 	return len;
 }
@@ -118,40 +185,34 @@ int ring_buffer_read(struct ring_buffer *buf, void *data, unsigned int len)
 	unsigned int offset;
 	unsigned char *d = data;
 
-	len = MIN(len, buf->in - buf->out);
+	len = MIN(len, consumer_in(buf) - buf->out);
 
 	/* Grab data from buffer starting at offset until the end */
-	offset = buf->out % buf->size;
+	offset = buf->out & buf->mask;
 	end = MIN(len, buf->size - offset);
 	memcpy(d, buf->buffer + offset, end);
 
 	/* Now grab remainder from the beginning */
 	memcpy(d + end, buf->buffer, len - end);
 
-	buf->out += len;
-
-	if (buf->out == buf->in)
-		buf->out = buf->in = 0;
+	drained(buf, buf->out + len);
 
 	return len;
 }
 
 int ring_buffer_drain(struct ring_buffer *buf, unsigned int len)
 {
-	len = MIN(len, buf->in - buf->out);
-
-	buf->out += len;
+	len = MIN(len, consumer_in(buf) - buf->out);
 
-	if (buf->out == buf->in)
-		buf->out = buf->in = 0;
+	drained(buf, buf->out + len);
 
 	return len;
 }
 
 int ring_buffer_len_no_wrap(struct ring_buffer *buf)
 {
-	unsigned int offset = buf->out % buf->size;
-	unsigned int len = buf->in - buf->out;
+	unsigned int offset = buf->out & buf->mask;
+	unsigned int len = consumer_in(buf) - buf->out;
 
 	return MIN(len, buf->size - offset);
 }
@@ -159,7 +220,29 @@ int ring_buffer_len_no_wrap(struct ring_buffer *buf)
 unsigned char *ring_buffer_read_ptr(struct ring_buffer *buf,
 					unsigned int offset)
 {
-	return buf->buffer + (buf->out + offset) % buf->size;
+	return buf->buffer + ((buf->out + offset) & buf->mask);
+}
+
+int ring_buffer_read_iov(struct ring_buffer *buf, struct iovec *iov)
+{
+	unsigned int len = consumer_in(buf) - buf->out;
+	unsigned int end;
+
+	if (len == 0)
+		return 0;
+
+	end = MIN(len, buf->size - (buf->out & buf->mask));
+
+	iov[0].iov_base = ring_buffer_read_ptr(buf, 0);
+	iov[0].iov_len = end;
+
+	if (end == len)
+		return 1;
+
+	iov[1].iov_base = buf->buffer;
+	iov[1].iov_len = len - end;
+
+	return 2;
 }
 
 int ring_buffer_len(struct ring_buffer *buf)
@@ -167,7 +250,7 @@ int ring_buffer_len(struct ring_buffer *buf)
 	if (buf == NULL)
 		return -1;
 
-	return buf->in - buf->out;
+	return consumer_in(buf) - buf->out;
 }
 
 void ring_buffer_reset(struct ring_buffer *buf)
@@ -177,6 +260,7 @@ void ring_buffer_reset(struct ring_buffer *buf)
 
 	buf->in = 0;
 	buf->out = 0;
+	buf->visible = 0;
 }
 
 int ring_buffer_avail(struct ring_buffer *buf)
@@ -184,7 +268,7 @@ int ring_buffer_avail(struct ring_buffer *buf)
 	if (buf == NULL)
 		return -1;
 
-	return buf->size - buf->in + buf->out;
+	return buf->size - buf->in + load_acquire(&buf->out);
 }
 
 int ring_buffer_capacity(struct ring_buffer *buf)
@@ -20,12 +20,30 @@
  */
 
 struct ring_buffer;
+struct iovec;
 
 /*!
  * Creates a new ring buffer with capacity size
  */
 struct ring_buffer *ring_buffer_new(unsigned int size);
 
+/*!
+ * Creates a new ring buffer with capacity size that one thread may fill
+ * while another one drains it, without locking.  Only the producer may call
+ * the write and avail functions and only the consumer the read, drain, len
+ * and snapshot functions.  Unlike private buffers it is never rewound when
+ * empty.
+ */
+struct ring_buffer *ring_buffer_new_shared(unsigned int size);
+
+/*!
+ * Makes the data written to a shared buffer so far visible to the read,
+ * drain and len functions, which don't see anything written after the last
+ * snapshot.  Returns the number of bytes that became visible, always 0 for
+ * private buffers where everything written is visible right away.
+ */
+int ring_buffer_snapshot(struct ring_buffer *buf);
+
 /*!
  * Frees the resources allocated for the ring buffer
  */
@@ -89,6 +107,14 @@ int ring_buffer_read(struct ring_buffer *buf, void *data,
 unsigned char *ring_buffer_read_ptr(struct ring_buffer *buf,
 					unsigned int offset);
 
+/*!
+ * Fills iov with the (at most two) regions holding the data currently in
+ * the buffer, the second one being used only if the data wraps around.
+ * Returns the number of iovec entries filled in.  Use ring_buffer_drain
+ * once the data has been consumed.
+ */
+int ring_buffer_read_iov(struct ring_buffer *buf, struct iovec *iov);
+
 /*!
  * Returns the number of bytes currently available to be read in the buffer
  */
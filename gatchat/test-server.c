@@ -128,11 +128,27 @@ static void ppp_connect(const char *iface, const char *local, const char *peer,
 	execute(buf);
 }
 
+/* gsmdial has the full breakdown, the server side only needs a summary */
+static void print_ppp_stats(GAtPPP *ppp)
+{
+	GAtPPPStats stats;
+
+	if (g_at_ppp_get_stats(ppp, &stats) == FALSE)
+		return;
+
+	g_print("PPP sent %" G_GUINT64_FORMAT " packets, received %"
+		G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT
+		" frames dropped\n", stats.tx_ip_packets, stats.rx_ip_packets,
+		stats.rx_discarded + stats.hdlc.rx_fcs_errors +
+		stats.hdlc.rx_short_frames + stats.hdlc.rx_overruns);
+}
+
 static void ppp_disconnect(GAtPPPDisconnectReason reason, gpointer user)
 {
 	GAtServer *server = user;
 
 	g_print("PPP Link down: %d\n", reason);
+	print_ppp_stats(ppp);
 
 	g_at_ppp_unref(ppp);
 	ppp = NULL;
@@ -56,12 +56,28 @@ struct ofono_gprs_primary_context {
 	enum ofono_gprs_proto proto;
 };
 
+struct ofono_gprs_context_stats {
+	unsigned long long tx_packets;
+	unsigned long long tx_bytes;
+	unsigned long long tx_wire_bytes;	/* Including link framing */
+	unsigned long long tx_dropped;
+	unsigned int tx_queue_delay;		/* Average, in microseconds */
+	unsigned int tx_queue_delay_max;	/* In microseconds */
+	unsigned long long rx_packets;
+	unsigned long long rx_bytes;
+	unsigned long long rx_wire_bytes;	/* Including link framing */
+	unsigned long long rx_errors;
+};
+
 typedef void (*ofono_gprs_context_cb_t)(const struct ofono_error *error,
 					void *data);
 typedef void (*ofono_gprs_context_up_cb_t)(const struct ofono_error *error,
 				const char *interface, ofono_bool_t static_ip,
 				const char *address, const char *netmask,
 				const char *gw, const char **dns, void *data);
+typedef void (*ofono_gprs_context_stats_cb_t)(const struct ofono_error *error,
+			const struct ofono_gprs_context_stats *stats,
+			void *data);
 
 struct ofono_gprs_context_driver {
 	const char *name;
@@ -74,6 +90,8 @@ struct ofono_gprs_context_driver {
 	void (*deactivate_primary)(struct ofono_gprs_context *gc,
 					unsigned int id,
 					ofono_gprs_context_cb_t cb, void *data);
+	void (*get_stats)(struct ofono_gprs_context *gc, unsigned int id,
+				ofono_gprs_context_stats_cb_t cb, void *data);
 };
 
 void ofono_gprs_context_deactivated(struct ofono_gprs_context *gc,
@@ -762,6 +762,75 @@ static void pri_deactivate_callback(const struct ofono_error *error, void *data)
 					"Active", DBUS_TYPE_BOOLEAN, &value);
 }
 
+static void pri_get_stats_callback(const struct ofono_error *error,
+				const struct ofono_gprs_context_stats *stats,
+				void *data)
+{
+	struct pri_context *ctx = data;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+	DBusMessageIter dict;
+	dbus_uint64_t value;
+	dbus_uint32_t delay;
+
+	if (error->type != OFONO_ERROR_TYPE_NO_ERROR) {
+		DBG("Reading context statistics failed with error: %s",
+				telephony_error_to_str(error));
+		__ofono_dbus_pending_reply(&ctx->pending,
+					__ofono_error_failed(ctx->pending));
+		return;
+	}
+
+	reply = dbus_message_new_method_return(ctx->pending);
+	if (reply == NULL) {
+		__ofono_dbus_pending_reply(&ctx->pending,
+					__ofono_error_failed(ctx->pending));
+		return;
+	}
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					OFONO_PROPERTIES_ARRAY_SIGNATURE,
+					&dict);
+
+	value = stats->tx_packets;
+	ofono_dbus_dict_append(&dict, "TxPackets", DBUS_TYPE_UINT64, &value);
+
+	value = stats->tx_bytes;
+	ofono_dbus_dict_append(&dict, "TxBytes", DBUS_TYPE_UINT64, &value);
+
+	value = stats->tx_wire_bytes;
+	ofono_dbus_dict_append(&dict, "TxWireBytes", DBUS_TYPE_UINT64, &value);
+
+	value = stats->tx_dropped;
+	ofono_dbus_dict_append(&dict, "TxDropped", DBUS_TYPE_UINT64, &value);
+
+	delay = stats->tx_queue_delay;
+	ofono_dbus_dict_append(&dict, "TxQueueDelay", DBUS_TYPE_UINT32,
+				&delay);
+
+	delay = stats->tx_queue_delay_max;
+	ofono_dbus_dict_append(&dict, "TxQueueDelayMax", DBUS_TYPE_UINT32,
+				&delay);
+
+	value = stats->rx_packets;
+	ofono_dbus_dict_append(&dict, "RxPackets", DBUS_TYPE_UINT64, &value);
+
+	value = stats->rx_bytes;
+	ofono_dbus_dict_append(&dict, "RxBytes", DBUS_TYPE_UINT64, &value);
+
+	value = stats->rx_wire_bytes;
+	ofono_dbus_dict_append(&dict, "RxWireBytes", DBUS_TYPE_UINT64, &value);
+
+	value = stats->rx_errors;
+	ofono_dbus_dict_append(&dict, "RxErrors", DBUS_TYPE_UINT64, &value);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	__ofono_dbus_pending_reply(&ctx->pending, reply);
+}
+
 static DBusMessage *pri_set_apn(struct pri_context *ctx, DBusConnection *conn,
 				DBusMessage *msg, const char *apn)
 {
@@ -1168,10 +1237,35 @@ static DBusMessage *pri_set_property(DBusConnection *conn,
 	return __ofono_error_invalid_args(msg);
 }
 
+static DBusMessage *pri_get_statistics(DBusConnection *conn,
+					DBusMessage *msg, void *data)
+{
+	struct pri_context *ctx = data;
+	struct ofono_gprs_context *gc = ctx->context_driver;
+
+	if (ctx->pending)
+		return __ofono_error_busy(msg);
+
+	if (ctx->active == FALSE || gc == NULL)
+		return __ofono_error_not_active(msg);
+
+	if (gc->driver->get_stats == NULL)
+		return __ofono_error_not_implemented(msg);
+
+	ctx->pending = dbus_message_ref(msg);
+
+	gc->driver->get_stats(gc, ctx->context.cid,
+				pri_get_stats_callback, ctx);
+
+	return NULL;
+}
+
 static GDBusMethodTable context_methods[] = {
 	{ "GetProperties",	"",	"a{sv}",	pri_get_properties },
 	{ "SetProperty",	"sv",	"",		pri_set_property,
 							G_DBUS_METHOD_FLAG_ASYNC },
+	{ "GetStatistics",	"",	"a{sv}",	pri_get_statistics,
+							G_DBUS_METHOD_FLAG_ASYNC },
 	{ }
 };
 
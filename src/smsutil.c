@@ -41,14 +41,19 @@
 #define uninitialized_var(x) x = x
 
 #define SMS_BACKUP_MODE 0600
-#define SMS_BACKUP_PATH STORAGEDIR "/%s/sms_assembly"
+#define SMS_BACKUP_PATH "%s/%s/sms_assembly"
 #define SMS_BACKUP_PATH_DIR SMS_BACKUP_PATH "/%s-%i-%i"
 #define SMS_BACKUP_PATH_FILE SMS_BACKUP_PATH_DIR "/%03i"
+#define SMS_BACKUP_JOURNAL "%s/%s/sms_assembly_journal"
 
-#define SMS_SR_BACKUP_PATH STORAGEDIR "/%s/sms_sr"
+#define SMS_JOURNAL_FRAGMENT 'F'
+#define SMS_JOURNAL_DROP 'D'
+#define SMS_JOURNAL_COMPACT_MIN 64
+
+#define SMS_SR_BACKUP_PATH "%s/%s/sms_sr"
 #define SMS_SR_BACKUP_PATH_FILE SMS_SR_BACKUP_PATH "/%s-%s"
 
-#define SMS_TX_BACKUP_PATH STORAGEDIR "/%s/tx_queue"
+#define SMS_TX_BACKUP_PATH "%s/%s/tx_queue"
 #define SMS_TX_BACKUP_PATH_DIR SMS_TX_BACKUP_PATH "/%lu-%lu-%s"
 #define SMS_TX_BACKUP_PATH_FILE SMS_TX_BACKUP_PATH_DIR "/%03i"
 
@@ -2394,7 +2399,7 @@ static void sms_assembly_load(struct sms_assembly *assembly,
 	if (sms_assembly_extract_address(straddr, &addr) == FALSE)
 		return;
 
-	path = g_strdup_printf(SMS_BACKUP_PATH "/%s",
+	path = g_strdup_printf(SMS_BACKUP_PATH "/%s", storage_get_root(),
 			assembly->imsi, dir->d_name);
 	len = scandir(path, &segments, NULL, alphasort);
 	g_free(path);
@@ -2411,7 +2416,7 @@ static void sms_assembly_load(struct sms_assembly *assembly,
 			continue;
 
 		r = read_file(buf, sizeof(buf), SMS_BACKUP_PATH "/%s/%s",
-				assembly->imsi,
+				storage_get_root(), assembly->imsi,
 				dir->d_name, segments[i]->d_name);
 		if (r < 0)
 			continue;
@@ -2420,7 +2425,7 @@ static void sms_assembly_load(struct sms_assembly *assembly,
 			continue;
 
 		path = g_strdup_printf(SMS_BACKUP_PATH "/%s/%s",
-				assembly->imsi,
+				storage_get_root(), assembly->imsi,
 				dir->d_name, segments[i]->d_name);
 		r = stat(path, &segment_stat);
 		g_free(path);
@@ -2440,58 +2445,493 @@ static void sms_assembly_load(struct sms_assembly *assembly,
 	free(segments);
 }
 
+/*
+ * Fragments of incomplete messages are backed up to an append-only journal
+ * of records, each followed by the serialized fragment.  Once a message is
+ * complete or expires a drop record, with no fragment, is appended for it.
+ * The journal is rewritten with just the pending fragments when it is
+ * loaded and whenever most of its records have become stale.
+ */
+struct sms_journal_record {
+	guint8 type;
+	guint8 addr_len;
+	guint8 addr[12];
+	guint16 ref;
+	guint8 max;
+	guint8 seq;
+	gint64 ts;
+	guint8 len;
+} __attribute__((packed));
+
+#define SMS_JOURNAL_RECORD_MAX (sizeof(struct sms_journal_record) + 177)
+
+static int sms_journal_encode(unsigned char *buf, guint8 type,
+				const struct sms_assembly_node *node,
+				guint8 seq, const struct sms *sms)
+{
+	struct sms_journal_record record;
+	int offset = 0;
+
+	memset(&record, 0, sizeof(record));
+
+	if (sms_encode_address_field(&node->addr, FALSE,
+					record.addr, &offset) == FALSE)
+		return -1;
+
+	record.type = type;
+	record.addr_len = offset;
+	record.ref = node->ref;
+	record.max = node->max_fragments;
+
+	if (sms != NULL) {
+		record.seq = seq;
+		record.ts = node->ts;
+		record.len = sms_serialize(buf + sizeof(record), sms);
+	}
+
+	memcpy(buf, &record, sizeof(record));
+
+	return sizeof(record) + record.len;
+}
+
+static gboolean sms_journal_append(struct sms_assembly *assembly,
+					const unsigned char *buf, int len)
+{
+	char *path;
+	off_t end;
+	ssize_t r;
+
+	if (assembly->journal_fd < 0) {
+		path = g_strdup_printf(SMS_BACKUP_JOURNAL,
+				storage_get_root(), assembly->imsi);
+
+		if (create_dirs(path, SMS_BACKUP_MODE | S_IXUSR) == 0)
+			assembly->journal_fd = TFR(open(path,
+						O_WRONLY | O_CREAT | O_APPEND,
+						SMS_BACKUP_MODE));
+
+		g_free(path);
+
+		if (assembly->journal_fd < 0)
+			return FALSE;
+	}
+
+	end = lseek(assembly->journal_fd, 0, SEEK_END);
+	r = TFR(write(assembly->journal_fd, buf, len));
+
+	if (r == len) {
+		assembly->journal_records += 1;
+		return TRUE;
+	}
+
+	/* Never leave a torn record behind for the next one to follow */
+	if (r > 0 && ftruncate(assembly->journal_fd, end) < 0) {
+		TFR(close(assembly->journal_fd));
+		assembly->journal_fd = -1;
+	}
+
+	return FALSE;
+}
+
+static gboolean sms_journal_compact(struct sms_assembly *assembly)
+{
+	GPtrArray *heap = assembly->expiry_heap;
+	unsigned int fragments = 0;
+	unsigned int records = 0;
+	unsigned char *buf;
+	int len = 0;
+	int r;
+	unsigned int i;
+
+	for (i = 0; i < heap->len; i++) {
+		struct sms_assembly_node *node = g_ptr_array_index(heap, i);
+
+		fragments += node->num_fragments;
+	}
+
+	buf = g_try_malloc(fragments * SMS_JOURNAL_RECORD_MAX + 1);
+	if (buf == NULL)
+		return FALSE;
+
+	for (i = 0; i < heap->len; i++) {
+		struct sms_assembly_node *node = g_ptr_array_index(heap, i);
+		GSList *l = node->fragment_list;
+		unsigned int seq;
+
+		/* Fragments are kept in the order of their sequence number */
+		for (seq = 0; seq < 256 && l != NULL; seq++) {
+			if ((node->bitmap[seq / 32] & (1U << (seq % 32))) == 0)
+				continue;
+
+			r = sms_journal_encode(buf + len, SMS_JOURNAL_FRAGMENT,
+						node, seq, l->data);
+			if (r > 0) {
+				len += r;
+				records += 1;
+			}
+
+			l = l->next;
+		}
+	}
+
+	r = write_file(buf, len, SMS_BACKUP_MODE, SMS_BACKUP_JOURNAL,
+			storage_get_root(), assembly->imsi);
+	g_free(buf);
+
+	if (r != len)
+		return FALSE;
+
+	/* The journal we were appending to has been replaced */
+	if (assembly->journal_fd >= 0) {
+		TFR(close(assembly->journal_fd));
+		assembly->journal_fd = -1;
+	}
+
+	assembly->journal_records = records;
+	assembly->journal_live = records;
+
+	return TRUE;
+}
+
 static gboolean sms_assembly_store(struct sms_assembly *assembly,
 				struct sms_assembly_node *node,
 				const struct sms *sms, guint8 seq)
 {
-	unsigned char buf[177];
+	unsigned char buf[SMS_JOURNAL_RECORD_MAX];
 	int len;
-	DECLARE_SMS_ADDR_STR(straddr);
 
-	if (assembly->imsi == NULL)
+	if (assembly->imsi == NULL || assembly->journal_loading)
 		return FALSE;
 
-	if (sms_address_to_hex_string(&node->addr, straddr) == FALSE)
+	len = sms_journal_encode(buf, SMS_JOURNAL_FRAGMENT, node, seq, sms);
+	if (len < 0)
 		return FALSE;
 
-	len = sms_serialize(buf, sms);
-
-	if (write_file(buf, len, SMS_BACKUP_MODE,
-				SMS_BACKUP_PATH_FILE, assembly->imsi, straddr,
-				node->ref, node->max_fragments, seq) != len)
+	if (sms_journal_append(assembly, buf, len) == FALSE)
 		return FALSE;
 
+	assembly->journal_live += 1;
+
 	return TRUE;
 }
 
+/*
+ * Records that the stored fragments of a node, which must have left the
+ * assembly already, are no longer needed.  Nothing is written while the
+ * journal is being replayed, it is compacted afterwards if need be.
+ */
 static void sms_assembly_backup_free(struct sms_assembly *assembly,
+					struct sms_assembly_node *node,
+					unsigned int stored)
+{
+	unsigned char buf[SMS_JOURNAL_RECORD_MAX];
+	int len;
+
+	if (assembly->imsi == NULL || assembly->journal_loading ||
+			stored == 0)
+		return;
+
+	len = sms_journal_encode(buf, SMS_JOURNAL_DROP, node, 0, NULL);
+	if (len < 0 || sms_journal_append(assembly, buf, len) == FALSE)
+		return;
+
+	assembly->journal_live -= MIN(stored, assembly->journal_live);
+
+	if (assembly->journal_records < SMS_JOURNAL_COMPACT_MIN)
+		return;
+
+	if (assembly->journal_records > 2 * assembly->journal_live)
+		sms_journal_compact(assembly);
+}
+
+static guint assembly_node_hash(gconstpointer v)
+{
+	const struct sms_assembly_node *node = v;
+	guint h = g_str_hash(node->addr.address);
+
+	h = h * 31 + node->addr.number_type;
+	h = h * 31 + node->addr.numbering_plan;
+
+	return h * 31 + node->ref;
+}
+
+static gboolean assembly_node_equal(gconstpointer v1, gconstpointer v2)
+{
+	const struct sms_assembly_node *a = v1;
+	const struct sms_assembly_node *b = v2;
+
+	if (a->addr.number_type != b->addr.number_type)
+		return FALSE;
+
+	if (a->addr.numbering_plan != b->addr.numbering_plan)
+		return FALSE;
+
+	if (a->ref != b->ref)
+		return FALSE;
+
+	return strcmp(a->addr.address, b->addr.address) == 0;
+}
+
+/*
+ * The expiry heap is a binary min-heap on the time of the first fragment.
+ * Each node remembers its position so it can be taken out once complete.
+ */
+static void expiry_heap_set(GPtrArray *heap, unsigned int i,
+				struct sms_assembly_node *node)
+{
+	g_ptr_array_index(heap, i) = node;
+	node->expiry_index = i;
+}
+
+static void expiry_heap_sift_up(GPtrArray *heap, unsigned int i)
+{
+	struct sms_assembly_node *node = g_ptr_array_index(heap, i);
+
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		struct sms_assembly_node *p = g_ptr_array_index(heap, parent);
+
+		if (p->ts <= node->ts)
+			break;
+
+		expiry_heap_set(heap, i, p);
+		i = parent;
+	}
+
+	expiry_heap_set(heap, i, node);
+}
+
+static void expiry_heap_sift_down(GPtrArray *heap, unsigned int i)
+{
+	struct sms_assembly_node *node = g_ptr_array_index(heap, i);
+	struct sms_assembly_node *c;
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < heap->len) {
+		c = g_ptr_array_index(heap, child);
+
+		if (child + 1 < heap->len) {
+			struct sms_assembly_node *r =
+				g_ptr_array_index(heap, child + 1);
+
+			if (r->ts < c->ts) {
+				child += 1;
+				c = r;
+			}
+		}
+
+		if (node->ts <= c->ts)
+			break;
+
+		expiry_heap_set(heap, i, c);
+		i = child;
+	}
+
+	expiry_heap_set(heap, i, node);
+}
+
+static void sms_assembly_node_add(struct sms_assembly *assembly,
 					struct sms_assembly_node *node)
 {
-	char *path;
-	int seq;
-	DECLARE_SMS_ADDR_STR(straddr);
+	GPtrArray *heap = assembly->expiry_heap;
+
+	g_hash_table_insert(assembly->assembly_table, node, node);
+
+	g_ptr_array_add(heap, node);
+	expiry_heap_sift_up(heap, heap->len - 1);
+}
+
+static void sms_assembly_node_remove(struct sms_assembly *assembly,
+					struct sms_assembly_node *node)
+{
+	GPtrArray *heap = assembly->expiry_heap;
+	unsigned int i = node->expiry_index;
+	struct sms_assembly_node *last;
+
+	g_hash_table_remove(assembly->assembly_table, node);
+
+	/* The last node takes our place, then settles either way */
+	g_ptr_array_remove_index_fast(heap, i);
 
-	if (assembly->imsi == NULL)
+	if (i == heap->len)
 		return;
 
-	if (sms_address_to_hex_string(&node->addr, straddr) == FALSE)
+	last = g_ptr_array_index(heap, i);
+	expiry_heap_sift_down(heap, i);
+	expiry_heap_sift_up(heap, last->expiry_index);
+}
+
+static void sms_assembly_node_free(struct sms_assembly_node *node)
+{
+	g_slist_foreach(node->fragment_list, (GFunc) g_free, 0);
+	g_slist_free(node->fragment_list);
+	g_free(node);
+}
+
+/*
+ * Replays the journal.  Returns TRUE if it holds stale or torn records and
+ * should be rewritten.
+ */
+static gboolean sms_journal_load(struct sms_assembly *assembly)
+{
+	struct sms_journal_record record;
+	struct sms_assembly_node key;
+	struct sms_assembly_node *node;
+	struct sms segment;
+	gchar *contents;
+	gsize size;
+	gsize offset = 0;
+	const unsigned char *data;
+	char *path;
+	int addr_offset;
+	GSList *l;
+	unsigned int i;
+
+	path = g_strdup_printf(SMS_BACKUP_JOURNAL,
+			storage_get_root(), assembly->imsi);
+
+	if (g_file_get_contents(path, &contents, &size, NULL) == FALSE) {
+		g_free(path);
+		return FALSE;
+	}
+
+	g_free(path);
+
+	while (offset + sizeof(record) <= size) {
+		memcpy(&record, contents + offset, sizeof(record));
+
+		if (record.type != SMS_JOURNAL_FRAGMENT &&
+				record.type != SMS_JOURNAL_DROP)
+			break;
+
+		if (offset + sizeof(record) + record.len > size)
+			break;
+
+		data = (unsigned char *) contents + offset + sizeof(record);
+		offset += sizeof(record) + record.len;
+		assembly->journal_records += 1;
+
+		addr_offset = 0;
+		if (sms_decode_address_field(record.addr, record.addr_len,
+						&addr_offset, FALSE,
+						&key.addr) == FALSE)
+			continue;
+
+		key.ref = record.ref;
+
+		if (record.type == SMS_JOURNAL_DROP) {
+			node = g_hash_table_lookup(assembly->assembly_table,
+							&key);
+			if (node == NULL || node->max_fragments != record.max)
+				continue;
+
+			sms_assembly_node_remove(assembly, node);
+			sms_assembly_node_free(node);
+			continue;
+		}
+
+		if (!sms_deserialize(data, &segment, record.len))
+			continue;
+
+		l = sms_assembly_add_fragment_backup(assembly, &segment,
+						record.ts, &key.addr,
+						record.ref, record.max,
+						record.seq, FALSE);
+
+		/* A complete message was never stored, but be careful */
+		g_slist_foreach(l, (GFunc) g_free, NULL);
+		g_slist_free(l);
+	}
+
+	g_free(contents);
+
+	for (i = 0; i < assembly->expiry_heap->len; i++) {
+		node = g_ptr_array_index(assembly->expiry_heap, i);
+		assembly->journal_live += node->num_fragments;
+	}
+
+	if (offset < size)
+		return TRUE;
+
+	return assembly->journal_records > assembly->journal_live;
+}
+
+/*
+ * Fragments used to be backed up one file each, in a directory per message.
+ * Returns TRUE if there was such a backup to take over.
+ */
+static gboolean sms_assembly_legacy_load(struct sms_assembly *assembly)
+{
+	struct dirent **entries;
+	char *path;
+	int len;
+
+	path = g_strdup_printf(SMS_BACKUP_PATH,
+			storage_get_root(), assembly->imsi);
+	len = scandir(path, &entries, NULL, alphasort);
+	g_free(path);
+
+	if (len < 0)
+		return FALSE;
+
+	while (len--) {
+		sms_assembly_load(assembly, entries[len]);
+		free(entries[len]);
+	}
+
+	free(entries);
+
+	return TRUE;
+}
+
+static void sms_assembly_legacy_remove(const char *imsi)
+{
+	struct dirent **entries;
+	struct dirent **segments;
+	char *path;
+	char *dir;
+	int len;
+	int n;
+	int i;
+
+	path = g_strdup_printf(SMS_BACKUP_PATH, storage_get_root(), imsi);
+	len = scandir(path, &entries, NULL, alphasort);
+
+	if (len < 0) {
+		g_free(path);
 		return;
+	}
+
+	while (len--) {
+		if (entries[len]->d_type != DT_DIR ||
+				entries[len]->d_name[0] == '.')
+			goto next;
+
+		dir = g_strdup_printf("%s/%s", path, entries[len]->d_name);
+		n = scandir(dir, &segments, NULL, alphasort);
+
+		for (i = 0; i < n; i++) {
+			char *file = g_strdup_printf("%s/%s", dir,
+							segments[i]->d_name);
 
-	for (seq = 0; seq < node->max_fragments; seq++) {
-		int offset = seq / 32;
-		int bit = 1 << (seq % 32);
+			if (segments[i]->d_type == DT_REG)
+				unlink(file);
 
-		if (node->bitmap[offset] & bit) {
-			path = g_strdup_printf(SMS_BACKUP_PATH_FILE,
-					assembly->imsi, straddr,
-					node->ref, node->max_fragments, seq);
-			unlink(path);
-			g_free(path);
+			g_free(file);
+			free(segments[i]);
 		}
+
+		if (n >= 0)
+			free(segments);
+
+		rmdir(dir);
+		g_free(dir);
+next:
+		free(entries[len]);
 	}
 
-	path = g_strdup_printf(SMS_BACKUP_PATH_DIR, assembly->imsi, straddr,
-				node->ref, node->max_fragments);
+	free(entries);
+
 	rmdir(path);
 	g_free(path);
 }
@@ -2499,28 +2939,28 @@ static void sms_assembly_backup_free(struct sms_assembly *assembly,
 struct sms_assembly *sms_assembly_new(const char *imsi)
 {
 	struct sms_assembly *ret = g_new0(struct sms_assembly, 1);
-	char *path;
-	struct dirent **entries;
-	int len;
+	gboolean compact;
+	gboolean legacy;
+
+	ret->assembly_table = g_hash_table_new(assembly_node_hash,
+						assembly_node_equal);
+	ret->expiry_heap = g_ptr_array_new();
+	ret->journal_fd = -1;
 
 	if (imsi) {
 		ret->imsi = imsi;
 
 		/* Restore state from backup */
+		ret->journal_loading = TRUE;
+		compact = sms_journal_load(ret);
+		legacy = sms_assembly_legacy_load(ret);
+		ret->journal_loading = FALSE;
 
-		path = g_strdup_printf(SMS_BACKUP_PATH, imsi);
-		len = scandir(path, &entries, NULL, alphasort);
-		g_free(path);
-
-		if (len < 0)
+		if (compact == FALSE && legacy == FALSE)
 			return ret;
 
-		while (len--) {
-			sms_assembly_load(ret, entries[len]);
-			free(entries[len]);
-		}
-
-		free(entries);
+		if (sms_journal_compact(ret) && legacy)
+			sms_assembly_legacy_remove(imsi);
 	}
 
 	return ret;
@@ -2528,17 +2968,17 @@ struct sms_assembly *sms_assembly_new(const char *imsi)
 
 void sms_assembly_free(struct sms_assembly *assembly)
 {
-	GSList *l;
+	unsigned int i;
 
-	for (l = assembly->assembly_list; l; l = l->next) {
-		struct sms_assembly_node *node = l->data;
+	for (i = 0; i < assembly->expiry_heap->len; i++)
+		sms_assembly_node_free(g_ptr_array_index(assembly->expiry_heap,
+								i));
 
-		g_slist_foreach(node->fragment_list, (GFunc) g_free, 0);
-		g_slist_free(node->fragment_list);
-		g_free(node);
-	}
+	if (assembly->journal_fd >= 0)
+		TFR(close(assembly->journal_fd));
 
-	g_slist_free(assembly->assembly_list);
+	g_hash_table_destroy(assembly->assembly_table);
+	g_ptr_array_free(assembly->expiry_heap, TRUE);
 	g_free(assembly);
 }
 
@@ -2559,8 +2999,7 @@ static GSList *sms_assembly_add_fragment_backup(struct sms_assembly *assembly,
 {
 	unsigned int offset = seq / 32;
 	unsigned int bit = 1 << (seq % 32);
-	GSList *l;
-	GSList *prev;
+	struct sms_assembly_node key;
 	struct sms *newsms;
 	struct sms_assembly_node *node;
 	GSList *completed;
@@ -2568,23 +3007,12 @@ static GSList *sms_assembly_add_fragment_backup(struct sms_assembly *assembly,
 	unsigned int i;
 	unsigned int j;
 
-	prev = NULL;
-
-	for (l = assembly->assembly_list; l; prev = l, l = l->next) {
-		node = l->data;
-
-		if (node->addr.number_type != addr->number_type)
-			continue;
-
-		if (node->addr.numbering_plan != addr->numbering_plan)
-			continue;
+	memcpy(&key.addr, addr, sizeof(struct sms_address));
+	key.ref = ref;
 
-		if (strcmp(node->addr.address, addr->address))
-			continue;
-
-		if (ref != node->ref)
-			continue;
+	node = g_hash_table_lookup(assembly->assembly_table, &key);
 
+	if (node != NULL) {
 		/*
 		 * Message Reference and address the same, but max is not
 		 * ignore the SMS completely
@@ -2622,11 +3050,8 @@ static GSList *sms_assembly_add_fragment_backup(struct sms_assembly *assembly,
 	node->ref = ref;
 	node->max_fragments = max;
 
-	assembly->assembly_list = g_slist_prepend(assembly->assembly_list,
-							node);
+	sms_assembly_node_add(assembly, node);
 
-	prev = NULL;
-	l = assembly->assembly_list;
 	position = 0;
 
 out:
@@ -2647,15 +3072,11 @@ out:
 
 	completed = node->fragment_list;
 
-	sms_assembly_backup_free(assembly, node);
-
-	if (prev)
-		prev->next = l->next;
-	else
-		assembly->assembly_list = l->next;
+	/* The fragment just received was never stored */
+	sms_assembly_node_remove(assembly, node);
+	sms_assembly_backup_free(assembly, node, node->num_fragments - 1);
 
 	g_free(node);
-	g_slist_free_1(l);
 	return completed;
 }
 
@@ -2666,36 +3087,17 @@ out:
  */
 void sms_assembly_expire(struct sms_assembly *assembly, time_t before)
 {
-	GSList *cur;
-	GSList *prev;
-	GSList *tmp;
-
-	prev = NULL;
-	cur = assembly->assembly_list;
+	GPtrArray *heap = assembly->expiry_heap;
 
-	while (cur) {
-		struct sms_assembly_node *node = cur->data;
+	while (heap->len > 0) {
+		struct sms_assembly_node *node = g_ptr_array_index(heap, 0);
 
-		if (node->ts > before) {
-			prev = cur;
-			cur = cur->next;
-			continue;
-		}
-
-		sms_assembly_backup_free(assembly, node);
-
-		g_slist_foreach(node->fragment_list, (GFunc) g_free, 0);
-		g_slist_free(node->fragment_list);
-		g_free(node);
-
-		if (prev)
-			prev->next = cur->next;
-		else
-			assembly->assembly_list = cur->next;
+		if (node->ts > before)
+			break;
 
-		tmp = cur;
-		cur = cur->next;
-		g_slist_free_1(tmp);
+		sms_assembly_node_remove(assembly, node);
+		sms_assembly_backup_free(assembly, node, node->num_fragments);
+		sms_assembly_node_free(node);
 	}
 }
 
@@ -2756,7 +3158,7 @@ static void sr_assembly_load_backup(GHashTable *assembly_table,
 
 	r = read_file((unsigned char *) node,
 			sizeof(struct id_table_node),
-			SMS_SR_BACKUP_PATH "/%s",
+			SMS_SR_BACKUP_PATH "/%s", storage_get_root(),
 			imsi, addr_dir->d_name);
 
 	if (r < 0) {
@@ -2798,7 +3200,8 @@ struct status_report_assembly *status_report_assembly_new(const char *imsi)
 		ret->imsi = imsi;
 
 		/* Restore state from backup */
-		path = g_strdup_printf(SMS_SR_BACKUP_PATH, imsi);
+		path = g_strdup_printf(SMS_SR_BACKUP_PATH,
+				storage_get_root(), imsi);
 		len = scandir(path, &addresses, NULL, alphasort);
 
 		g_free(path);
@@ -2843,7 +3246,7 @@ static gboolean sr_assembly_add_fragment_backup(const char *imsi,
 
 	/* storagedir/%s/sms_sr/%s-%s */
 	if (write_file((unsigned char *) node, len, SMS_BACKUP_MODE,
-			SMS_SR_BACKUP_PATH_FILE, imsi,
+			SMS_SR_BACKUP_PATH_FILE, storage_get_root(), imsi,
 			straddr, msgid_str) != len)
 		return FALSE;
 
@@ -2867,7 +3270,7 @@ static gboolean sr_assembly_remove_fragment_backup(const char *imsi,
 	if (encode_hex_own_buf(sha1, SMS_MSGID_LEN, 0, msgid_str) == FALSE)
 		return FALSE;
 
-	path = g_strdup_printf(SMS_SR_BACKUP_PATH_FILE,
+	path = g_strdup_printf(SMS_SR_BACKUP_PATH_FILE, storage_get_root(),
 					imsi, straddr, msgid_str);
 
 	unlink(path);
@@ -3188,7 +3591,8 @@ static GSList *sms_tx_load(const char *imsi, const struct dirent *dir)
 	if (dir->d_type != DT_DIR)
 		return NULL;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH "/%s", imsi, dir->d_name);
+	path = g_strdup_printf(SMS_TX_BACKUP_PATH "/%s",
+			storage_get_root(), imsi, dir->d_name);
 	len = scandir(path, &pdus, sms_tx_load_filter, alphasort);
 	g_free(path);
 
@@ -3197,7 +3601,8 @@ static GSList *sms_tx_load(const char *imsi, const struct dirent *dir)
 
 	while (len--) {
 		r = read_file(buf, sizeof(buf), SMS_TX_BACKUP_PATH "/%s/%s",
-					imsi, dir->d_name, pdus[len]->d_name);
+					storage_get_root(), imsi, dir->d_name,
+					pdus[len]->d_name);
 
 		if (r < 0)
 			goto free_pdu;
@@ -3243,7 +3648,7 @@ GQueue *sms_tx_queue_load(const char *imsi)
 	if (imsi == NULL)
 		return NULL;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH, imsi);
+	path = g_strdup_printf(SMS_TX_BACKUP_PATH, storage_get_root(), imsi);
 
 	len = scandir(path, &entries, sms_tx_queue_filter, alphasort);
 	if (len < 0)
@@ -3287,7 +3692,8 @@ GQueue *sms_tx_queue_load(const char *imsi)
 
 		oldpath = g_strdup_printf("%s/%s", path, dir->d_name);
 		newpath = g_strdup_printf(SMS_TX_BACKUP_PATH_DIR,
-						imsi, id++, flags, uuid);
+						storage_get_root(), imsi, id++,
+						flags, uuid);
 
 		/* rename directory to reflect new position in queue */
 		rename(oldpath, newpath);
@@ -3325,7 +3731,8 @@ gboolean sms_tx_backup_store(const char *imsi, unsigned long id,
 	 * file name is: imsi/tx_queue/order-flags-uuid/pdu
 	 */
 	if (write_file(buf, len, SMS_BACKUP_MODE, SMS_TX_BACKUP_PATH_FILE,
-					imsi, id, flags, uuid, seq) != len)
+					storage_get_root(), imsi, id, flags,
+					uuid, seq) != len)
 		return FALSE;
 
 	return TRUE;
@@ -3338,7 +3745,7 @@ void sms_tx_backup_free(const char *imsi, unsigned long id,
 	struct dirent **entries;
 	int len;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH_DIR,
+	path = g_strdup_printf(SMS_TX_BACKUP_PATH_DIR, storage_get_root(),
 					imsi, id, flags, uuid);
 
 	len = scandir(path, &entries, NULL, alphasort);
@@ -3371,7 +3778,7 @@ void sms_tx_backup_remove(const char *imsi, unsigned long id,
 {
 	char *path;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH_FILE,
+	path = g_strdup_printf(SMS_TX_BACKUP_PATH_FILE, storage_get_root(),
 					imsi, id, flags, uuid, seq);
 	unlink(path);
 
@@ -3516,6 +3923,25 @@ GSList *sms_datagram_prepare(const char *to,
 	return r;
 }
 
+/*
+ * Number of messages needed for septets of GSM text that use the given
+ * number of national language shift tables.  Ignores escapes that would
+ * have to move to the next fragment, this is only used to rank encodings.
+ */
+static long sms_gsm_fragments(long septets, int tables, gboolean use_16bit)
+{
+	int offset = tables > 0 ? 1 + 3 * tables : 0;
+	int capacity;
+
+	if (septets <= sms_text_capacity_gsm(160, offset))
+		return 1;
+
+	offset = 1 + 3 * tables + (use_16bit ? 6 : 5);
+	capacity = sms_text_capacity_gsm(160, offset);
+
+	return (septets + capacity - 1) / capacity;
+}
+
 /*
  * Prepares the text for transmission.  Breaks up into fragments if
  * necessary using ref as the concatenated message reference number.
@@ -3537,8 +3963,14 @@ GSList *sms_text_prepare_with_alphabet(const char *to, const char *utf8,
 	long left;
 	guint8 seq;
 	GSList *r = NULL;
-	enum gsm_dialect used_locking;
-	enum gsm_dialect used_single;
+	enum gsm_dialect locking[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect single[GSM_DIALECT_CANDIDATES];
+	long septets[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect used_locking = GSM_DIALECT_DEFAULT;
+	enum gsm_dialect used_single = GSM_DIALECT_DEFAULT;
+	long fragments = 0;
+	int candidates;
+	int i;
 
 	memset(&template, 0, sizeof(struct sms));
 	template.type = SMS_TYPE_SUBMIT;
@@ -3553,10 +3985,32 @@ GSList *sms_text_prepare_with_alphabet(const char *to, const char *utf8,
 	/*
 	 * UDHI, UDL, UD and DCS actually depend on the contents of
 	 * the text, and also on the GSM dialect we use to encode it.
+	 * Measure all dialects at once and only encode with the one
+	 * needing the fewest messages, preferring fewer shift tables.
+	 * UCS2 never takes fewer messages than a GSM encoding.
 	 */
-	gsm_encoded = convert_utf8_to_gsm_best_lang(utf8, -1, NULL, &written, 0,
-							alphabet, &used_locking,
-							&used_single);
+	candidates = utf8_to_gsm_candidates(utf8, -1, alphabet, locking,
+						single, septets);
+
+	for (i = 0; i < candidates; i++) {
+		int tables = (locking[i] != GSM_DIALECT_DEFAULT) +
+				(single[i] != GSM_DIALECT_DEFAULT);
+		long n = sms_gsm_fragments(septets[i], tables, use_16bit);
+
+		if (fragments > 0 && n >= fragments)
+			continue;
+
+		fragments = n;
+		used_locking = locking[i];
+		used_single = single[i];
+	}
+
+	if (candidates > 0)
+		gsm_encoded = convert_utf8_to_gsm_with_lang(utf8, -1, NULL,
+							&written, 0,
+							used_locking,
+							used_single);
+
 	if (gsm_encoded == NULL) {
 		gsize converted;
 
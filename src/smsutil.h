@@ -366,11 +366,17 @@ struct sms_assembly_node {
 	guint8 max_fragments;
 	guint8 num_fragments;
 	unsigned int bitmap[8];
+	unsigned int expiry_index;
 };
 
 struct sms_assembly {
 	const char *imsi;
-	GSList *assembly_list;
+	GHashTable *assembly_table;	/* Nodes by address and ref */
+	GPtrArray *expiry_heap;		/* Nodes, oldest first */
+	int journal_fd;			/* Fragment backup, appended to */
+	unsigned int journal_records;	/* Records in the journal */
+	unsigned int journal_live;	/* Records not yet dropped */
+	gboolean journal_loading;	/* Replaying, leave the journal be */
 };
 
 struct id_table_node {
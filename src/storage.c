@@ -35,6 +35,8 @@
 
 #include "storage.h"
 
+static const char *storage_root = STORAGEDIR;
+
 int create_dirs(const char *filename, const mode_t mode)
 {
 	struct stat st;
@@ -142,12 +144,11 @@ ssize_t write_file(const unsigned char *buffer, size_t len, mode_t mode,
 	/*
 	 * Now that the file contents are written, rename to the real
 	 * file name; this way we are uniquely sure that the whole
-	 * thing is there.
+	 * thing is there.  rename() replaces an existing file in one
+	 * step, so there is never a moment without it.
 	 */
-	unlink(path);
-
 	/* conserve @r's value from 'write' */
-	if (link(tmp_path, path) == -1)
+	if (rename(tmp_path, path) == -1)
 		r = -1;
 
 error_write:
@@ -159,6 +160,20 @@ error_create_dirs:
 	return r;
 }
 
+/*
+ * Everything stored by oFono lives below STORAGEDIR.  The unit tests
+ * point this at a scratch directory so they never touch the real state.
+ */
+void storage_set_root(const char *root)
+{
+	storage_root = root ? root : STORAGEDIR;
+}
+
+const char *storage_get_root(void)
+{
+	return storage_root;
+}
+
 GKeyFile *storage_open(const char *imsi, const char *store)
 {
 	GKeyFile *keyfile;
@@ -168,9 +183,9 @@ GKeyFile *storage_open(const char *imsi, const char *store)
 		return NULL;
 
 	if (imsi)
-		path = g_strdup_printf(STORAGEDIR "/%s/%s", imsi, store);
+		path = g_strdup_printf("%s/%s/%s", storage_root, imsi, store);
 	else
-		path = g_strdup_printf(STORAGEDIR "/%s", store);
+		path = g_strdup_printf("%s/%s", storage_root, store);
 
 	keyfile = g_key_file_new();
 
@@ -189,9 +204,9 @@ void storage_sync(const char *imsi, const char *store, GKeyFile *keyfile)
 	gsize length = 0;
 
 	if (imsi)
-		path = g_strdup_printf(STORAGEDIR "/%s/%s", imsi, store);
+		path = g_strdup_printf("%s/%s/%s", storage_root, imsi, store);
 	else
-		path = g_strdup_printf(STORAGEDIR "/%s", store);
+		path = g_strdup_printf("%s/%s", storage_root, store);
 
 	if (path == NULL)
 		return;
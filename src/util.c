@@ -68,26 +68,37 @@
 #define TABLE_SIZE(t) \
 	(sizeof((t)) / sizeof(struct codepoint))
 
+#define CODEPOINT_MAP(t) \
+	{ (t), TABLE_SIZE(t), NULL }
+
 struct codepoint {
 	unsigned short from;
 	unsigned short to;
 };
 
+/*
+ * Sorted codepoint table plus a two level index of it, built on first use.
+ * The high byte of a key selects a page of 256 results, pages without any
+ * entry all point to the same page of GUND.
+ */
+struct codepoint_map {
+	const struct codepoint *table;
+	unsigned int len;
+	unsigned short **pages;
+};
+
 struct conversion_table {
 	/* To unicode locking shift table */
-	const struct codepoint *locking_u;
-	unsigned int locking_len_u;
+	struct codepoint_map *locking_u;
 
 	/* To unicode single shift table */
-	const struct codepoint *single_u;
-	unsigned int single_len_u;
+	struct codepoint_map *single_u;
 
 	/* To GSM locking shift table, fixed size */
 	const unsigned short *locking_g;
 
 	/* To GSM single shift table */
-	const struct codepoint *single_g;
-	unsigned int single_len_g;
+	struct codepoint_map *single_g;
 };
 
 /* GSM to Unicode extension table, for GSM sequences starting with 0x1B */
@@ -454,6 +465,24 @@ static const struct codepoint por_unicode[] = {
 	{ 0x00FC, 0x7E }, { 0x0394, 0x10 }, { 0x20AC, 0x18 }, { 0x221E, 0x15 }
 };
 
+static struct codepoint_map def_ext_gsm_map = CODEPOINT_MAP(def_ext_gsm);
+static struct codepoint_map def_ext_unicode_map =
+					CODEPOINT_MAP(def_ext_unicode);
+static struct codepoint_map tur_ext_gsm_map = CODEPOINT_MAP(tur_ext_gsm);
+static struct codepoint_map tur_ext_unicode_map =
+					CODEPOINT_MAP(tur_ext_unicode);
+static struct codepoint_map spa_ext_gsm_map = CODEPOINT_MAP(spa_ext_gsm);
+static struct codepoint_map spa_ext_unicode_map =
+					CODEPOINT_MAP(spa_ext_unicode);
+static struct codepoint_map por_ext_gsm_map = CODEPOINT_MAP(por_ext_gsm);
+static struct codepoint_map por_ext_unicode_map =
+					CODEPOINT_MAP(por_ext_unicode);
+static struct codepoint_map def_unicode_map = CODEPOINT_MAP(def_unicode);
+static struct codepoint_map tur_unicode_map = CODEPOINT_MAP(tur_unicode);
+static struct codepoint_map por_unicode_map = CODEPOINT_MAP(por_unicode);
+
+static unsigned short undefined_page[256];
+
 static int compare_codepoints(const void *a, const void *b)
 {
 	const struct codepoint *ca = (const struct codepoint *) a;
@@ -462,13 +491,64 @@ static int compare_codepoints(const void *a, const void *b)
 	return (ca->from > cb->from) - (ca->from < cb->from);
 }
 
-static unsigned short codepoint_lookup(struct codepoint *key,
-					const struct codepoint *table,
-					unsigned int len)
+static gboolean codepoint_map_init(struct codepoint_map *map)
 {
+	unsigned short **pages;
+	unsigned short *page;
+	unsigned int npages = 0;
+	unsigned int i;
+	int last = -1;
+
+	if (undefined_page[0] != GUND)
+		for (i = 0; i < 256; i++)
+			undefined_page[i] = GUND;
+
+	/* The table is sorted, so entries sharing a page are adjacent */
+	for (i = 0; i < map->len; i++) {
+		if (map->table[i].from >> 8 == last)
+			continue;
+
+		last = map->table[i].from >> 8;
+		npages += 1;
+	}
+
+	pages = g_try_malloc(256 * sizeof(*pages) +
+				npages * 256 * sizeof(*page));
+	if (pages == NULL)
+		return FALSE;
+
+	page = (unsigned short *) (pages + 256);
+
+	for (i = 0; i < 256; i++)
+		pages[i] = undefined_page;
+
+	for (i = 0; i < map->len; i++) {
+		unsigned short from = map->table[i].from;
+
+		if (pages[from >> 8] == undefined_page) {
+			memcpy(page, undefined_page, sizeof(undefined_page));
+			pages[from >> 8] = page;
+			page += 256;
+		}
+
+		pages[from >> 8][from & 0xff] = map->table[i].to;
+	}
+
+	map->pages = pages;
+
+	return TRUE;
+}
+
+static unsigned short codepoint_lookup(struct codepoint_map *map,
+					unsigned short k)
+{
+	struct codepoint key = { k, 0 };
 	struct codepoint *result = NULL;
 
-	result = bsearch(key, table, len, sizeof(struct codepoint),
+	if (map->pages != NULL || codepoint_map_init(map) == TRUE)
+		return map->pages[k >> 8][k & 0xff];
+
+	result = bsearch(&key, map->table, map->len, sizeof(struct codepoint),
 				compare_codepoints);
 
 	return result ? result->to : GUND;
@@ -483,22 +563,19 @@ static unsigned short gsm_locking_shift_lookup(struct conversion_table *t,
 static unsigned short gsm_single_shift_lookup(struct conversion_table *t,
 						unsigned char k)
 {
-	struct codepoint key = { k, 0 };
-	return codepoint_lookup(&key, t->single_g, t->single_len_g);
+	return codepoint_lookup(t->single_g, k);
 }
 
 static unsigned short unicode_locking_shift_lookup(struct conversion_table *t,
 							unsigned short k)
 {
-	struct codepoint key = { k, 0 };
-	return codepoint_lookup(&key, t->locking_u, t->locking_len_u);
+	return codepoint_lookup(t->locking_u, k);
 }
 
 static unsigned short unicode_single_shift_lookup(struct conversion_table *t,
 							unsigned short k)
 {
-	struct codepoint key = { k, 0 };
-	return codepoint_lookup(&key, t->single_u, t->single_len_u);
+	return codepoint_lookup(t->single_u, k);
 }
 
 static gboolean populate_locking_shift(struct conversion_table *t,
@@ -508,20 +585,17 @@ static gboolean populate_locking_shift(struct conversion_table *t,
 	case GSM_DIALECT_DEFAULT:
 	case GSM_DIALECT_SPANISH:
 		t->locking_g = def_gsm;
-		t->locking_u = def_unicode;
-		t->locking_len_u = TABLE_SIZE(def_unicode);
+		t->locking_u = &def_unicode_map;
 		return TRUE;
 
 	case GSM_DIALECT_TURKISH:
 		t->locking_g = tur_gsm;
-		t->locking_u = tur_unicode;
-		t->locking_len_u = TABLE_SIZE(tur_unicode);
+		t->locking_u = &tur_unicode_map;
 		return TRUE;
 
 	case GSM_DIALECT_PORTUGUESE:
 		t->locking_g = por_gsm;
-		t->locking_u = por_unicode;
-		t->locking_len_u = TABLE_SIZE(por_unicode);
+		t->locking_u = &por_unicode_map;
 		return TRUE;
 	}
 
@@ -533,31 +607,23 @@ static gboolean populate_single_shift(struct conversion_table *t,
 {
 	switch (lang) {
 	case GSM_DIALECT_DEFAULT:
-		t->single_g = def_ext_gsm;
-		t->single_len_g = TABLE_SIZE(def_ext_gsm);
-		t->single_u = def_ext_unicode;
-		t->single_len_u = TABLE_SIZE(def_ext_unicode);
+		t->single_g = &def_ext_gsm_map;
+		t->single_u = &def_ext_unicode_map;
 		return TRUE;
 
 	case GSM_DIALECT_TURKISH:
-		t->single_g = tur_ext_gsm;
-		t->single_len_g = TABLE_SIZE(tur_ext_gsm);
-		t->single_u = tur_ext_unicode;
-		t->single_len_u = TABLE_SIZE(tur_ext_unicode);
+		t->single_g = &tur_ext_gsm_map;
+		t->single_u = &tur_ext_unicode_map;
 		return TRUE;
 
 	case GSM_DIALECT_SPANISH:
-		t->single_g = spa_ext_gsm;
-		t->single_len_g = TABLE_SIZE(spa_ext_gsm);
-		t->single_u = spa_ext_unicode;
-		t->single_len_u = TABLE_SIZE(spa_ext_unicode);
+		t->single_g = &spa_ext_gsm_map;
+		t->single_u = &spa_ext_unicode_map;
 		return TRUE;
 
 	case GSM_DIALECT_PORTUGUESE:
-		t->single_g = por_ext_gsm;
-		t->single_len_g = TABLE_SIZE(por_ext_gsm);
-		t->single_u = por_ext_unicode;
-		t->single_len_u = TABLE_SIZE(por_ext_unicode);
+		t->single_g = &por_ext_gsm_map;
+		t->single_u = &por_ext_unicode_map;
 		return TRUE;
 	}
 
@@ -789,6 +855,102 @@ unsigned char *convert_utf8_to_gsm(const char *text, long len,
 						GSM_DIALECT_DEFAULT);
 }
 
+/*!
+ * Measures UTF-8 encoded text against every pair of GSM dialects that
+ * convert_utf8_to_gsm_best_lang would try for the given hint, in a single
+ * pass over the text.  The pairs that can encode the whole text are
+ * written to locking, single and septets, each of which must have room for
+ * GSM_DIALECT_CANDIDATES entries, in order of the fewest national tables.
+ * septets receives the length of the unpacked encoding.
+ *
+ * Returns the number of usable pairs, which is 0 if the text can't be
+ * encoded in GSM at all.
+ */
+int utf8_to_gsm_candidates(const char *utf8, long len, enum gsm_dialect hint,
+				enum gsm_dialect *locking,
+				enum gsm_dialect *single, long *septets)
+{
+	struct conversion_table t[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect try_locking[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect try_single[GSM_DIALECT_CANDIDATES];
+	long length[GSM_DIALECT_CANDIDATES];
+	const char *in = utf8;
+	int candidates = 0;
+	int alive;
+	int count;
+	int i;
+
+	try_locking[candidates] = GSM_DIALECT_DEFAULT;
+	try_single[candidates++] = GSM_DIALECT_DEFAULT;
+
+	if (hint != GSM_DIALECT_DEFAULT) {
+		try_locking[candidates] = GSM_DIALECT_DEFAULT;
+		try_single[candidates++] = hint;
+	}
+
+	/* Spanish dialect uses the default locking shift table */
+	if (hint != GSM_DIALECT_DEFAULT && hint != GSM_DIALECT_SPANISH) {
+		try_locking[candidates] = hint;
+		try_single[candidates++] = hint;
+	}
+
+	for (i = 0; i < candidates; i++) {
+		if (conversion_table_init(&t[i], try_locking[i],
+						try_single[i]) == FALSE)
+			return 0;
+
+		length[i] = 0;
+	}
+
+	alive = candidates;
+
+	while ((len < 0 || utf8 + len - in > 0) && *in && alive > 0) {
+		long max = len < 0 ? 6 : utf8 + len - in;
+		gunichar c = g_utf8_get_char_validated(in, max);
+
+		if (c & 0x80000000)
+			return 0;
+
+		if (c > 0xffff)
+			return 0;
+
+		for (i = 0; i < candidates; i++) {
+			unsigned short converted;
+
+			if (length[i] < 0)
+				continue;
+
+			converted = unicode_locking_shift_lookup(&t[i], c);
+
+			if (converted == GUND)
+				converted = unicode_single_shift_lookup(&t[i],
+									c);
+
+			if (converted == GUND) {
+				length[i] = -1;
+				alive -= 1;
+			} else if (converted & 0x1b00)
+				length[i] += 2;
+			else
+				length[i] += 1;
+		}
+
+		in = g_utf8_next_char(in);
+	}
+
+	for (i = 0, count = 0; i < candidates; i++) {
+		if (length[i] < 0)
+			continue;
+
+		locking[count] = try_locking[i];
+		single[count] = try_single[i];
+		septets[count] = length[i];
+		count += 1;
+	}
+
+	return count;
+}
+
 /*!
  * Converts UTF-8 encoded text to GSM alphabet. It finds an encoding
  * that uses the minimum set of GSM dialects based on the hint given.
@@ -812,44 +974,32 @@ unsigned char *convert_utf8_to_gsm_best_lang(const char *utf8, long len,
 					enum gsm_dialect *used_locking,
 					enum gsm_dialect *used_single)
 {
-	enum gsm_dialect locking = GSM_DIALECT_DEFAULT;
-	enum gsm_dialect single = GSM_DIALECT_DEFAULT;
+	enum gsm_dialect locking[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect single[GSM_DIALECT_CANDIDATES];
+	long septets[GSM_DIALECT_CANDIDATES];
 	unsigned char *encoded;
 
-	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
-						items_written, terminator,
-						locking, single);
-	if (encoded != NULL)
-		goto out;
-
-	if (hint == GSM_DIALECT_DEFAULT)
-		return NULL;
-
-	single = hint;
-	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
-						items_written, terminator,
-						locking, single);
-	if (encoded != NULL)
-		goto out;
+	/* Only encode once, with the first pair that covers the text */
+	if (utf8_to_gsm_candidates(utf8, len, hint, locking, single,
+					septets) == 0) {
+		/* Let the default tables report how far we got */
+		if (items_read != NULL)
+			convert_utf8_to_gsm(utf8, len, items_read, NULL, 0);
 
-	/* Spanish dialect uses the default locking shift table */
-	if (hint == GSM_DIALECT_SPANISH)
 		return NULL;
+	}
 
-	locking = hint;
 	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
 						items_written, terminator,
-						locking, single);
-
+						locking[0], single[0]);
 	if (encoded == NULL)
 		return NULL;
 
-out:
 	if (used_locking != NULL)
-		*used_locking = locking;
+		*used_locking = locking[0];
 
 	if (used_single != NULL)
-		*used_single = single;
+		*used_single = single[0];
 
 	return encoded;
 }
@@ -999,6 +1149,37 @@ char *encode_hex(const unsigned char *in, long len, unsigned char terminator)
 	return encode_hex_own_buf(in, len, terminator, buf);
 }
 
+/*
+ * 7 octets hold exactly 8 septets, so once we are on a group boundary whole
+ * groups can be converted with a single 64 bit shift register instead of a
+ * shift, mask and branch per octet.
+ */
+static inline void unpack_7bit_group(const unsigned char *in,
+					unsigned char *out)
+{
+	guint64 v = 0;
+	int k;
+
+	for (k = 6; k >= 0; k--)
+		v = v << 8 | in[k];
+
+	for (k = 0; k < 8; k++)
+		out[k] = (v >> (7 * k)) & 0x7f;
+}
+
+static inline void pack_7bit_group(const unsigned char *in,
+					unsigned char *out)
+{
+	guint64 v = 0;
+	int k;
+
+	for (k = 7; k >= 0; k--)
+		v = v << 7 | in[k];
+
+	for (k = 0; k < 7; k++)
+		out[k] = v >> (8 * k);
+}
+
 unsigned char *unpack_7bit_own_buf(const unsigned char *in, long len,
 					int byte_offset, gboolean ussd,
 					long max_to_unpack, long *items_written,
@@ -1018,6 +1199,14 @@ unsigned char *unpack_7bit_own_buf(const unsigned char *in, long len,
 		max_to_unpack = len * 8 / 7;
 
 	for (i = 0; (i < len) && ((out-buf) < max_to_unpack); i++) {
+		if (bits == 7 && len - i >= 7 &&
+				max_to_unpack - (out - buf) >= 8) {
+			unpack_7bit_group(in + i, out);
+			out += 8;
+			i += 6;
+			continue;
+		}
+
 		/* Grab what we have in the current octet */
 		*out = (in[i] & ((1 << bits) - 1)) << (7 - bits);
 
@@ -1120,6 +1309,13 @@ unsigned char *pack_7bit_own_buf(const unsigned char *in, long len,
 	}
 
 	for (i = 0; i < len; i++) {
+		if (bits == 7 && len - i >= 8) {
+			pack_7bit_group(in + i, out);
+			out += 7;
+			i += 7;
+			continue;
+		}
+
 		if (bits != 7) {
 			*out |= (in[i] & ((1 << (7 - bits)) - 1)) <<
 					(bits + 1);
@@ -26,6 +26,9 @@ enum gsm_dialect {
 	GSM_DIALECT_PORTUGUESE,
 };
 
+/* Most dialect pairs utf8_to_gsm_candidates can return */
+#define GSM_DIALECT_CANDIDATES 3
+
 char *convert_gsm_to_utf8(const unsigned char *text, long len, long *items_read,
 				long *items_written, unsigned char terminator);
 
@@ -44,6 +47,10 @@ unsigned char *convert_utf8_to_gsm_with_lang(const char *text, long len,
 					enum gsm_dialect locking_shift_lang,
 					enum gsm_dialect single_shift_lang);
 
+int utf8_to_gsm_candidates(const char *utf8, long len, enum gsm_dialect hint,
+				enum gsm_dialect *locking,
+				enum gsm_dialect *single, long *septets);
+
 unsigned char *convert_utf8_to_gsm_best_lang(const char *utf8, long len,
 					long *items_read, long *items_written,
 					unsigned char terminator,
@@ -0,0 +1,660 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gatchat.h"
+#include "gathdlc.h"
+#include "gsm0710.h"
+
+#define NOTIFY_LINES 20000
+#define TRACE_PASSES 2000
+#define RESULT_PASSES 20000
+#define HDLC_FRAMES 4000
+#define HDLC_FRAME_SIZE 1500
+#define MUX_PASSES 200
+
+static const char *urc_prefixes[] = {
+	"+CREG:", "+CGREG:", "+CSQ:", "+CIEV:", "+CMTI:", "+CMT:",
+	"+CBM:", "+CDS:", "+CUSD:", "+CRING:", "+CLIP:", "+CCWA:",
+	"RING", "NO CARRIER", NULL
+};
+
+static const char *urc_lines[] = {
+	"+CREG: 1,\"1A2B\",\"0000C0DE\",2",
+	"+CSQ: 21,99",
+	"+CIEV: 2,3",
+	"+CGREG: 1,\"1A2B\",\"0000C0DE\",2,\"01\"",
+	"+CUSD: 0,\"Balance 42.00\",15",
+	"+ZUNKNOWN: 7",
+	NULL
+};
+
+/* A recorded session with a gsmv1 modem, echo disabled */
+static const char modem_trace[] =
+	"\r\n+CSQ: 21,99\r\n\r\nOK\r\n"
+	"\r\n+CREG: 2,1,\"1A2B\",\"0000C0DE\",2\r\n\r\nOK\r\n"
+	"\r\n+COPS: 0,0,\"Example Operator\",2\r\n\r\nOK\r\n"
+	"\r\n+CGDCONT: 1,\"IP\",\"internet\",\"0.0.0.0\",0,0\r\n"
+	"\r\n+CGDCONT: 2,\"IP\",\"mms\",\"0.0.0.0\",0,0\r\n\r\nOK\r\n"
+	"\r\n+CMTI: \"SM\",3\r\n"
+	"\r\n+CLCC: 1,1,4,0,0,\"+15551234567\",145\r\n\r\nOK\r\n"
+	"\r\n+CPMS: \"SM\",3,30,\"SM\",3,30,\"SM\",3,30\r\n\r\nOK\r\n"
+	"\r\nRING\r\n"
+	"\r\n+CLIP: \"+15551234567\",145,,,,0\r\n"
+	"\r\nNO CARRIER\r\n"
+	"\r\n+CME ERROR: 30\r\n";
+
+static const char *cgdcont_lines[] = {
+	"+CGDCONT: 1,\"IP\",\"internet\",\"0.0.0.0\",0,0",
+	"+CGDCONT: 2,\"IP\",\"mms\",\"0.0.0.0\",0,0",
+	"+CGDCONT: 3,\"IPV6\",\"ims\",\"\",0,0",
+	"+CGDCONT: 4,\"IP\",\"wap.example.com\",\"10.0.0.1\",1,1",
+	NULL
+};
+
+/*
+ * Allocations are counted by defining malloc, calloc and realloc in the
+ * program itself, so that GLib's own calls to them end up here as well.
+ * The real work is left to the C library, which glibc exports for this.
+ */
+static gsize alloc_count;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	alloc_count += 1;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	alloc_count += 1;
+
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+		alloc_count += 1;
+
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static const char *allocs_per(gsize allocs, unsigned int count)
+{
+	static char buf[32];
+
+#ifndef __GLIBC__
+	return "n/a";
+#endif
+
+	if (count == 0)
+		return "n/a";
+
+	snprintf(buf, sizeof(buf), "%.2f", (gdouble) allocs / count);
+
+	return buf;
+}
+
+static unsigned int notify_count;
+
+static void notify_cb(GAtResult *result, gpointer user_data)
+{
+	notify_count += 1;
+}
+
+static GString *build_urc_stream(unsigned int lines)
+{
+	GString *stream = g_string_sized_new(lines * 32);
+	unsigned int i;
+
+	for (i = 0; i < lines; i++) {
+		g_string_append(stream, "\r\n");
+		g_string_append(stream, urc_lines[i % 6]);
+		g_string_append(stream, "\r\n");
+	}
+
+	return stream;
+}
+
+/*
+ * Push data through a socketpair and spin the main loop until the other
+ * end has consumed it.  Returns the elapsed time in seconds.
+ */
+static gdouble feed_peer(int fd, const void *data, gsize len)
+{
+	GTimer *timer = g_timer_new();
+	gsize written = 0;
+	gdouble elapsed;
+
+	g_timer_start(timer);
+
+	while (written < len) {
+		ssize_t n = write(fd, (const char *) data + written,
+					len - written);
+
+		if (n > 0)
+			written += n;
+		else if (n < 0 && errno != EAGAIN)
+			break;
+
+		while (g_main_context_iteration(NULL, FALSE));
+	}
+
+	while (g_main_context_iteration(NULL, FALSE));
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+static GAtChat *create_chat(int *peer)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	GAtChat *chat;
+	int sk[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sk) < 0)
+		return NULL;
+
+	fcntl(sk[1], F_SETFL, fcntl(sk[1], F_GETFL) | O_NONBLOCK);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsmv1();
+	chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	*peer = sk[1];
+
+	return chat;
+}
+
+static void register_prefixes(GAtChat *chat, GHashTable *table,
+				unsigned int extra)
+{
+	unsigned int i;
+	char buf[16];
+
+	for (i = 0; urc_prefixes[i]; i++) {
+		g_at_chat_register(chat, urc_prefixes[i], notify_cb, FALSE,
+					NULL, NULL);
+		g_hash_table_insert(table, g_strdup(urc_prefixes[i]), chat);
+	}
+
+	/* Filler registrations sharing the common "+C" stem */
+	for (i = 0; i < extra; i++) {
+		snprintf(buf, sizeof(buf), "+CX%03u:", i);
+		g_at_chat_register(chat, buf, notify_cb, FALSE, NULL, NULL);
+		g_hash_table_insert(table, g_strdup(buf), chat);
+	}
+}
+
+static unsigned int scan_matches;
+
+/* Reference: the linear prefix scan previously used by GAtChat */
+static void linear_scan_cb(GAtResult *result, gpointer user_data)
+{
+	GHashTable *table = user_data;
+	GHashTableIter iter;
+	GAtResultIter line_iter;
+	gpointer key, value;
+	const char *line;
+
+	g_at_result_iter_init(&line_iter, result);
+	g_at_result_iter_next(&line_iter, NULL);
+	line = g_at_result_iter_raw_line(&line_iter);
+
+	g_hash_table_iter_init(&iter, table);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		if (g_str_has_prefix(line, key))
+			scan_matches += 1;
+}
+
+/*
+ * Every line of the stream starts with '+', so a single registration on
+ * it hands each line to the linear scan through the same socket, syntax
+ * and main loop as the trie is timed with.
+ */
+static gdouble linear_scan(GHashTable *table, GString *stream)
+{
+	GAtChat *chat;
+	gdouble elapsed;
+	int peer;
+
+	chat = create_chat(&peer);
+	g_assert(chat != NULL);
+
+	g_at_chat_register(chat, "+", linear_scan_cb, FALSE, table, NULL);
+
+	scan_matches = 0;
+	elapsed = feed_peer(peer, stream->str, stream->len);
+
+	g_at_chat_unref(chat);
+	close(peer);
+
+	return elapsed;
+}
+
+static void bench_notify_dispatch(void)
+{
+	static const unsigned int extra[] = { 0, 16, 64, 256 };
+	GString *stream = build_urc_stream(NOTIFY_LINES);
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(extra); i++) {
+		GHashTable *table;
+		GAtChat *chat;
+		gdouble chat_time;
+		gdouble scan_time;
+		int peer;
+
+		chat = create_chat(&peer);
+		g_assert(chat != NULL);
+
+		table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, NULL);
+		register_prefixes(chat, table, extra[i]);
+
+		notify_count = 0;
+		chat_time = feed_peer(peer, stream->str, stream->len);
+		scan_time = linear_scan(table, stream);
+
+		g_assert(notify_count == scan_matches);
+
+		g_print("notify dispatch, %3u prefixes: "
+			"%10.0f lines/s (trie), %10.0f lines/s "
+			"(linear scan)\n",
+			g_hash_table_size(table),
+			NOTIFY_LINES / chat_time, NOTIFY_LINES / scan_time);
+
+		g_hash_table_destroy(table);
+		g_at_chat_unref(chat);
+		close(peer);
+	}
+
+	g_string_free(stream, TRUE);
+}
+
+/* Returns the number of complete lines the syntax reported */
+static unsigned int syntax_replay(GAtSyntax *syntax, const char *trace,
+					gsize len)
+{
+	unsigned int lines = 0;
+	gsize pos = 0;
+
+	while (pos < len) {
+		gsize rbytes = len - pos;
+		GAtSyntaxResult result;
+
+		result = syntax->feed(syntax, trace + pos, &rbytes);
+		pos += rbytes;
+
+		if (result == G_AT_SYNTAX_RESULT_LINE ||
+				result == G_AT_SYNTAX_RESULT_MULTILINE ||
+				result == G_AT_SYNTAX_RESULT_PDU)
+			lines += 1;
+
+		if (rbytes == 0)
+			break;
+	}
+
+	return lines;
+}
+
+static void bench_syntax_feed(void)
+{
+	static const struct {
+		const char *name;
+		GAtSyntax *(*create)(void);
+	} syntaxes[] = {
+		{ "gsmv1", g_at_syntax_new_gsmv1 },
+		{ "permissive", g_at_syntax_new_gsm_permissive },
+	};
+	gsize len = sizeof(modem_trace) - 1;
+	unsigned int i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(syntaxes); i++) {
+		GAtSyntax *syntax = syntaxes[i].create();
+		GTimer *timer = g_timer_new();
+		unsigned int lines = 0;
+		gdouble elapsed;
+
+		g_timer_start(timer);
+
+		for (j = 0; j < TRACE_PASSES; j++)
+			lines += syntax_replay(syntax, modem_trace, len);
+
+		elapsed = g_timer_elapsed(timer, NULL);
+		g_timer_destroy(timer);
+
+		g_assert(lines > 0);
+
+		g_print("syntax feed, %-10s: %12.0f bytes/s, %10.0f lines/s\n",
+			syntaxes[i].name, len * TRACE_PASSES / elapsed,
+			lines / elapsed);
+
+		g_at_syntax_unref(syntax);
+	}
+}
+
+static void bench_line_extraction(void)
+{
+	GString *stream = g_string_sized_new(sizeof(modem_trace) *
+						TRACE_PASSES);
+	GAtSyntax *syntax = g_at_syntax_new_gsmv1();
+	GHashTable *table;
+	GAtChat *chat;
+	unsigned int lines;
+	gsize allocs;
+	gdouble elapsed;
+	unsigned int i;
+	int peer;
+
+	lines = syntax_replay(syntax, modem_trace, sizeof(modem_trace) - 1);
+	lines *= TRACE_PASSES;
+	g_at_syntax_unref(syntax);
+
+	for (i = 0; i < TRACE_PASSES; i++)
+		g_string_append_len(stream, modem_trace,
+					sizeof(modem_trace) - 1);
+
+	chat = create_chat(&peer);
+	g_assert(chat != NULL);
+
+	table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	register_prefixes(chat, table, 0);
+
+	allocs = alloc_count;
+	elapsed = feed_peer(peer, stream->str, stream->len);
+	allocs = alloc_count - allocs;
+
+	g_print("line extraction: %12.0f bytes/s, %10.0f lines/s, "
+		"%s allocations/line\n", stream->len / elapsed,
+		lines / elapsed, allocs_per(allocs, lines));
+
+	g_hash_table_destroy(table);
+	g_at_chat_unref(chat);
+	close(peer);
+
+	g_string_free(stream, TRUE);
+}
+
+static void bench_result_iter(void)
+{
+	GAtResult result;
+	GAtResultIter iter;
+	GTimer *timer;
+	unsigned int lines = 0;
+	gsize allocs;
+	gdouble elapsed;
+	unsigned int i;
+
+	result.lines = NULL;
+	result.final_or_pdu = "OK";
+
+	for (i = 0; cgdcont_lines[i]; i++)
+		result.lines = g_slist_append(result.lines,
+						(char *) cgdcont_lines[i]);
+
+	timer = g_timer_new();
+	allocs = alloc_count;
+	g_timer_start(timer);
+
+	for (i = 0; i < RESULT_PASSES; i++) {
+		g_at_result_iter_init(&iter, &result);
+
+		while (g_at_result_iter_next(&iter, "+CGDCONT:")) {
+			const char *str;
+			int cid, num;
+
+			g_assert(g_at_result_iter_next_number(&iter, &cid));
+			g_assert(g_at_result_iter_next_string(&iter, &str));
+			g_assert(g_at_result_iter_next_string(&iter, &str));
+			g_assert(g_at_result_iter_next_string(&iter, &str));
+			g_assert(g_at_result_iter_next_number(&iter, &num));
+			g_assert(g_at_result_iter_next_number(&iter, &num));
+
+			lines += 1;
+		}
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	allocs = alloc_count - allocs;
+	g_timer_destroy(timer);
+
+	g_print("result iteration: %10.0f lines/s, %s allocations/line\n",
+		lines / elapsed, allocs_per(allocs, lines));
+
+	g_slist_free(result.lines);
+}
+
+static gsize hdlc_received;
+
+static void hdlc_receive_cb(const unsigned char *buf, gsize len, void *data)
+{
+	hdlc_received += len;
+}
+
+static void drain_peer(int fd, GByteArray *out)
+{
+	guint8 buf[4096];
+	ssize_t n;
+
+	while (g_main_context_iteration(NULL, FALSE));
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		g_byte_array_append(out, buf, n);
+		while (g_main_context_iteration(NULL, FALSE));
+	}
+}
+
+static void bench_hdlc(void)
+{
+	static const guint32 accms[] = { 0, ~0U };
+	guint8 *payload = g_malloc(HDLC_FRAME_SIZE);
+	unsigned int i, j;
+
+	srand(0);
+
+	for (i = 0; i < HDLC_FRAME_SIZE; i++)
+		payload[i] = rand() & 0xff;
+
+	for (i = 0; i < G_N_ELEMENTS(accms); i++) {
+		GByteArray *encoded = g_byte_array_new();
+		GIOChannel *channel;
+		GAtHDLC *hdlc;
+		GTimer *timer;
+		gdouble encode_time;
+		gdouble decode_time;
+		gsize total = (gsize) HDLC_FRAMES * HDLC_FRAME_SIZE;
+		int sk[2];
+
+		g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+		fcntl(sk[1], F_SETFL, fcntl(sk[1], F_GETFL) | O_NONBLOCK);
+
+		channel = g_io_channel_unix_new(sk[0]);
+		g_io_channel_set_close_on_unref(channel, TRUE);
+		hdlc = g_at_hdlc_new(channel);
+		g_io_channel_unref(channel);
+
+		g_at_hdlc_set_xmit_accm(hdlc, accms[i]);
+		g_at_hdlc_set_recv_accm(hdlc, accms[i]);
+		g_at_hdlc_set_receive(hdlc, hdlc_receive_cb, NULL);
+
+		timer = g_timer_new();
+		g_timer_start(timer);
+
+		for (j = 0; j < HDLC_FRAMES; j++)
+			while (g_at_hdlc_send(hdlc, payload,
+						HDLC_FRAME_SIZE) == FALSE)
+				drain_peer(sk[1], encoded);
+
+		drain_peer(sk[1], encoded);
+
+		encode_time = g_timer_elapsed(timer, NULL);
+		g_timer_destroy(timer);
+
+		hdlc_received = 0;
+		decode_time = feed_peer(sk[1], encoded->data, encoded->len);
+
+		g_assert(hdlc_received == total);
+
+		g_print("hdlc, accm %08x: %12.0f bytes/s encode, "
+			"%12.0f bytes/s decode\n", accms[i],
+			total / encode_time, total / decode_time);
+
+		g_at_hdlc_unref(hdlc);
+		close(sk[1]);
+		g_byte_array_free(encoded, TRUE);
+	}
+
+	g_free(payload);
+}
+
+typedef int (*MuxFillFunc)(guint8 *frame, guint8 dlc, guint8 type,
+				const guint8 *data, int len);
+typedef int (*MuxExtractFunc)(guint8 *data, int len,
+				guint8 *out_dlc, guint8 *out_type,
+				guint8 **frame, int *out_len);
+
+static void bench_mux_mode(const char *name, int frame_size,
+				MuxFillFunc fill, MuxExtractFunc extract)
+{
+	GByteArray *stream = g_byte_array_new();
+	guint8 *frame = g_malloc(frame_size * 2 + 8);
+	guint8 *payload = g_malloc(frame_size);
+	guint8 *work;
+	GTimer *timer;
+	gsize total = 0;
+	unsigned int i;
+	int len;
+
+	srand(0);
+
+	/* Traffic spread over a few DLCs, payloads include flag bytes */
+	for (i = 0; i < 1000; i++) {
+		int j;
+
+		for (j = 0; j < frame_size; j++)
+			payload[j] = rand() & 0xff;
+
+		len = fill(frame, i % 4 + 1, GSM0710_DATA, payload,
+				frame_size);
+		g_byte_array_append(stream, frame, len);
+	}
+
+	work = g_malloc(stream->len);
+	timer = g_timer_new();
+	g_timer_stop(timer);
+
+	for (i = 0; i < MUX_PASSES; i++) {
+		int posn = 0;
+
+		/* Extraction unquotes in place, start from a fresh copy */
+		memcpy(work, stream->data, stream->len);
+
+		g_timer_continue(timer);
+
+		while (posn < (int) stream->len) {
+			guint8 *out = NULL;
+			guint8 dlc, type;
+			int out_len;
+			int nread;
+
+			nread = extract(work + posn, stream->len - posn,
+					&dlc, &type, &out, &out_len);
+			posn += nread;
+
+			if (out == NULL)
+				break;
+
+			total += out_len;
+
+			if (nread == 0)
+				break;
+		}
+
+		g_timer_stop(timer);
+	}
+
+	g_assert(total == (gsize) MUX_PASSES * 1000 * frame_size);
+
+	g_print("07.10 %-8s, %3d byte frames: %12.0f bytes/s\n", name,
+		frame_size, total / g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+	g_free(work);
+	g_free(payload);
+	g_free(frame);
+	g_byte_array_free(stream, TRUE);
+}
+
+static void bench_mux(void)
+{
+	bench_mux_mode("basic", 31, gsm0710_basic_fill_frame,
+			gsm0710_basic_extract_frame);
+	bench_mux_mode("basic", 127, gsm0710_basic_fill_frame,
+			gsm0710_basic_extract_frame);
+	bench_mux_mode("advanced", 64, gsm0710_advanced_fill_frame,
+			gsm0710_advanced_extract_frame);
+	bench_mux_mode("advanced", 127, gsm0710_advanced_fill_frame,
+			gsm0710_advanced_extract_frame);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/benchgatchat/Notify dispatch", bench_notify_dispatch);
+	g_test_add_func("/benchgatchat/Syntax feed", bench_syntax_feed);
+	g_test_add_func("/benchgatchat/Line extraction", bench_line_extraction);
+	g_test_add_func("/benchgatchat/Result iteration", bench_result_iter);
+	g_test_add_func("/benchgatchat/HDLC", bench_hdlc);
+	g_test_add_func("/benchgatchat/GSM 07.10", bench_mux);
+
+	return g_test_run();
+}
@@ -0,0 +1,87 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gat-fixture.h"
+
+void fixture_spin(void)
+{
+	int i;
+
+	/* Idle and timeout sources may queue more work, give them a chance */
+	for (i = 0; i < 10; i++)
+		while (g_main_context_iteration(NULL, FALSE));
+}
+
+void fixture_set_nonblock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+GIOChannel *fixture_channel_new(int *peer)
+{
+	GIOChannel *channel;
+	int sk[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	fixture_set_nonblock(sk[1]);
+	*peer = sk[1];
+
+	return channel;
+}
+
+guint fixture_build_ipv4(guint8 *buf, guint16 len, guint8 seed)
+{
+	guint32 sum = 0;
+	guint i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = seed + i;
+
+	buf[0] = 0x45;
+	buf[2] = len >> 8;
+	buf[3] = len;
+	buf[10] = 0;
+	buf[11] = 0;
+
+	for (i = 0; i < 20; i += 2)
+		sum += buf[i] << 8 | buf[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	buf[10] = ~sum >> 8;
+	buf[11] = ~sum;
+
+	return len;
+}
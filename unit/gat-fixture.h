@@ -0,0 +1,37 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Runs the main loop until nothing is left to dispatch */
+void fixture_spin(void);
+
+void fixture_set_nonblock(int fd);
+
+/*
+ * Returns one end of a stream socketpair as a channel, closed along with
+ * it, and hands the other, non-blocking end back in peer to act as modem.
+ */
+GIOChannel *fixture_channel_new(int *peer);
+
+/*
+ * Fills buf with an IPv4 packet of len bytes, a valid header followed by
+ * bytes counting up from seed.  Returns len.
+ */
+guint fixture_build_ipv4(guint8 *buf, guint16 len, guint8 seed);
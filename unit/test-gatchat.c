@@ -0,0 +1,492 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "gatchat.h"
+#include "gat-fixture.h"
+
+static const char *pipeline_cmds[] = { "+CGMI", "+CGMM", "+CGSN", NULL };
+
+static GString *results;
+
+static GAtChat *create_chat(int *peer)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	GAtChat *chat;
+
+	channel = fixture_channel_new(peer);
+
+	syntax = g_at_syntax_new_gsmv1();
+	chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	return chat;
+}
+
+/* Everything the modem side received since the last call */
+static void check_sent(int peer, const char *expected)
+{
+	char buf[256];
+	ssize_t len;
+
+	fixture_spin();
+
+	len = read(peer, buf, sizeof(buf) - 1);
+	if (len < 0)
+		len = 0;
+
+	buf[len] = '\0';
+
+	g_assert_cmpstr(buf, ==, expected);
+}
+
+static void respond(int peer, const char *response)
+{
+	gsize len = strlen(response);
+
+	g_assert(write(peer, response, len) == (ssize_t) len);
+	fixture_spin();
+}
+
+static void result_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	GSList *l;
+
+	g_string_append_printf(results, "%s:", (char *) user_data);
+
+	for (l = result->lines; l; l = l->next)
+		g_string_append_printf(results, "%s,", (char *) l->data);
+
+	g_string_append_printf(results, "%s;", result->final_or_pdu);
+}
+
+static void check_results(const char *expected)
+{
+	g_assert_cmpstr(results->str, ==, expected);
+	g_string_truncate(results, 0);
+}
+
+static void test_no_pipeline(void)
+{
+	GAtChat *chat;
+	int peer;
+
+	chat = create_chat(&peer);
+	results = g_string_new(NULL);
+
+	g_at_chat_send(chat, "AT+CGMI", NULL, result_cb, "cgmi", NULL);
+	g_at_chat_send(chat, "AT+CGMM", NULL, result_cb, "cgmm", NULL);
+
+	check_sent(peer, "AT+CGMI\r");
+	respond(peer, "\r\nACME\r\n\r\nOK\r\n");
+	check_results("cgmi:ACME,OK;");
+
+	check_sent(peer, "AT+CGMM\r");
+	respond(peer, "\r\nRocket\r\n\r\nOK\r\n");
+	check_results("cgmm:Rocket,OK;");
+
+	g_assert(g_at_chat_get_pipeline_stats(chat, NULL) == 0);
+
+	g_at_chat_unref(chat);
+	g_string_free(results, TRUE);
+	close(peer);
+}
+
+static void test_pipeline(void)
+{
+	GAtChat *chat;
+	gdouble saved;
+	int peer;
+
+	chat = create_chat(&peer);
+	results = g_string_new(NULL);
+
+	g_assert(g_at_chat_set_pipeline(chat, 3, pipeline_cmds));
+
+	g_at_chat_send(chat, "AT+CGMI", NULL, result_cb, "cgmi", NULL);
+	g_at_chat_send(chat, "AT+CGMM", NULL, result_cb, "cgmm", NULL);
+	g_at_chat_send(chat, "AT+CGSN", NULL, result_cb, "cgsn", NULL);
+	g_at_chat_send(chat, "AT+CFUN=1", NULL, result_cb, "cfun", NULL);
+	g_at_chat_send(chat, "AT+CGMI", NULL, result_cb, "cgmi", NULL);
+
+	/* Up to the depth, and never past a command that isn't allowed */
+	check_sent(peer, "AT+CGMI\rAT+CGMM\rAT+CGSN\r");
+
+	respond(peer, "\r\nACME\r\n\r\nOK\r\n\r\nRocket\r\n\r\nOK\r\n");
+	check_results("cgmi:ACME,OK;cgmm:Rocket,OK;");
+	check_sent(peer, "");
+
+	respond(peer, "\r\n12345\r\n\r\nOK\r\n");
+	check_results("cgsn:12345,OK;");
+
+	/* Nothing is written ahead of a command that isn't allowed */
+	check_sent(peer, "AT+CFUN=1\r");
+	respond(peer, "\r\nOK\r\n");
+	check_results("cfun:OK;");
+
+	check_sent(peer, "AT+CGMI\r");
+	respond(peer, "\r\nACME\r\n\r\nOK\r\n");
+	check_results("cgmi:ACME,OK;");
+
+	g_assert(g_at_chat_get_pipeline_stats(chat, &saved) == 2);
+	g_assert(saved > 0);
+
+	g_at_chat_unref(chat);
+	g_string_free(results, TRUE);
+	close(peer);
+}
+
+static void test_pipeline_cancel(void)
+{
+	GAtChat *chat;
+	guint id;
+	int peer;
+
+	chat = create_chat(&peer);
+	results = g_string_new(NULL);
+
+	g_at_chat_set_pipeline(chat, 2, pipeline_cmds);
+
+	g_at_chat_send(chat, "AT+CGMI", NULL, result_cb, "cgmi", NULL);
+	id = g_at_chat_send(chat, "AT+CGMM", NULL, result_cb, "cgmm", NULL);
+	g_at_chat_send(chat, "AT+CGSN", NULL, result_cb, "cgsn", NULL);
+
+	check_sent(peer, "AT+CGMI\rAT+CGMM\r");
+
+	/* Already sent, the response must still be consumed */
+	g_assert(g_at_chat_cancel(chat, id));
+
+	respond(peer, "\r\nACME\r\n\r\nOK\r\n");
+	check_results("cgmi:ACME,OK;");
+	check_sent(peer, "AT+CGSN\r");
+
+	respond(peer, "\r\nRocket\r\n\r\nOK\r\n\r\n12345\r\n\r\nOK\r\n");
+	check_results("cgsn:12345,OK;");
+
+	g_at_chat_unref(chat);
+	g_string_free(results, TRUE);
+	close(peer);
+}
+
+static const char *iter_lines[] = {
+	"+CPBR: 1,\"+15551234567\",145,\"Alice\"",
+	"+CMGL: 2,1,,23",
+	"07911326040000F0040B911346610089F60000208062917314080CC8F71D14969741F977FD07",
+	"+COPS: (2,\"Op A\",\"OpA\",\"00101\"),(1,\"Op B\",\"OpB\",\"00102\"),,(0-4),(0,2)",
+	"+CSIM: 4,\"9000\"",
+	"+CUSD: 0,,15",
+	NULL
+};
+
+static void test_result_iter(void)
+{
+	GAtResult result;
+	GAtResultIter iter;
+	const guint8 *hex;
+	const char *str;
+	gint length;
+	gint num, min, max;
+	int i;
+
+	result.lines = NULL;
+	result.final_or_pdu = NULL;
+
+	for (i = 0; iter_lines[i]; i++)
+		result.lines = g_slist_append(result.lines,
+						(char *) iter_lines[i]);
+
+	g_at_result_iter_init(&iter, &result);
+
+	g_assert(g_at_result_iter_next(&iter, "+CPBR:"));
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 1);
+	g_assert(g_at_result_iter_next_string_span(&iter, &str, &length));
+	g_assert(length == 12 && strncmp(str, "+15551234567", 12) == 0);
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 145);
+	g_assert(g_at_result_iter_next_string(&iter, &str));
+	g_assert_cmpstr(str, ==, "Alice");
+
+	g_assert(g_at_result_iter_next(&iter, "+CMGL:"));
+	g_assert(g_at_result_iter_skip_next(&iter));
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 1);
+	g_assert(g_at_result_iter_next_string(&iter, &str));
+	g_assert_cmpstr(str, ==, "");
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 23);
+
+	g_assert(g_at_result_iter_next(&iter, NULL));
+	g_assert(g_at_result_iter_next_hexstring(&iter, &hex, &length));
+	g_assert(length == 38 && hex[0] == 0x07 && hex[37] == 0x07);
+
+	g_assert(g_at_result_iter_next(&iter, "+COPS:"));
+	g_assert(g_at_result_iter_open_list(&iter));
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 2);
+	g_assert(g_at_result_iter_next_string(&iter, &str));
+	g_assert_cmpstr(str, ==, "Op A");
+	g_assert(g_at_result_iter_skip_next(&iter));
+	g_assert(g_at_result_iter_next_string(&iter, &str));
+	g_assert_cmpstr(str, ==, "00101");
+	g_assert(g_at_result_iter_close_list(&iter));
+	g_assert(g_at_result_iter_skip_next(&iter));
+	g_assert(g_at_result_iter_skip_next(&iter));
+	g_assert(g_at_result_iter_open_list(&iter));
+	g_assert(g_at_result_iter_next_range(&iter, &min, &max));
+	g_assert(min == 0 && max == 4);
+	g_assert(g_at_result_iter_close_list(&iter));
+	g_assert(g_at_result_iter_open_list(&iter));
+	g_assert(g_at_result_iter_next_unquoted_string(&iter, &str));
+	g_assert_cmpstr(str, ==, "0");
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 2);
+	g_assert(g_at_result_iter_close_list(&iter));
+
+	g_assert(g_at_result_iter_next(&iter, "+CSIM:"));
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 4);
+	g_assert(g_at_result_iter_next_hexstring(&iter, &hex, &length));
+	g_assert(length == 2 && hex[0] == 0x90 && hex[1] == 0x00);
+
+	g_assert(g_at_result_iter_next(&iter, "+CUSD:"));
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 0);
+	g_assert(g_at_result_iter_next_hexstring_span(&iter, &str, &length));
+	g_assert(length == 0);
+	g_assert(g_at_result_iter_next_number(&iter, &num) && num == 15);
+
+	g_assert(g_at_result_iter_next(&iter, "+CPBR:") == FALSE);
+
+	g_slist_free(result.lines);
+}
+
+static const char syntax_trace[] =
+	"\r\n+CSQ: 21,99\r\n\r\nOK\r\n"
+	"\r\n+COPS: 0,0,\"Op \r\n X\",2\r\n\r\nOK\r\n"
+	"\r\n+CMTI: \"SM\",3\r\n";
+
+static const char syntax_lines[] =
+	"+CSQ: 21,99|OK|+COPS: 0,0,\"Op \r\n X\",2|OK|+CMTI: \"SM\",3|";
+
+/* Feed the trace in chunks and cut out lines where the syntax says */
+static void check_syntax_lines(GAtSyntax *syntax, gsize chunk)
+{
+	GString *lines = g_string_new(NULL);
+	gsize len = sizeof(syntax_trace) - 1;
+	gsize start = 0;
+	gsize pos = 0;
+
+	while (pos < len) {
+		gsize rbytes = MIN(chunk, len - pos);
+		GAtSyntaxResult result;
+		gsize front;
+
+		result = syntax->feed(syntax, syntax_trace + pos, &rbytes);
+		pos += rbytes;
+
+		if (result == G_AT_SYNTAX_RESULT_UNSURE)
+			continue;
+
+		g_assert(result == G_AT_SYNTAX_RESULT_LINE);
+		g_assert(syntax->line_end >= 0);
+
+		front = start;
+		while (syntax_trace[front] == '\r' ||
+				syntax_trace[front] == '\n')
+			front += 1;
+
+		g_string_append_len(lines, syntax_trace + front,
+					start + syntax->line_end - front);
+		g_string_append_c(lines, '|');
+
+		start = pos;
+	}
+
+	g_assert_cmpstr(lines->str, ==, syntax_lines);
+	g_string_free(lines, TRUE);
+}
+
+static void test_syntax_line_end(void)
+{
+	static const gsize chunks[] = { 1, 2, 3, 7, 1024 };
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(chunks); i++) {
+		GAtSyntax *syntax = g_at_syntax_new_gsmv1();
+
+		check_syntax_lines(syntax, chunks[i]);
+		g_at_syntax_unref(syntax);
+
+		syntax = g_at_syntax_new_gsm_permissive();
+		check_syntax_lines(syntax, chunks[i]);
+		g_at_syntax_unref(syntax);
+	}
+}
+
+static void notify_cb(GAtResult *result, gpointer user_data)
+{
+	g_string_append_printf(results, "%s:%s;", (char *) user_data,
+				(char *) result->lines->data);
+}
+
+static void test_notify_prefix(void)
+{
+	GAtChat *chat;
+	guint cr;
+	int peer;
+
+	chat = create_chat(&peer);
+	results = g_string_new(NULL);
+
+	/* The empty prefix is refused, it would take every line */
+	g_assert(g_at_chat_register(chat, "", notify_cb, FALSE,
+					"any", NULL) == 0);
+
+	cr = g_at_chat_register(chat, "+CR", notify_cb, FALSE, "cr", NULL);
+	g_assert(cr != 0);
+	g_assert(g_at_chat_register(chat, "+CRING:", notify_cb, FALSE,
+					"cring", NULL) != 0);
+	g_assert(g_at_chat_register(chat, "+CRING: VOICE", notify_cb, FALSE,
+					"voice", NULL) != 0);
+
+	/* Every registered prefix of a line fires, longest first */
+	respond(peer, "\r\n+CRING: VOICE\r\n");
+	check_results("voice:+CRING: VOICE;cring:+CRING: VOICE;"
+			"cr:+CRING: VOICE;");
+
+	respond(peer, "\r\nRING\r\n\r\n+CREG: 1\r\n");
+	check_results("cr:+CREG: 1;");
+
+	g_assert(g_at_chat_unregister(chat, cr));
+
+	respond(peer, "\r\n+CREG: 1\r\n\r\n+CRING: FAX\r\n");
+	check_results("cring:+CRING: FAX;");
+
+	/* PDU notifications go through the same walk */
+	g_assert(g_at_chat_register(chat, "+CMT:", notify_cb, TRUE,
+					"cmt", NULL) != 0);
+
+	respond(peer, "\r\n+CMT: ,4\r\n0001000000\r\n");
+	check_results("cmt:+CMT: ,4;");
+
+	g_at_chat_unref(chat);
+	g_string_free(results, TRUE);
+	close(peer);
+}
+
+#define URC_BURST 3000
+
+static unsigned int creg_count;
+
+static void creg_cb(GAtResult *result, gpointer user_data)
+{
+	GAtResultIter iter;
+	int status;
+
+	g_at_result_iter_init(&iter, result);
+	g_assert(g_at_result_iter_next(&iter, "+CREG:"));
+	g_assert(g_at_result_iter_next_number(&iter, &status));
+	g_assert(status == (int) (creg_count % 6));
+
+	creg_count += 1;
+}
+
+static void test_threaded_reader(void)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	GString *burst;
+	GAtChat *chat;
+	GAtIO *io;
+	gsize sent = 0;
+	ssize_t n;
+	int peer;
+	int i;
+
+	channel = fixture_channel_new(&peer);
+	io = g_at_io_new_threaded(channel);
+	g_io_channel_unref(channel);
+	g_assert(io != NULL);
+
+	syntax = g_at_syntax_new_gsmv1();
+	chat = g_at_chat_new_from_io(io, syntax);
+	g_at_syntax_unref(syntax);
+	g_at_io_unref(io);
+	g_assert(chat != NULL);
+
+	results = g_string_new(NULL);
+	creg_count = 0;
+
+	g_assert(g_at_chat_register(chat, "+CREG:", creg_cb, FALSE,
+					NULL, NULL) != 0);
+
+	/* Far more unsolicited results than the read buffer holds */
+	burst = g_string_new(NULL);
+
+	for (i = 0; i < URC_BURST; i++)
+		g_string_append_printf(burst, "\r\n+CREG: %d\r\n", i % 6);
+
+	while (sent < burst->len || creg_count < URC_BURST) {
+		if (sent < burst->len) {
+			n = write(peer, burst->str + sent, burst->len - sent);
+			if (n > 0)
+				sent += n;
+		}
+
+		g_main_context_iteration(NULL, sent == burst->len);
+	}
+
+	g_assert(creg_count == URC_BURST);
+
+	/* Commands still go out and get their response */
+	g_at_chat_send(chat, "AT+CGMI", NULL, result_cb, "cgmi", NULL);
+	check_sent(peer, "AT+CGMI\r");
+	respond(peer, "\r\nACME\r\n\r\nOK\r\n");
+	check_results("cgmi:ACME,OK;");
+
+	g_at_chat_unref(chat);
+	g_string_free(burst, TRUE);
+	g_string_free(results, TRUE);
+	close(peer);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef NEED_THREADS
+	if (g_thread_supported() == FALSE)
+		g_thread_init(NULL);
+#endif
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testgatchat/No pipeline", test_no_pipeline);
+	g_test_add_func("/testgatchat/Pipeline", test_pipeline);
+	g_test_add_func("/testgatchat/Pipeline cancel", test_pipeline_cancel);
+	g_test_add_func("/testgatchat/Result iter", test_result_iter);
+	g_test_add_func("/testgatchat/Syntax line end", test_syntax_line_end);
+	g_test_add_func("/testgatchat/Notify prefix", test_notify_prefix);
+	g_test_add_func("/testgatchat/Threaded reader", test_threaded_reader);
+
+	return g_test_run();
+}
@@ -0,0 +1,353 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "ringbuffer.h"
+#include "gatio.h"
+#include "gat-fixture.h"
+
+#define STREAM_LEN 200000
+
+static guint8 stream_byte(unsigned int i)
+{
+	return i * 7 + (i >> 8);
+}
+
+/* Printable, so that the debug output can be compared byte for byte */
+static char text_byte(unsigned int i)
+{
+	return 'A' + (i * 7 + (i >> 8)) % 26;
+}
+
+static void test_wrap(void)
+{
+	struct ring_buffer *buf = ring_buffer_new(16);
+	struct iovec iov[2];
+	guint8 in[16];
+	guint8 out[16];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = stream_byte(i);
+
+	g_assert(ring_buffer_capacity(buf) == 16);
+
+	g_assert(ring_buffer_write(buf, in, 10) == 10);
+	g_assert(ring_buffer_read(buf, out, 6) == 6);
+	g_assert(memcmp(out, in, 6) == 0);
+
+	/* Runs over the end and comes back in at the start */
+	g_assert(ring_buffer_avail(buf) == 12);
+	g_assert(ring_buffer_write(buf, in + 10, 6) == 6);
+	g_assert(ring_buffer_len(buf) == 10);
+	g_assert(ring_buffer_len_no_wrap(buf) == 10);
+
+	g_assert(ring_buffer_write(buf, in, 6) == 6);
+	g_assert(ring_buffer_len(buf) == 16);
+	g_assert(ring_buffer_len_no_wrap(buf) == 10);
+	g_assert(ring_buffer_read_iov(buf, iov) == 2);
+	g_assert(iov[0].iov_len == 10 && iov[1].iov_len == 6);
+
+	/* Full, nothing more goes in */
+	g_assert(ring_buffer_avail(buf) == 0);
+	g_assert(ring_buffer_write(buf, in, 1) == 0);
+
+	g_assert(ring_buffer_read(buf, out, sizeof(out)) == 16);
+	g_assert(memcmp(out, in + 6, 10) == 0);
+	g_assert(memcmp(out + 10, in, 6) == 0);
+	g_assert(ring_buffer_len(buf) == 0);
+
+	ring_buffer_free(buf);
+}
+
+static void test_snapshot(void)
+{
+	struct ring_buffer *buf = ring_buffer_new_shared(16);
+	guint8 in[20];
+	guint8 out[16];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = stream_byte(i);
+
+	g_assert(ring_buffer_write(buf, in, 10) == 10);
+
+	/* Nothing is visible to the consumer until it takes a snapshot */
+	g_assert(ring_buffer_len(buf) == 0);
+	g_assert(ring_buffer_read(buf, out, sizeof(out)) == 0);
+	g_assert(ring_buffer_snapshot(buf) == 10);
+	g_assert(ring_buffer_snapshot(buf) == 0);
+
+	g_assert(ring_buffer_write(buf, in + 10, 2) == 2);
+	g_assert(ring_buffer_len(buf) == 10);
+	g_assert(ring_buffer_read(buf, out, 4) == 4);
+	g_assert(ring_buffer_drain(buf, 10) == 6);
+
+	/* Shared buffers aren't rewound, so this one wraps */
+	g_assert(ring_buffer_write(buf, in + 12, 8) == 8);
+	g_assert(ring_buffer_write(buf, in, 8) == 6);
+	g_assert(ring_buffer_avail(buf) == 0);
+
+	g_assert(ring_buffer_snapshot(buf) == 16);
+	g_assert(ring_buffer_read(buf, out, sizeof(out)) == 16);
+	g_assert(memcmp(out, in + 10, 10) == 0);
+	g_assert(memcmp(out + 10, in, 6) == 0);
+
+	/* Private buffers show everything right away */
+	ring_buffer_free(buf);
+	buf = ring_buffer_new(16);
+
+	g_assert(ring_buffer_write(buf, in, 10) == 10);
+	g_assert(ring_buffer_snapshot(buf) == 0);
+	g_assert(ring_buffer_len(buf) == 10);
+
+	ring_buffer_free(buf);
+}
+
+#ifdef NEED_THREADS
+static gpointer producer(gpointer user_data)
+{
+	struct ring_buffer *buf = user_data;
+	guint8 chunk[48];
+	unsigned int sent = 0;
+	unsigned int len = 1;
+	unsigned int i;
+	int n;
+
+	while (sent < STREAM_LEN) {
+		/* Vary the chunk size so the writes wrap at all offsets */
+		len = len % sizeof(chunk) + 1;
+		len = MIN(len, STREAM_LEN - sent);
+
+		for (i = 0; i < len; i++)
+			chunk[i] = stream_byte(sent + i);
+
+		for (i = 0; i < len; i += n) {
+			n = ring_buffer_write(buf, chunk + i, len - i);
+
+			/* Full, wait for the consumer */
+			if (n == 0)
+				g_thread_yield();
+		}
+
+		sent += len;
+	}
+
+	return NULL;
+}
+
+static void test_shared_threads(void)
+{
+	struct ring_buffer *buf = ring_buffer_new_shared(64);
+	unsigned int received = 0;
+	guint8 out[40];
+	GThread *thread;
+	int n;
+	int i;
+
+	thread = g_thread_create(producer, buf, TRUE, NULL);
+	g_assert(thread != NULL);
+
+	/* Let the producer run into a full buffer first */
+	while (received < (unsigned int) ring_buffer_capacity(buf)) {
+		received += ring_buffer_snapshot(buf);
+		g_thread_yield();
+	}
+
+	g_assert(ring_buffer_len(buf) == ring_buffer_capacity(buf));
+	received = 0;
+
+	while (received < STREAM_LEN) {
+		ring_buffer_snapshot(buf);
+
+		n = ring_buffer_read(buf, out, received % sizeof(out) + 1);
+		if (n == 0) {
+			g_thread_yield();
+			continue;
+		}
+
+		for (i = 0; i < n; i++)
+			g_assert(out[i] == stream_byte(received + i));
+
+		received += n;
+	}
+
+	g_thread_join(thread);
+
+	g_assert(ring_buffer_snapshot(buf) == 0);
+	g_assert(ring_buffer_len(buf) == 0);
+
+	ring_buffer_free(buf);
+}
+#endif
+
+static void test_writev(void)
+{
+	static const char *regions[] = { "AT+CGMI\r", "AT+CGMM\r", "AT\r" };
+	struct iovec iov[3];
+	GIOChannel *channel;
+	char buf[64];
+	gsize total = 0;
+	GAtIO *io;
+	int peer;
+	int i;
+
+	channel = fixture_channel_new(&peer);
+
+	io = g_at_io_new(channel);
+	g_assert(io != NULL);
+
+	for (i = 0; i < 3; i++) {
+		iov[i].iov_base = (char *) regions[i];
+		iov[i].iov_len = strlen(regions[i]);
+		total += iov[i].iov_len;
+	}
+
+	/* Through the channel, a region at a time */
+	g_assert(g_at_io_writev(io, iov, 3) == total);
+
+	g_assert(g_at_io_set_use_writev(io, TRUE));
+	g_assert(g_at_io_writev(io, iov, 3) == total);
+
+	g_assert(read(peer, buf, sizeof(buf)) == (ssize_t) total * 2);
+	g_assert(memcmp(buf, "AT+CGMI\rAT+CGMM\rAT\r", total) == 0);
+	g_assert(memcmp(buf + total, buf, total) == 0);
+
+	/* Nothing may go around data held back in the channel buffer */
+	g_assert(g_at_io_set_use_writev(io, FALSE));
+	g_io_channel_set_buffered(channel, TRUE);
+	g_assert(g_at_io_set_use_writev(io, FALSE));
+	g_assert(g_at_io_set_use_writev(io, TRUE) == FALSE);
+
+	g_at_io_unref(io);
+	g_io_channel_unref(channel);
+	close(peer);
+}
+
+static GByteArray *io_received;
+static GString *io_debug;
+
+static void io_read(struct ring_buffer *rbuf, gpointer user_data)
+{
+	unsigned int len = ring_buffer_len(rbuf);
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+
+	g_byte_array_append(io_received, ring_buffer_read_ptr(rbuf, 0), wrap);
+
+	if (len > wrap)
+		g_byte_array_append(io_received, ring_buffer_read_ptr(rbuf, wrap),
+					len - wrap);
+
+	ring_buffer_drain(rbuf, len);
+}
+
+static void io_debug_cb(const char *str, gpointer user_data)
+{
+	/* Skip the direction marker, "< " */
+	g_assert(str[0] == '<' && str[1] == ' ');
+	g_string_append(io_debug, str + 2);
+}
+
+static void test_threaded_io(void)
+{
+	char *data = g_malloc(STREAM_LEN);
+	GIOChannel *channel;
+	unsigned int sent = 0;
+	GAtIO *io;
+	int peer;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < STREAM_LEN; i++)
+		data[i] = text_byte(i);
+
+	channel = fixture_channel_new(&peer);
+
+	io = g_at_io_new_threaded(channel);
+	g_assert(io != NULL);
+	g_io_channel_unref(channel);
+
+	io_received = g_byte_array_new();
+	io_debug = g_string_new(NULL);
+
+	g_at_io_set_read_handler(io, io_read, NULL);
+	g_at_io_set_debug(io, io_debug_cb, NULL);
+
+	/* Well past the size of the read buffer, in uneven pieces */
+	while (sent < STREAM_LEN || io_received->len < STREAM_LEN) {
+		if (sent < STREAM_LEN) {
+			n = write(peer, data + sent,
+					MIN(STREAM_LEN - sent, 1 + sent % 5000));
+			if (n > 0)
+				sent += n;
+			else
+				g_assert(errno == EAGAIN);
+		}
+
+		g_main_context_iteration(NULL, sent == STREAM_LEN);
+	}
+
+	g_assert(io_received->len == STREAM_LEN);
+	g_assert(memcmp(io_received->data, data, STREAM_LEN) == 0);
+
+	/* Everything handed to the read handler was shown, once */
+	g_assert(io_debug->len == STREAM_LEN);
+	g_assert(memcmp(io_debug->str, data, STREAM_LEN) == 0);
+
+	g_at_io_unref(io);
+	close(peer);
+
+	g_byte_array_free(io_received, TRUE);
+	g_string_free(io_debug, TRUE);
+	g_free(data);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef NEED_THREADS
+	if (g_thread_supported() == FALSE)
+		g_thread_init(NULL);
+#endif
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testgatio/Ring buffer wrap around", test_wrap);
+	g_test_add_func("/testgatio/Shared ring buffer snapshot",
+				test_snapshot);
+#ifdef NEED_THREADS
+	g_test_add_func("/testgatio/Shared ring buffer threads",
+				test_shared_threads);
+#endif
+	g_test_add_func("/testgatio/Write regions", test_writev);
+	g_test_add_func("/testgatio/Threaded reader", test_threaded_io);
+
+	return g_test_run();
+}
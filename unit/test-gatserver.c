@@ -0,0 +1,158 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "gatserver.h"
+#include "gat-fixture.h"
+
+#define ROUNDS 4
+
+struct server_test {
+	GAtServer *server;
+	int peer;
+	GString *output;
+};
+
+static void server_test_init(struct server_test *t)
+{
+	GIOChannel *channel = fixture_channel_new(&t->peer);
+
+	t->server = g_at_server_new(channel);
+	g_assert(t->server != NULL);
+	g_io_channel_unref(channel);
+
+	t->output = g_string_new(NULL);
+}
+
+static void server_test_cleanup(struct server_test *t)
+{
+	g_at_server_unref(t->server);
+	close(t->peer);
+	g_string_free(t->output, TRUE);
+}
+
+/* Collect everything the server wrote out so far */
+static void collect(struct server_test *t)
+{
+	char buf[4096];
+	ssize_t len;
+
+	fixture_spin();
+
+	while ((len = read(t->peer, buf, sizeof(buf))) > 0) {
+		g_string_append_len(t->output, buf, len);
+		fixture_spin();
+	}
+}
+
+/*
+ * Lines of varying length, several times the size of a write buffer in
+ * total, with one too long to be sent in the middle and, on odd rounds,
+ * one at the end
+ */
+static GSList *build_lines(unsigned int round)
+{
+	GSList *lines = NULL;
+	unsigned int i;
+
+	for (i = 0; i < 24; i++) {
+		gsize len = (i * 97 + round * 31) % 1500 + 1;
+
+		if (i == 11 || (i == 23 && round % 2))
+			len = 2049;
+
+		lines = g_slist_append(lines, g_strnfill(len, 'A' + i));
+	}
+
+	return lines;
+}
+
+static void free_lines(GSList *lines)
+{
+	g_slist_foreach(lines, (GFunc) g_free, NULL);
+	g_slist_free(lines);
+}
+
+static void test_info_batch(void)
+{
+	struct server_test single;
+	struct server_test batch;
+	unsigned int round;
+	GSList *lines;
+	GSList *l;
+
+	server_test_init(&single);
+	server_test_init(&batch);
+
+	/*
+	 * Reading the output between rounds drains the write buffers, the
+	 * next round then runs on the recycled ones
+	 */
+	for (round = 0; round < ROUNDS; round++) {
+		gboolean last = round < ROUNDS - 1;
+
+		lines = build_lines(round);
+
+		for (l = lines; l; l = l->next)
+			g_at_server_send_info(single.server, l->data,
+						last && l->next == NULL);
+
+		g_at_server_send_info_batch(batch.server, lines, last);
+
+		collect(&single);
+		collect(&batch);
+
+		g_assert(single.output->len > round * 4096 * 3);
+		g_assert(single.output->len == batch.output->len);
+		g_assert(memcmp(single.output->str, batch.output->str,
+					single.output->len) == 0);
+
+		free_lines(lines);
+	}
+
+	/* Long lines never made it out */
+	g_assert(strstr(batch.output->str, "LLLLL") == NULL);
+
+	/* Only a line that was sent ends the response */
+	g_assert(strstr(batch.output->str, "XXXXX\r\n\r\n") != NULL);
+	g_assert(strstr(batch.output->str, "WWWWW\r\nA") != NULL);
+	g_assert(g_str_has_suffix(batch.output->str, "WWWWW"));
+
+	server_test_cleanup(&single);
+	server_test_cleanup(&batch);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testgatserver/Info batch", test_info_batch);
+
+	return g_test_run();
+}
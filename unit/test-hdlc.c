@@ -0,0 +1,396 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "crc-ccitt.h"
+#include "gathdlc.h"
+#include "gat-fixture.h"
+
+#define MAX_FRAME 1600
+
+static guint8 payload[MAX_FRAME];
+static GSList *received;
+
+static void fill_payload(unsigned int seed, gsize len)
+{
+	gsize i;
+
+	srand(seed);
+
+	for (i = 0; i < len; i++)
+		payload[i] = rand() & 0xff;
+
+	/* Sprinkle in runs of the characters that need escaping */
+	for (i = 0; i + 3 < len; i += 97) {
+		payload[i] = 0x7e;
+		payload[i + 1] = 0x7d;
+		payload[i + 2] = 0x11;
+	}
+}
+
+/* Reference encoder, one byte at a time */
+static void encode_byte(GByteArray *out, guint32 accm, guint8 c)
+{
+	guint8 esc[2] = { 0x7d, c ^ 0x20 };
+
+	if (c == 0x7e || c == 0x7d || (c < 0x20 && (accm & (1U << c))))
+		g_byte_array_append(out, esc, 2);
+	else
+		g_byte_array_append(out, &c, 1);
+}
+
+static void encode_frame(GByteArray *out, guint32 accm,
+				const guint8 *data, gsize len)
+{
+	guint8 flag = 0x7e;
+	guint16 fcs = 0xffff;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		fcs = crc_ccitt_byte(fcs, data[i]);
+		encode_byte(out, accm, data[i]);
+	}
+
+	fcs ^= 0xffff;
+	encode_byte(out, accm, fcs & 0xff);
+	encode_byte(out, accm, fcs >> 8);
+
+	g_byte_array_append(out, &flag, 1);
+}
+
+static void receive_cb(const unsigned char *buf, gsize len, void *data)
+{
+	received = g_slist_append(received, g_byte_array_append(
+					g_byte_array_new(), buf, len));
+}
+
+static GAtHDLC *create_hdlc(int *peer)
+{
+	GIOChannel *channel;
+	GAtHDLC *hdlc;
+
+	channel = fixture_channel_new(peer);
+	hdlc = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	return hdlc;
+}
+
+static void check_received(const gsize *lengths, unsigned int count)
+{
+	unsigned int i;
+	GSList *l;
+
+	g_assert(g_slist_length(received) == count);
+
+	for (i = 0, l = received; l; l = l->next, i++) {
+		GByteArray *frame = l->data;
+
+		fill_payload(i, lengths[i]);
+		g_assert(frame->len == lengths[i]);
+		g_assert(memcmp(frame->data, payload, frame->len) == 0);
+
+		g_byte_array_free(frame, TRUE);
+	}
+
+	g_slist_free(received);
+	received = NULL;
+}
+
+static const gsize frame_lengths[] = { 1, 7, 8, 9, 64, 300, 1500 };
+
+static void test_crc(void)
+{
+	gsize len;
+	gsize offset;
+
+	fill_payload(42, sizeof(payload));
+
+	for (offset = 0; offset < 8; offset++) {
+		for (len = 0; len < 200; len++) {
+			guint16 ref = 0xffff;
+			gsize i;
+
+			for (i = 0; i < len; i++)
+				ref = crc_ccitt_byte(ref, payload[offset + i]);
+
+			g_assert(crc_ccitt(0xffff, payload + offset, len) ==
+					ref);
+		}
+	}
+}
+
+static void inject_noise(GByteArray *stream)
+{
+	GByteArray *noisy = g_byte_array_new();
+	guint8 xoff = 0x13;
+	guint i;
+
+	for (i = 0; i < stream->len; i++) {
+		if (i % 50 == 49 && stream->data[i - 1] != 0x7d)
+			g_byte_array_append(noisy, &xoff, 1);
+
+		g_byte_array_append(noisy, stream->data + i, 1);
+	}
+
+	g_byte_array_set_size(stream, 0);
+	g_byte_array_append(stream, noisy->data, noisy->len);
+	g_byte_array_free(noisy, TRUE);
+}
+
+static void decode_stream(guint32 accm, gsize chunk)
+{
+	GByteArray *stream = g_byte_array_new();
+	unsigned int i;
+	GAtHDLC *hdlc;
+	gsize written;
+	int peer;
+
+	hdlc = create_hdlc(&peer);
+	g_at_hdlc_set_recv_accm(hdlc, accm);
+	g_at_hdlc_set_receive(hdlc, receive_cb, NULL);
+
+	g_byte_array_append(stream, (guint8 *) "\x7e", 1);
+
+	for (i = 0; i < G_N_ELEMENTS(frame_lengths); i++) {
+		fill_payload(i, frame_lengths[i]);
+		encode_frame(stream, accm ? ~0U : 0, payload, frame_lengths[i]);
+	}
+
+	/* Line noise in the ACCM must be dropped by the receiver */
+	if (accm)
+		inject_noise(stream);
+
+	for (written = 0; written < stream->len; written += chunk) {
+		gsize n = MIN(chunk, stream->len - written);
+
+		g_assert(write(peer, stream->data + written, n) == (ssize_t) n);
+		fixture_spin();
+	}
+
+	check_received(frame_lengths, G_N_ELEMENTS(frame_lengths));
+
+	g_at_hdlc_unref(hdlc);
+	g_byte_array_free(stream, TRUE);
+	close(peer);
+}
+
+static void test_decode(void)
+{
+	static const gsize chunks[] = { 1, 3, 8, 13, 4096 };
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(chunks); i++) {
+		decode_stream(~0U, chunks[i]);
+		decode_stream(0, chunks[i]);
+	}
+}
+
+static void encode_stream(guint32 accm)
+{
+	GByteArray *expected = g_byte_array_new();
+	guint8 buf[16384];
+	unsigned int i;
+	GAtHDLC *hdlc;
+	gsize total = 0;
+	ssize_t n;
+	int peer;
+
+	hdlc = create_hdlc(&peer);
+	g_at_hdlc_set_xmit_accm(hdlc, accm);
+	g_assert(g_at_hdlc_get_xmit_accm(hdlc) == accm);
+
+	/* Wakeup flag */
+	g_byte_array_append(expected, (guint8 *) "\x7e", 1);
+
+	for (i = 0; i < G_N_ELEMENTS(frame_lengths); i++) {
+		fill_payload(i, frame_lengths[i]);
+		encode_frame(expected, accm, payload, frame_lengths[i]);
+
+		g_assert(g_at_hdlc_send(hdlc, payload, frame_lengths[i]));
+		fixture_spin();
+	}
+
+	while ((n = read(peer, buf + total, sizeof(buf) - total)) > 0)
+		total += n;
+
+	g_assert(total == expected->len);
+	g_assert(memcmp(buf, expected->data, total) == 0);
+
+	g_at_hdlc_unref(hdlc);
+	g_byte_array_free(expected, TRUE);
+	close(peer);
+}
+
+static void test_encode(void)
+{
+	encode_stream(~0U);
+	encode_stream(0);
+	encode_stream(0x000a0000);
+}
+
+/*
+ * Loop a little of what GAtHDLC wrote back into its own decoder, so that
+ * sending has to wait for room in the write buffer every now and then
+ */
+static gboolean loopback(int peer)
+{
+	guint8 buf[256];
+	ssize_t n;
+
+	fixture_spin();
+
+	n = read(peer, buf, sizeof(buf));
+	if (n <= 0)
+		return FALSE;
+
+	g_assert(write(peer, buf, n) == n);
+	fixture_spin();
+
+	return TRUE;
+}
+
+static void test_encode_wrap(void)
+{
+	gsize lengths[40];
+	unsigned int i;
+	GAtHDLC *hdlc;
+	int peer;
+
+	hdlc = create_hdlc(&peer);
+	g_at_hdlc_set_receive(hdlc, receive_cb, NULL);
+
+	/* A socket, so both halves of a wrapped buffer go out at once */
+	g_assert(g_at_io_set_use_writev(g_at_hdlc_get_io(hdlc), TRUE));
+
+	/* Without ACCM the escape-free runs are copied in blocks */
+	g_at_hdlc_set_xmit_accm(hdlc, 0);
+	g_at_hdlc_set_recv_accm(hdlc, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(lengths); i++) {
+		lengths[i] = frame_lengths[i % G_N_ELEMENTS(frame_lengths)];
+		fill_payload(i, lengths[i]);
+
+		while (g_at_hdlc_send(hdlc, payload, lengths[i]) == FALSE)
+			loopback(peer);
+
+		fixture_spin();
+	}
+
+	while (loopback(peer) == TRUE);
+
+	check_received(lengths, G_N_ELEMENTS(lengths));
+
+	g_at_hdlc_unref(hdlc);
+	close(peer);
+}
+
+static void test_stats(void)
+{
+	static const guint8 escaped[] = { 0x7e, 0x01, 0x7d, 0x41 };
+	GByteArray *stream = g_byte_array_new();
+	GAtHDLCStats stats;
+	guint8 buf[256];
+	GAtHDLC *hdlc;
+	gsize total = 0;
+	gsize pos;
+	ssize_t n;
+	int peer;
+
+	hdlc = create_hdlc(&peer);
+	g_at_hdlc_set_recv_accm(hdlc, 0);
+	g_at_hdlc_set_xmit_accm(hdlc, 0);
+	g_at_hdlc_set_receive(hdlc, receive_cb, NULL);
+
+	/*
+	 * A good frame, a corrupted one, one too short for an FCS and
+	 * another good one
+	 */
+	g_byte_array_append(stream, (guint8 *) "\x7e", 1);
+	fill_payload(0, 64);
+	encode_frame(stream, 0, payload, 64);
+	pos = stream->len + 10;
+	encode_frame(stream, 0, payload, 64);
+
+	while (stream->data[pos] == 0x7d || stream->data[pos - 1] == 0x7d)
+		pos++;
+
+	stream->data[pos] = stream->data[pos] == 0x41 ? 0x42 : 0x41;
+	g_byte_array_append(stream, (guint8 *) "\x01\x02\x7e", 3);
+	fill_payload(1, 64);
+	encode_frame(stream, 0, payload, 64);
+
+	g_assert(write(peer, stream->data, stream->len) ==
+						(ssize_t) stream->len);
+	fixture_spin();
+
+	g_assert(g_at_hdlc_get_stats(hdlc, &stats) == TRUE);
+	g_assert(stats.rx_frames == 2);
+	g_assert(stats.rx_bytes == 128);
+	g_assert(stats.rx_fcs_errors == 1);
+	g_assert(stats.rx_short_frames == 1);
+	g_assert(stats.rx_wire_bytes == stream->len);
+
+	g_slist_foreach(received, (GFunc) g_byte_array_unref, NULL);
+	g_slist_free(received);
+	received = NULL;
+
+	/* Flag and escape characters need escaping, the rest doesn't */
+	g_assert(g_at_hdlc_send(hdlc, escaped, sizeof(escaped)) == TRUE);
+	fixture_spin();
+
+	while ((n = read(peer, buf + total, sizeof(buf) - total)) > 0)
+		total += n;
+
+	g_assert(g_at_hdlc_get_stats(hdlc, &stats) == TRUE);
+	g_assert(stats.tx_frames == 1);
+	g_assert(stats.tx_bytes == sizeof(escaped));
+	g_assert(stats.tx_escapes >= 2);
+	g_assert(stats.tx_wire_bytes == total);
+	g_assert(stats.tx_queue_samples > 0);
+	g_assert(stats.tx_overruns == 0);
+
+	g_at_hdlc_unref(hdlc);
+	g_byte_array_free(stream, TRUE);
+	close(peer);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testhdlc/CRC", test_crc);
+	g_test_add_func("/testhdlc/Decode", test_decode);
+	g_test_add_func("/testhdlc/Encode", test_encode);
+	g_test_add_func("/testhdlc/Encode wrap around", test_encode_wrap);
+	g_test_add_func("/testhdlc/Statistics", test_stats);
+
+	return g_test_run();
+}
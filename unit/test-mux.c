@@ -34,6 +34,10 @@
 #include <glib/gprintf.h>
 
 #include "gatmux.h"
+#include "gathdlc.h"
+#include "gatrawip.h"
+#include "gatutil.h"
+#include "gat-fixture.h"
 #include "gsm0710.h"
 
 static int do_connect(const char *address, unsigned short port)
@@ -554,6 +558,354 @@ static void test_extract_advanced(void)
 	g_assert(total == sizeof(advanced_input2) - 1);
 }
 
+static void test_extract_advanced_quoted(void)
+{
+	guint8 payload[64];
+	guint8 stream[1024];
+	guint8 *frame;
+	int frame_size;
+	int total = 0;
+	int len = 0;
+	int nread;
+	guint8 dlc;
+	guint8 ctrl;
+	int i, j;
+
+	/* Payloads dense with flag and escape bytes, separated by noise */
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < i * 8; j++)
+			payload[j] = (j % 3) ? 0x7D - (j & 1) : 0x7E;
+
+		stream[len++] = 0xFF;
+		len += gsm0710_advanced_fill_frame(stream + len, i + 1,
+							GSM0710_DATA,
+							payload, i * 8);
+	}
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < i * 8; j++)
+			payload[j] = (j % 3) ? 0x7D - (j & 1) : 0x7E;
+
+		frame = NULL;
+		nread = gsm0710_advanced_extract_frame(stream + total,
+							len - total,
+							&dlc, &ctrl,
+							&frame, &frame_size);
+		total += nread;
+
+		g_assert(frame != NULL);
+		g_assert(dlc == i + 1);
+		g_assert(ctrl == GSM0710_DATA);
+		g_assert(frame_size == i * 8);
+		g_assert(memcmp(payload, frame, frame_size) == 0);
+	}
+
+	g_assert(total == len - 1);
+}
+
+/* A basic mode multiplexer with the modem end of it handed back in peer */
+static GAtMux *create_local_mux(int *peer)
+{
+	GIOChannel *channel;
+	GAtMux *local;
+
+	channel = fixture_channel_new(peer);
+	g_assert(g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK));
+
+	local = g_at_mux_new_gsm0710_basic(channel, 31);
+	g_io_channel_unref(channel);
+
+	g_assert(g_at_mux_start(local));
+
+	return local;
+}
+
+/* Collect what arrived on a DLC at the modem end since the last call */
+static void dlc_received(int peer, guint8 want, GByteArray *out)
+{
+	guint8 buf[4096];
+	guint8 *frame;
+	guint8 dlc;
+	guint8 ctrl;
+	int frame_len;
+	int len = 0;
+	int offset = 0;
+	int r;
+
+	fixture_spin();
+
+	while ((r = read(peer, buf + len, sizeof(buf) - len)) > 0)
+		len += r;
+
+	while (offset < len) {
+		frame = NULL;
+		r = gsm0710_basic_extract_frame(buf + offset, len - offset,
+						&dlc, &ctrl, &frame,
+						&frame_len);
+		offset += r;
+
+		if (frame == NULL)
+			break;
+
+		if (dlc == want && ctrl == GSM0710_DATA)
+			g_byte_array_append(out, frame, frame_len);
+	}
+
+	/* Only the closing flag of the last frame may be left over */
+	g_assert(offset == len || (offset == len - 1 && buf[offset] == 0xF9));
+}
+
+static void dlc_send_data(int peer, guint8 dlc, const guint8 *data, int len)
+{
+	guint8 frame[64];
+	int size;
+
+	while (len > 0) {
+		int chunk = MIN(len, 31);
+
+		size = gsm0710_basic_fill_frame(frame, dlc, GSM0710_DATA,
+						data, chunk);
+		g_assert(write(peer, frame, size) == size);
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	fixture_spin();
+}
+
+static void dlc_send(int peer, guint8 dlc, const char *data)
+{
+	dlc_send_data(peer, dlc, (const guint8 *) data, strlen(data));
+}
+
+static void check_dlc_text(int peer, guint8 dlc, const char *expected)
+{
+	GByteArray *received = g_byte_array_new();
+
+	dlc_received(peer, dlc, received);
+
+	g_assert(received->len == strlen(expected));
+
+	if (received->len > 0)
+		g_assert(memcmp(received->data, expected, received->len) == 0);
+
+	g_byte_array_free(received, TRUE);
+}
+
+static GString *chat_results;
+
+static void dlc_result_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	GAtResultIter iter;
+
+	g_at_result_iter_init(&iter, result);
+	g_at_result_iter_next(&iter, NULL);
+
+	g_string_append_printf(chat_results, "%s:%s,%s;", (char *) user_data,
+				g_at_result_iter_raw_line(&iter),
+				g_at_result_final_response(result));
+}
+
+static GAtChat *create_dlc_chat(GAtMux *local)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	GAtChat *chat;
+
+	channel = g_at_mux_create_channel(local);
+	g_assert(channel != NULL);
+
+	syntax = g_at_syntax_new_gsmv1();
+	chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	return chat;
+}
+
+static void test_chat_over_dlc(void)
+{
+	GAtMux *local;
+	GAtChat *chat;
+	int peer;
+
+	local = create_local_mux(&peer);
+	chat = create_dlc_chat(local);
+	chat_results = g_string_new(NULL);
+
+	/* Startup and DLC 1 open */
+	check_dlc_text(peer, 1, "");
+
+	g_at_chat_send(chat, "AT+CGMI", NULL, dlc_result_cb, "cgmi", NULL);
+	g_at_chat_send(chat, "AT+CGMM", NULL, dlc_result_cb, "cgmm", NULL);
+
+	check_dlc_text(peer, 1, "AT+CGMI\r");
+	dlc_send(peer, 1, "\r\nACME\r\n\r\nOK\r\n");
+	g_assert_cmpstr(chat_results->str, ==, "cgmi:ACME,OK;");
+
+	check_dlc_text(peer, 1, "AT+CGMM\r");
+	dlc_send(peer, 1, "\r\nRocket\r\n\r\nOK\r\n");
+	g_assert_cmpstr(chat_results->str, ==, "cgmi:ACME,OK;cgmm:Rocket,OK;");
+
+	g_at_chat_unref(chat);
+	g_at_mux_unref(local);
+	g_string_free(chat_results, TRUE);
+	close(peer);
+}
+
+static void test_pipeline_over_dlc(void)
+{
+	const char *cmds[] = { "+CGMI", "+CGMM", "+CGSN", NULL };
+	GAtMux *local;
+	GAtChat *chat;
+	int peer;
+
+	local = create_local_mux(&peer);
+	chat = create_dlc_chat(local);
+	chat_results = g_string_new(NULL);
+
+	check_dlc_text(peer, 1, "");
+
+	g_assert(g_at_chat_set_pipeline(chat, 3, cmds));
+
+	g_at_chat_send(chat, "AT+CGMI", NULL, dlc_result_cb, "cgmi", NULL);
+	g_at_chat_send(chat, "AT+CGMM", NULL, dlc_result_cb, "cgmm", NULL);
+	g_at_chat_send(chat, "AT+CGSN", NULL, dlc_result_cb, "cgsn", NULL);
+
+	/* All three go out in one write, split over several DLC frames */
+	check_dlc_text(peer, 1, "AT+CGMI\rAT+CGMM\rAT+CGSN\r");
+
+	dlc_send(peer, 1, "\r\nACME\r\n\r\nOK\r\n\r\nRocket\r\n\r\nOK\r\n"
+				"\r\n12345\r\n\r\nOK\r\n");
+	g_assert_cmpstr(chat_results->str, ==,
+			"cgmi:ACME,OK;cgmm:Rocket,OK;cgsn:12345,OK;");
+
+	g_at_chat_unref(chat);
+	g_at_mux_unref(local);
+	g_string_free(chat_results, TRUE);
+	close(peer);
+}
+
+static GByteArray *hdlc_frames;
+
+static void hdlc_receive(const unsigned char *data, gsize size,
+				gpointer user_data)
+{
+	g_byte_array_append(hdlc_frames, data, size);
+}
+
+static void test_hdlc_over_dlc(void)
+{
+	GAtMux *local;
+	GAtHDLC *hdlc;
+	GAtHDLC *decoder;
+	GIOChannel *channel;
+	GByteArray *received;
+	guint8 payload[600];
+	int decoder_peer;
+	int peer;
+	int i;
+
+	for (i = 0; i < (int) sizeof(payload); i++)
+		payload[i] = i * 7;
+
+	local = create_local_mux(&peer);
+
+	channel = g_at_mux_create_channel(local);
+	hdlc = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	received = g_byte_array_new();
+	dlc_received(peer, 1, received);
+	g_assert(received->len == 0);
+
+	/* Enough that the frame goes out over several writes and DLC frames */
+	g_assert(g_at_hdlc_send(hdlc, payload, sizeof(payload)));
+	g_assert(g_at_hdlc_send(hdlc, payload, 3));
+	dlc_received(peer, 1, received);
+	g_assert(received->len > sizeof(payload) + 3);
+
+	/* Another HDLC instance must decode exactly what was sent */
+	channel = fixture_channel_new(&decoder_peer);
+	decoder = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	hdlc_frames = g_byte_array_new();
+	g_at_hdlc_set_receive(decoder, hdlc_receive, NULL);
+
+	g_assert(write(decoder_peer, received->data, received->len) ==
+			(ssize_t) received->len);
+	fixture_spin();
+
+	g_assert(hdlc_frames->len == sizeof(payload) + 3);
+	g_assert(memcmp(hdlc_frames->data, payload, sizeof(payload)) == 0);
+	g_assert(memcmp(hdlc_frames->data + sizeof(payload), payload, 3) == 0);
+
+	g_at_hdlc_unref(decoder);
+	g_at_hdlc_unref(hdlc);
+	g_at_mux_unref(local);
+	g_byte_array_free(hdlc_frames, TRUE);
+	g_byte_array_free(received, TRUE);
+	close(decoder_peer);
+	close(peer);
+}
+
+static void test_rawip_over_dlc(void)
+{
+	GAtMux *local;
+	GAtRawIP *rawip;
+	GIOChannel *channel;
+	GByteArray *received;
+	guint8 packets[2][300];
+	guint8 buf[512];
+	int tun[2];
+	int peer;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		fixture_build_ipv4(packets[i], sizeof(packets[i]), i);
+
+	local = create_local_mux(&peer);
+
+	channel = g_at_mux_create_channel(local);
+	rawip = g_at_rawip_new(channel);
+	g_io_channel_unref(channel);
+
+	/* A packet socketpair keeps the boundaries like a TUN device */
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tun) == 0);
+	fixture_set_nonblock(tun[1]);
+	g_at_rawip_open_fd(rawip, tun[0], "test0");
+
+	received = g_byte_array_new();
+	dlc_received(peer, 1, received);
+	g_assert(received->len == 0);
+
+	/* Both packets go out back to back over the DLC */
+	for (i = 0; i < 2; i++)
+		g_assert(write(tun[1], packets[i], sizeof(packets[i])) ==
+					(ssize_t) sizeof(packets[i]));
+
+	dlc_received(peer, 1, received);
+	g_assert(received->len == sizeof(packets));
+	g_assert(memcmp(received->data, packets, sizeof(packets)) == 0);
+
+	/* And come back cut into packets again, from many small frames */
+	dlc_send_data(peer, 1, (const guint8 *) packets, sizeof(packets));
+
+	for (i = 0; i < 2; i++) {
+		g_assert(read(tun[1], buf, sizeof(buf)) ==
+					(ssize_t) sizeof(packets[i]));
+		g_assert(memcmp(buf, packets[i], sizeof(packets[i])) == 0);
+	}
+
+	g_at_rawip_unref(rawip);
+	g_at_mux_unref(local);
+	g_byte_array_free(received, TRUE);
+	close(tun[1]);
+	close(peer);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -562,7 +914,13 @@ int main(int argc, char **argv)
 	g_test_add_func("/testmux/fill_advanced", test_fill_advanced);
 	g_test_add_func("/testmux/extract_basic", test_extract_basic);
 	g_test_add_func("/testmux/extract_advanced", test_extract_advanced);
+	g_test_add_func("/testmux/extract_advanced_quoted",
+				test_extract_advanced_quoted);
 	g_test_add_func("/testmux/basic", test_basic);
+	g_test_add_func("/testmux/chat_over_dlc", test_chat_over_dlc);
+	g_test_add_func("/testmux/pipeline_over_dlc", test_pipeline_over_dlc);
+	g_test_add_func("/testmux/hdlc_over_dlc", test_hdlc_over_dlc);
+	g_test_add_func("/testmux/rawip_over_dlc", test_rawip_over_dlc);
 
 	return g_test_run();
 }
@@ -0,0 +1,350 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "gatppp.h"
+#include "ppp.h"
+
+#define TH_PUSH	0x08
+#define TH_ACK	0x10
+#define TH_URG	0x20
+#define TH_SYN	0x02
+
+#define NEW_I	0x20
+#define NEW_S	0x08
+#define NEW_U	0x01
+
+struct tcp_segment {
+	guint16 id;
+	guint32 seq;
+	guint32 ack;
+	guint16 win;
+	guint8 flags;
+	guint16 payload;
+	guint16 expect;
+	guint16 urp;
+};
+
+static void put_long(guint8 *p, guint32 val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static guint build_segment(guint8 *buf, const struct tcp_segment *seg)
+{
+	guint32 sum = 0;
+	guint i;
+
+	memset(buf, 0, 40);
+
+	buf[0] = 0x45;
+	put_network_short(buf + 2, 40 + seg->payload);
+	put_network_short(buf + 4, seg->id);
+	buf[8] = 64;
+	buf[9] = 6;
+	put_long(buf + 12, 0x0a000001);
+	put_long(buf + 16, 0x0a000002);
+
+	for (i = 0; i < 20; i += 2)
+		sum += (buf[i] << 8) | buf[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	put_network_short(buf + 10, ~sum);
+
+	put_network_short(buf + 20, 1234);
+	put_network_short(buf + 22, 80);
+	put_long(buf + 24, seg->seq);
+	put_long(buf + 28, seg->ack);
+	buf[32] = 0x50;
+	buf[33] = seg->flags;
+	put_network_short(buf + 34, seg->win);
+
+	/* Not a real checksum, but it must make it across untouched */
+	put_network_short(buf + 36, seg->seq ^ seg->id);
+	put_network_short(buf + 38, seg->urp);
+
+	for (i = 0; i < seg->payload; i++)
+		buf[40 + i] = i;
+
+	return 40 + seg->payload;
+}
+
+static const struct tcp_segment segments[] = {
+	/* A bare ACK sets up the slot */
+	{ 1, 1000, 5000, 8192, TH_ACK, 0, PPP_VJ_UNCOMP_PROTO },
+	/* Data right after the ACK */
+	{ 2, 1000, 5000, 8192, TH_ACK, 100, PPP_VJ_COMP_PROTO },
+	/* Plain data transfer */
+	{ 3, 1100, 5000, 8192, TH_ACK, 100, PPP_VJ_COMP_PROTO },
+	{ 4, 1200, 5300, 4096, TH_ACK | TH_PUSH, 50, PPP_VJ_COMP_PROTO },
+	/* IP id jumps, large window change */
+	{ 20, 1250, 5300, 65000, TH_ACK, 1, PPP_VJ_COMP_PROTO },
+	/* Retransmission goes out uncompressed */
+	{ 20, 1250, 5300, 65000, TH_ACK, 1, PPP_VJ_UNCOMP_PROTO },
+	/* Sequence number moves too far */
+	{ 21, 200000, 5300, 65000, TH_ACK, 10, PPP_VJ_UNCOMP_PROTO },
+	{ 22, 200010, 5310, 65000, TH_ACK, 10, PPP_VJ_COMP_PROTO },
+	/* Connection teardown and setup are never compressed */
+	{ 23, 200020, 5310, 65000, TH_SYN, 0, PPP_IP_PROTO },
+};
+
+static void test_vj_roundtrip(void)
+{
+	struct ppp_vj *tx = ppp_vj_new(16, TRUE, 0);
+	struct ppp_vj *rx = ppp_vj_new(0, FALSE, 16);
+	guint8 orig[256];
+	guint8 buf[256];
+	guint i;
+
+	g_assert(tx != NULL);
+	g_assert(rx != NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(segments); i++) {
+		guint len = build_segment(orig, &segments[i]);
+		guint clen = len;
+		guint offset;
+		guint16 proto;
+		const guint8 *out;
+
+		memcpy(buf, orig, len);
+		proto = ppp_vj_compress(tx, buf, &clen, &offset);
+
+		g_assert(proto == segments[i].expect);
+
+		if (proto == PPP_IP_PROTO) {
+			g_assert(offset == 0);
+			g_assert(clen == len);
+			g_assert(memcmp(buf, orig, len) == 0);
+			continue;
+		}
+
+		if (proto == PPP_VJ_COMP_PROTO)
+			g_assert(clen + 30 <= len);
+		else
+			g_assert(clen == len);
+
+		g_assert(offset + clen == len);
+
+		out = ppp_vj_uncompress(rx, proto, buf + offset, clen);
+		g_assert(out != NULL);
+		g_assert(memcmp(out, orig, len) == 0);
+	}
+
+	ppp_vj_free(tx);
+	ppp_vj_free(rx);
+}
+
+static void test_vj_toss(void)
+{
+	struct ppp_vj *tx = ppp_vj_new(4, TRUE, 0);
+	struct ppp_vj *rx = ppp_vj_new(0, FALSE, 4);
+	guint8 frames[4][256];
+	guint lengths[4];
+	guint16 protos[4];
+	const guint8 *starts[4];
+	guint8 bad[3] = { 0x40, 200, 0 };
+	guint8 unset[4] = { 0x40, 3, 0, 0 };
+	guint i;
+
+	for (i = 0; i < 4; i++) {
+		guint offset;
+
+		lengths[i] = build_segment(frames[i], &segments[i]);
+		protos[i] = ppp_vj_compress(tx, frames[i], &lengths[i],
+						&offset);
+		starts[i] = frames[i] + offset;
+	}
+
+	/* Nothing to decompress against yet */
+	g_assert(ppp_vj_uncompress(rx, protos[2], starts[2],
+						lengths[2]) == NULL);
+
+	/* Out of range slot */
+	g_assert(ppp_vj_uncompress(rx, PPP_VJ_COMP_PROTO, bad,
+						sizeof(bad)) == NULL);
+
+	/* A slot the peer never set up */
+	g_assert(ppp_vj_uncompress(rx, PPP_VJ_COMP_PROTO, unset,
+						sizeof(unset)) == NULL);
+
+	g_assert(ppp_vj_uncompress(rx, protos[0], starts[0],
+						lengths[0]) != NULL);
+	g_assert(ppp_vj_uncompress(rx, protos[1], starts[1],
+						lengths[1]) != NULL);
+
+	/* A truncated frame makes us ignore the ones that follow */
+	g_assert(ppp_vj_uncompress(rx, protos[2], starts[2], 2) == NULL);
+	g_assert(ppp_vj_uncompress(rx, protos[3], starts[3],
+						lengths[3]) == NULL);
+
+	ppp_vj_free(tx);
+	ppp_vj_free(rx);
+}
+
+static const struct tcp_segment zero_segments[] = {
+	{ 7, 1000, 5000, 8192, TH_ACK, 0, PPP_VJ_UNCOMP_PROTO },
+	/* The IP id stays the same */
+	{ 7, 1000, 5000, 8192, TH_ACK, 100, PPP_VJ_COMP_PROTO },
+	/* Urgent data with a zero urgent pointer */
+	{ 8, 1100, 5000, 8192, TH_ACK | TH_URG, 100, PPP_VJ_COMP_PROTO, 0 },
+};
+
+/* Compressed headers of the above, past the change mask and checksum */
+static const guint8 zero_changes[] = { 0, NEW_I, NEW_U | NEW_S };
+static const guint8 zero_deltas[][4] = {
+	{ 0 },
+	{ 0x00, 0x00, 0x00 },
+	{ 0x00, 0x00, 0x00, 100 },
+};
+static const guint zero_delta_lens[] = { 0, 3, 4 };
+
+static void test_vj_zero(void)
+{
+	struct ppp_vj *tx = ppp_vj_new(4, TRUE, 0);
+	struct ppp_vj *rx = ppp_vj_new(0, FALSE, 4);
+	guint8 orig[256];
+	guint8 buf[256];
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(zero_segments); i++) {
+		guint len = build_segment(orig, &zero_segments[i]);
+		guint clen = len;
+		guint offset;
+		guint16 proto;
+		const guint8 *out;
+
+		memcpy(buf, orig, len);
+		proto = ppp_vj_compress(tx, buf, &clen, &offset);
+
+		g_assert(proto == zero_segments[i].expect);
+
+		if (proto == PPP_VJ_COMP_PROTO) {
+			const guint8 *hdr = buf + offset;
+
+			/* A zero must never go out on its own */
+			g_assert(hdr[0] == zero_changes[i]);
+			g_assert(clen == 3 + zero_delta_lens[i] +
+						zero_segments[i].payload);
+			g_assert(memcmp(hdr + 3, zero_deltas[i],
+						zero_delta_lens[i]) == 0);
+		}
+
+		out = ppp_vj_uncompress(rx, proto, buf + offset, clen);
+		g_assert(out != NULL);
+		g_assert(memcmp(out, orig, len) == 0);
+	}
+
+	ppp_vj_free(tx);
+	ppp_vj_free(rx);
+}
+
+struct header_test {
+	guint16 proto;
+	gboolean pfc;
+	gboolean acfc;
+	guint8 frame[4];
+	guint frame_len;
+};
+
+static const struct header_test header_tests[] = {
+	/* Not negotiated */
+	{ PPP_IP_PROTO, FALSE, FALSE, { 0xff, 0x03, 0x00, 0x21 }, 4 },
+	{ IPCP_PROTO, FALSE, FALSE, { 0xff, 0x03, 0x80, 0x21 }, 4 },
+	/* Negotiated by the peer */
+	{ PPP_IP_PROTO, TRUE, FALSE, { 0xff, 0x03, 0x21 }, 3 },
+	{ PPP_IP_PROTO, FALSE, TRUE, { 0x00, 0x21 }, 2 },
+	{ PPP_IP_PROTO, TRUE, TRUE, { 0x21 }, 1 },
+	{ PPP_VJ_COMP_PROTO, TRUE, TRUE, { 0x2d }, 1 },
+	/* Only protocols below 0x100 fit in a byte */
+	{ IPCP_PROTO, TRUE, TRUE, { 0x80, 0x21 }, 2 },
+	/* LCP is never compressed */
+	{ LCP_PROTOCOL, TRUE, TRUE, { 0xff, 0x03, 0xc0, 0x21 }, 4 },
+};
+
+static void test_header_encode(void)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(header_tests); i++) {
+		const struct header_test *t = &header_tests[i];
+		guint8 packet[8];
+		guint offset;
+
+		memset(packet, 0, sizeof(packet));
+		put_network_short(packet + 2, t->proto);
+		packet[4] = 0x45;
+
+		offset = ppp_header_encode(packet, t->pfc, t->acfc);
+
+		g_assert(offset + t->frame_len == 4);
+		g_assert(memcmp(packet + offset, t->frame, t->frame_len) == 0);
+		g_assert(packet[4] == 0x45);
+	}
+}
+
+static void test_header_decode(void)
+{
+	guint8 short_frame[] = { 0xff, 0x03, 0x00 };
+	guint8 frame[8];
+	guint16 proto;
+	guint i;
+
+	/* We take compressed headers whether we asked for them or not */
+	for (i = 0; i < G_N_ELEMENTS(header_tests); i++) {
+		const struct header_test *t = &header_tests[i];
+
+		memcpy(frame, t->frame, t->frame_len);
+		frame[t->frame_len] = 0x45;
+
+		g_assert(ppp_header_decode(frame, t->frame_len + 1, &proto) ==
+								t->frame_len);
+		g_assert(proto == t->proto);
+	}
+
+	g_assert(ppp_header_decode(short_frame, 2, &proto) == 0);
+	g_assert(ppp_header_decode(short_frame, 3, &proto) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testppp/VJ round trip", test_vj_roundtrip);
+	g_test_add_func("/testppp/VJ toss", test_vj_toss);
+	g_test_add_func("/testppp/VJ zero", test_vj_zero);
+	g_test_add_func("/testppp/Header encode", test_header_encode);
+	g_test_add_func("/testppp/Header decode", test_header_decode);
+
+	return g_test_run();
+}
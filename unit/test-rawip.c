@@ -0,0 +1,260 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2010  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gatrawip.h"
+#include "gat-fixture.h"
+
+struct rawip_test {
+	GAtRawIP *rawip;
+	int modem;		/* Our end of the modem channel */
+	int tun;		/* Our end of the TUN device */
+};
+
+/*
+ * A SOCK_SEQPACKET socketpair stands in for the TUN device, it keeps the
+ * packet boundaries the same way: one packet per read and write
+ */
+static void rawip_test_init(struct rawip_test *t)
+{
+	GIOChannel *channel;
+	int tun[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tun) == 0);
+	fixture_set_nonblock(tun[1]);
+
+	channel = fixture_channel_new(&t->modem);
+
+	t->rawip = g_at_rawip_new(channel);
+	g_assert(t->rawip != NULL);
+	g_io_channel_unref(channel);
+
+	g_at_rawip_open_fd(t->rawip, tun[0], "test0");
+	g_assert_cmpstr(g_at_rawip_get_interface(t->rawip), ==, "test0");
+
+	t->tun = tun[1];
+}
+
+static void rawip_test_cleanup(struct rawip_test *t)
+{
+	g_at_rawip_unref(t->rawip);
+
+	close(t->modem);
+	close(t->tun);
+}
+
+static guint build_ipv6(guint8 *buf, guint16 payload, guint8 seed)
+{
+	guint len = 40 + payload;
+	guint i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = seed + i;
+
+	buf[0] = 0x60;
+	buf[4] = payload >> 8;
+	buf[5] = payload;
+
+	return len;
+}
+
+static void send_modem(struct rawip_test *t, const guint8 *data, gsize len)
+{
+	g_assert(write(t->modem, data, len) == (ssize_t) len);
+	fixture_spin();
+}
+
+/* Checks that the next packet on the TUN device is the expected one */
+static void check_tun_packet(struct rawip_test *t, const guint8 *data,
+				gsize len)
+{
+	guint8 buf[2048];
+
+	g_assert(read(t->tun, buf, sizeof(buf)) == (ssize_t) len);
+	g_assert(memcmp(buf, data, len) == 0);
+}
+
+static void check_tun_empty(struct rawip_test *t)
+{
+	guint8 buf[16];
+
+	g_assert(read(t->tun, buf, sizeof(buf)) < 0);
+}
+
+static void test_split(void)
+{
+	struct rawip_test t;
+	guint8 packet[1500];
+	guint len;
+
+	rawip_test_init(&t);
+
+	len = fixture_build_ipv4(packet, sizeof(packet), 1);
+
+	/* Not even the length is there yet */
+	send_modem(&t, packet, 3);
+	check_tun_empty(&t);
+
+	send_modem(&t, packet + 3, 700);
+	check_tun_empty(&t);
+
+	send_modem(&t, packet + 703, len - 703);
+	check_tun_packet(&t, packet, len);
+	check_tun_empty(&t);
+
+	rawip_test_cleanup(&t);
+}
+
+static void test_coalesced(void)
+{
+	struct rawip_test t;
+	guint8 stream[2048];
+	guint len4;
+	guint len6;
+	guint len;
+
+	rawip_test_init(&t);
+
+	len4 = fixture_build_ipv4(stream, 100, 2);
+	len6 = build_ipv6(stream + len4, 300, 3);
+	len = fixture_build_ipv4(stream + len4 + len6, 20, 4);
+
+	/* Three packets in one read, the last one only partly */
+	send_modem(&t, stream, len4 + len6 + 10);
+
+	check_tun_packet(&t, stream, len4);
+	check_tun_packet(&t, stream + len4, len6);
+	check_tun_empty(&t);
+
+	send_modem(&t, stream + len4 + len6 + 10, len - 10);
+	check_tun_packet(&t, stream + len4 + len6, len);
+	check_tun_empty(&t);
+
+	rawip_test_cleanup(&t);
+}
+
+static void test_unframed(void)
+{
+	static const guint8 garbage[] = "\r\nNO CARRIER\r\n";
+	struct rawip_test t;
+	guint8 packets[3][64];
+	guint8 stream[512];
+	gsize skipped;
+	guint len = 0;
+	int i;
+
+	rawip_test_init(&t);
+
+	for (i = 0; i < 3; i++)
+		fixture_build_ipv4(packets[i], sizeof(packets[i]), 5 + i);
+
+	/*
+	 * All in a single read: text ahead of the first packet and a stray
+	 * byte between the first two must not take the packets queued
+	 * behind them along
+	 */
+	memcpy(stream + len, garbage, sizeof(garbage) - 1);
+	len += sizeof(garbage) - 1;
+	memcpy(stream + len, packets[0], sizeof(packets[0]));
+	len += sizeof(packets[0]);
+	stream[len++] = 0x45;
+
+	for (i = 1; i < 3; i++) {
+		memcpy(stream + len, packets[i], sizeof(packets[i]));
+		len += sizeof(packets[i]);
+	}
+
+	send_modem(&t, stream, len);
+
+	for (i = 0; i < 3; i++)
+		check_tun_packet(&t, packets[i], sizeof(packets[i]));
+
+	check_tun_empty(&t);
+
+	skipped = sizeof(garbage) - 1 + 1;
+	g_assert(g_at_rawip_get_discarded(t.rawip) == skipped);
+
+	/* A header that doesn't check out is skipped, even if it's IPv4 */
+	packets[0][3] -= 1;
+	memcpy(stream, packets[0], sizeof(packets[0]));
+	memcpy(stream + sizeof(packets[0]), packets[1], sizeof(packets[1]));
+	send_modem(&t, stream, sizeof(packets[0]) + sizeof(packets[1]));
+
+	check_tun_packet(&t, packets[1], sizeof(packets[1]));
+	check_tun_empty(&t);
+	skipped += sizeof(packets[0]);
+	g_assert(g_at_rawip_get_discarded(t.rawip) == skipped);
+
+	rawip_test_cleanup(&t);
+}
+
+static void test_to_modem(void)
+{
+	struct rawip_test t;
+	guint8 stream[4096];
+	guint8 buf[4096];
+	gsize total = 0;
+	guint pos = 0;
+	ssize_t n;
+	int i;
+
+	rawip_test_init(&t);
+
+	/* A burst of packets from the device goes out as one stream */
+	for (i = 0; i < 3; i++) {
+		guint len = fixture_build_ipv4(stream + pos, 500 + i * 100, i);
+
+		g_assert(write(t.tun, stream + pos, len) == (ssize_t) len);
+		pos += len;
+	}
+
+	fixture_spin();
+
+	while ((n = read(t.modem, buf + total, sizeof(buf) - total)) > 0)
+		total += n;
+
+	g_assert(total == pos);
+	g_assert(memcmp(buf, stream, pos) == 0);
+
+	rawip_test_cleanup(&t);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testrawip/Split packet", test_split);
+	g_test_add_func("/testrawip/Coalesced packets", test_coalesced);
+	g_test_add_func("/testrawip/Resync after unframed data",
+				test_unframed);
+	g_test_add_func("/testrawip/To modem", test_to_modem);
+
+	return g_test_run();
+}
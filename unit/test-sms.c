@@ -27,11 +27,13 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
 
 #include "util.h"
+#include "storage.h"
 #include "smsutil.h"
 
 static const char *simple_deliver = "07911326040000F0"
@@ -958,17 +960,17 @@ static void test_assembly(void)
 				sms_address_to_string(&sms.deliver.oaddr));
 	}
 
-	g_assert(g_slist_length(assembly->assembly_list) == 1);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
 	g_assert(l == NULL);
 
 	sms_assembly_expire(assembly, time(NULL) + 40);
 
-	g_assert(g_slist_length(assembly->assembly_list) == 0);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 0);
 
 	sms_extract_concatenation(&sms, &ref, &max, &seq);
 	l = sms_assembly_add_fragment(assembly, &sms, time(NULL),
 					&sms.deliver.oaddr, ref, max, seq);
-	g_assert(g_slist_length(assembly->assembly_list) == 1);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
 	g_assert(l == NULL);
 
 	decode_hex_own_buf(assembly_pdu2, -1, &pdu_len, 0, pdu);
@@ -1228,6 +1230,35 @@ static void test_prepare_limits(void)
 	test_limit(ucs2, target_size, FALSE);
 }
 
+static void test_prepare_dialect(void)
+{
+	GString *utf8 = g_string_new(NULL);
+	GSList *l;
+	char *decoded;
+	int i;
+
+	/*
+	 * 200 s-cedillas take 400 septets and 3 messages with only the
+	 * Turkish single shift table, but 200 septets and 2 messages once
+	 * the Turkish locking shift table is used as well
+	 */
+	for (i = 0; i < 200; i++)
+		g_string_append(utf8, "\xc5\x9f");
+
+	l = sms_text_prepare_with_alphabet("555", utf8->str, 0, TRUE, FALSE,
+						SMS_ALPHABET_TURKISH);
+	g_assert(l);
+	g_assert(g_slist_length(l) == 2);
+
+	decoded = sms_decode_text(l);
+	g_assert(g_strcmp0(decoded, utf8->str) == 0);
+
+	g_free(decoded);
+	g_slist_foreach(l, (GFunc) g_free, NULL);
+	g_slist_free(l);
+	g_string_free(utf8, TRUE);
+}
+
 static const char *cbs1 = "011000320111C2327BFC76BBCBEE46A3D168341A8D46A3D1683"
 	"41A8D46A3D168341A8D46A3D168341A8D46A3D168341A8D46A3D168341A8D46A3D168"
 	"341A8D46A3D168341A8D46A3D168341A8D46A3D168341A8D46A3D100";
@@ -1389,6 +1420,96 @@ static void test_cbs_assembly(void)
 	cbs_assembly_free(assembly);
 }
 
+static void test_assembly_stress(void)
+{
+	struct sms_assembly *assembly = sms_assembly_new(NULL);
+	struct sms_address addr;
+	struct sms sms;
+	time_t base = 1000;
+	time_t ts;
+	unsigned int expired = 0;
+	unsigned int i;
+	GSList *l;
+
+	memset(&sms, 0, sizeof(sms));
+	memset(&addr, 0, sizeof(addr));
+	addr.number_type = SMS_NUMBER_TYPE_INTERNATIONAL;
+	addr.numbering_plan = SMS_NUMBERING_PLAN_ISDN;
+
+	/* Thousands of half received messages, arriving out of order */
+	for (i = 0; i < 5000; i++) {
+		sprintf(addr.address, "1555%07u", i);
+		ts = base + (i * 7919) % 5000;
+
+		l = sms_assembly_add_fragment(assembly, &sms, ts, &addr,
+						i % 256, 3, 1);
+		g_assert(l == NULL);
+
+		l = sms_assembly_add_fragment(assembly, &sms, ts, &addr,
+						i % 256, 3, 2);
+		g_assert(l == NULL);
+	}
+
+	g_assert(g_hash_table_size(assembly->assembly_table) == 5000);
+
+	/* Same sender and reference, but a different number of parts */
+	sprintf(addr.address, "1555%07u", 0);
+	l = sms_assembly_add_fragment(assembly, &sms, base, &addr, 0, 4, 3);
+	g_assert(l == NULL);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 5000);
+
+	/* Complete every other message */
+	for (i = 0; i < 5000; i += 2) {
+		sprintf(addr.address, "1555%07u", i);
+		ts = base + (i * 7919) % 5000;
+
+		l = sms_assembly_add_fragment(assembly, &sms, ts, &addr,
+						i % 256, 3, 3);
+		g_assert(l != NULL);
+		g_assert(g_slist_length(l) == 3);
+
+		g_slist_foreach(l, (GFunc) g_free, NULL);
+		g_slist_free(l);
+	}
+
+	g_assert(g_hash_table_size(assembly->assembly_table) == 2500);
+
+	for (i = 1; i < 5000; i += 2)
+		if ((i * 7919) % 5000 < 2500)
+			expired += 1;
+
+	sms_assembly_expire(assembly, base + 2499);
+
+	g_assert(g_hash_table_size(assembly->assembly_table) ==
+			2500 - expired);
+
+	/* Exactly the messages that started before the cut off are gone */
+	for (i = 1; i < 5000; i += 2) {
+		sprintf(addr.address, "1555%07u", i);
+		ts = base + (i * 7919) % 5000;
+
+		l = sms_assembly_add_fragment(assembly, &sms, ts, &addr,
+						i % 256, 3, 3);
+
+		if (ts - base < 2500) {
+			g_assert(l == NULL);
+			continue;
+		}
+
+		g_assert(l != NULL);
+
+		g_slist_foreach(l, (GFunc) g_free, NULL);
+		g_slist_free(l);
+	}
+
+	g_assert(g_hash_table_size(assembly->assembly_table) == expired);
+
+	sms_assembly_expire(assembly, base + 5000);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 0);
+
+	sms_assembly_free(assembly);
+}
+
 static void test_serialize_assembly(void)
 {
 	unsigned char pdu[176];
@@ -1414,7 +1535,7 @@ static void test_serialize_assembly(void)
 				sms_address_to_string(&sms.deliver.oaddr));
 	}
 
-	g_assert(g_slist_length(assembly->assembly_list) == 1);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
 	g_assert(l == NULL);
 
 	decode_hex_own_buf(assembly_pdu2, -1, &pdu_len, 0, pdu);
@@ -1441,6 +1562,187 @@ static void test_serialize_assembly(void)
 	sms_assembly_free(assembly);
 }
 
+#define JOURNAL_IMSI "journal"
+
+static char *journal_path;
+static char *legacy_path;
+
+static void journal_fragment(const char *hex, int tpdu_len,
+				unsigned char *pdu, long *pdu_len,
+				struct sms *sms, guint16 *ref, guint8 *max,
+				guint8 *seq)
+{
+	decode_hex_own_buf(hex, -1, pdu_len, 0, pdu);
+	g_assert(sms_decode(pdu, *pdu_len, FALSE, tpdu_len, sms));
+	g_assert(sms_extract_concatenation(sms, ref, max, seq));
+}
+
+static void test_assembly_journal(void)
+{
+	unsigned char pdu[177];
+	long pdu_len;
+	struct sms sms;
+	struct sms_assembly *assembly;
+	DECLARE_SMS_ADDR_STR(straddr);
+	struct stat st;
+	guint16 ref;
+	guint8 max;
+	guint8 seq;
+	GSList *l;
+	FILE *f;
+	int i;
+
+	unlink(journal_path);
+
+	/* A fragment backed up the old way is taken over */
+	journal_fragment(assembly_pdu1, assembly_pdu_len1, pdu + 1, &pdu_len,
+				&sms, &ref, &max, &seq);
+	pdu[0] = assembly_pdu_len1;
+	g_assert(sms_address_to_hex_string(&sms.deliver.oaddr, straddr));
+	g_assert(write_file(pdu, pdu_len + 1, 0600,
+				"%s/%s-%i-%i/%03i", legacy_path,
+				straddr, ref, max, seq) == pdu_len + 1);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
+	g_assert(stat(legacy_path, &st) != 0);
+	g_assert(stat(journal_path, &st) == 0);
+	sms_assembly_free(assembly);
+
+	/* Fragments come back from the journal alone */
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
+
+	journal_fragment(assembly_pdu2, assembly_pdu_len2, pdu, &pdu_len,
+				&sms, &ref, &max, &seq);
+	l = sms_assembly_add_fragment(assembly, &sms, time(NULL),
+					&sms.deliver.oaddr, ref, max, seq);
+	g_assert(l == NULL);
+	sms_assembly_free(assembly);
+
+	/* A torn record at the end is left out */
+	f = fopen(journal_path, "a");
+	g_assert(f != NULL);
+	fputs("F\x0b", f);
+	fclose(f);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 1);
+
+	journal_fragment(assembly_pdu3, assembly_pdu_len3, pdu, &pdu_len,
+				&sms, &ref, &max, &seq);
+	l = sms_assembly_add_fragment(assembly, &sms, time(NULL),
+					&sms.deliver.oaddr, ref, max, seq);
+	g_assert(l != NULL);
+	g_assert(g_slist_length(l) == 3);
+
+	g_slist_foreach(l, (GFunc) g_free, NULL);
+	g_slist_free(l);
+	sms_assembly_free(assembly);
+
+	/* Messages dropped along the way are compacted out */
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 0);
+
+	journal_fragment(assembly_pdu1, assembly_pdu_len1, pdu, &pdu_len,
+				&sms, &ref, &max, &seq);
+
+	for (i = 0; i < 200; i++) {
+		l = sms_assembly_add_fragment(assembly, &sms, 1000 + i,
+						&sms.deliver.oaddr, i, max,
+						seq);
+		g_assert(l == NULL);
+	}
+
+	sms_assembly_expire(assembly, 1000 + 149);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 50);
+	g_assert(assembly->journal_records < 200);
+	sms_assembly_free(assembly);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 50);
+	g_assert(assembly->journal_records == 50);
+
+	sms_assembly_expire(assembly, 1000 + 199);
+	sms_assembly_free(assembly);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 0);
+	sms_assembly_free(assembly);
+
+	g_assert(stat(journal_path, &st) == 0);
+	g_assert(st.st_size == 0);
+
+	unlink(journal_path);
+}
+
+static void journal_record(const char *hex, int tpdu_len, guint16 ref,
+				GString *journal)
+{
+	unsigned char pdu[177];
+	long pdu_len;
+	struct sms sms;
+	struct sms_assembly *assembly;
+	guint16 orig_ref;
+	guint8 max;
+	guint8 seq;
+	gchar *contents;
+	gsize size;
+
+	unlink(journal_path);
+
+	journal_fragment(hex, tpdu_len, pdu, &pdu_len, &sms, &orig_ref,
+				&max, &seq);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(sms_assembly_add_fragment(assembly, &sms, time(NULL),
+						&sms.deliver.oaddr, ref, max,
+						seq) == NULL);
+	sms_assembly_free(assembly);
+
+	g_assert(g_file_get_contents(journal_path, &contents, &size, NULL));
+	g_string_append_len(journal, contents, size);
+	g_free(contents);
+}
+
+static void test_assembly_journal_replay(void)
+{
+	GString *journal = g_string_new(NULL);
+	struct sms_assembly *assembly;
+	int i;
+
+	/*
+	 * All fragments of a message, with no drop record after them, and
+	 * enough records before for a compaction to be due on the way
+	 */
+	for (i = 0; i < 70; i++)
+		journal_record(assembly_pdu1, assembly_pdu_len1, i, journal);
+
+	journal_record(assembly_pdu1, assembly_pdu_len1, 500, journal);
+	journal_record(assembly_pdu2, assembly_pdu_len2, 500, journal);
+	journal_record(assembly_pdu3, assembly_pdu_len3, 500, journal);
+	journal_record(assembly_pdu1, assembly_pdu_len1, 600, journal);
+
+	g_assert(g_file_set_contents(journal_path, journal->str,
+					journal->len, NULL));
+
+	/* Completing the message leaves the journal to the compaction */
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 71);
+	g_assert(assembly->journal_records == 71);
+	g_assert(assembly->journal_live == 71);
+	sms_assembly_free(assembly);
+
+	assembly = sms_assembly_new(JOURNAL_IMSI);
+	g_assert(g_hash_table_size(assembly->assembly_table) == 71);
+	g_assert(assembly->journal_records == 71);
+	sms_assembly_expire(assembly, time(NULL) + 1);
+	sms_assembly_free(assembly);
+
+	g_string_free(journal, TRUE);
+	unlink(journal_path);
+}
+
 static const char *ranges[] = { "1-5, 2, 3, 600, 569-900, 999",
 				"0-20, 33, 44, 50-60, 20-50, 1-5, 5, 3, 5",
 				NULL };
@@ -1661,13 +1963,44 @@ static void test_wap_push(gconstpointer data)
 	g_slist_free(list);
 }
 
+static void remove_tree(const char *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+
+	if (dir != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			char *child = g_build_filename(path, name, NULL);
+
+			remove_tree(child);
+			g_free(child);
+		}
+
+		g_dir_close(dir);
+	}
+
+	remove(path);
+}
+
 int main(int argc, char **argv)
 {
 	char long_string[152*33 + 1];
 	struct sms_concat_data long_string_test;
+	char *root;
+	int ret;
 
 	g_test_init(&argc, &argv, NULL);
 
+	/* Keep the backups the tests create out of the real STORAGEDIR */
+	root = g_build_filename(g_get_tmp_dir(), "test-sms-XXXXXX", NULL);
+	g_assert(g_mkdtemp(root) != NULL);
+	storage_set_root(root);
+
+	journal_path = g_strdup_printf("%s/" JOURNAL_IMSI
+					"/sms_assembly_journal", root);
+	legacy_path = g_strdup_printf("%s/" JOURNAL_IMSI "/sms_assembly",
+					root);
+
 	g_test_add_func("/testsms/Test Simple Deliver", test_simple_deliver);
 	g_test_add_func("/testsms/Test Alnum Deliver", test_alnum_sender);
 	g_test_add_func("/testsms/Test Deliver Encode", test_deliver_encode);
@@ -1708,6 +2041,7 @@ int main(int argc, char **argv)
 			&ems_udh_test_2, test_ems_udh);
 
 	g_test_add_func("/testsms/Test Assembly", test_assembly);
+	g_test_add_func("/testsms/Test Assembly Stress", test_assembly_stress);
 	g_test_add_func("/testsms/Test Prepare 7Bit", test_prepare_7bit);
 
 	g_test_add_data_func("/testsms/Test Prepare Concat",
@@ -1726,6 +2060,7 @@ int main(int argc, char **argv)
 			&long_string_test, test_prepare_concat);
 
 	g_test_add_func("/testsms/Test Prepare Limits", test_prepare_limits);
+	g_test_add_func("/testsms/Test Prepare Dialect", test_prepare_dialect);
 
 	g_test_add_func("/testsms/Test CBS Encode / Decode",
 			test_cbs_encode_decode);
@@ -1733,6 +2068,10 @@ int main(int argc, char **argv)
 
 	g_test_add_func("/testsms/Test SMS Assembly Serialize",
 			test_serialize_assembly);
+	g_test_add_func("/testsms/Test SMS Assembly Journal",
+			test_assembly_journal);
+	g_test_add_func("/testsms/Test SMS Assembly Journal Replay",
+			test_assembly_journal_replay);
 
 	g_test_add_func("/testsms/Range minimizer", test_range_minimizer);
 
@@ -1741,5 +2080,13 @@ int main(int argc, char **argv)
 	g_test_add_data_func("/testsms/Test WAP Push 1", &wap_push_1,
 				test_wap_push);
 
-	return g_test_run();
+	ret = g_test_run();
+
+	storage_set_root(NULL);
+	remove_tree(root);
+	g_free(legacy_path);
+	g_free(journal_path);
+	g_free(root);
+
+	return ret;
 }
@@ -676,6 +676,211 @@ static void test_pack_size(void)
 	g_free(packed);
 }
 
+/* The octet at a time loops the grouped versions in util.c must match */
+static unsigned char *ref_unpack_7bit(const unsigned char *in, long len,
+					int byte_offset, gboolean ussd,
+					long max_to_unpack, long *items_written,
+					unsigned char terminator,
+					unsigned char *buf)
+{
+	unsigned char rest = 0;
+	unsigned char *out = buf;
+	int bits = 7 - (byte_offset % 7);
+	long i;
+
+	if (len <= 0)
+		return NULL;
+
+	/* In the case of CB, unpack as much as possible */
+	if (ussd == TRUE)
+		max_to_unpack = len * 8 / 7;
+
+	for (i = 0; (i < len) && ((out-buf) < max_to_unpack); i++) {
+		/* Grab what we have in the current octet */
+		*out = (in[i] & ((1 << bits) - 1)) << (7 - bits);
+
+		/* Append what we have from the previous octet, if any */
+		*out |= rest;
+
+		/* Figure out the remainder */
+		rest = (in[i] >> bits) & ((1 << (8-bits)) - 1);
+
+		/*
+		 * We have the entire character, here we don't increate
+		 * out if this is we started at an offset.  Instead
+		 * we effectively populate variable rest
+		 */
+		if (i != 0 || bits == 7)
+			out++;
+
+		if ((out-buf) == max_to_unpack)
+			break;
+
+		/*
+		 * We expected only 1 bit from this octet, means there's 7
+		 * left, take care of them here
+		 */
+		if (bits == 1) {
+			*out = rest;
+			out++;
+			bits = 7;
+			rest = 0;
+		} else {
+			bits = bits - 1;
+		}
+	}
+
+	/*
+	 * According to 23.038 6.1.2.3.1, last paragraph:
+	 * "If the total number of characters to be sent equals (8n-1)
+	 * where n=1,2,3 etc. then there are 7 spare bits at the end
+	 * of the message. To avoid the situation where the receiving
+	 * entity confuses 7 binary zero pad bits as the @ character,
+	 * the carriage return or <CR> character shall be used for
+	 * padding in this situation, just as for Cell Broadcast."
+	 *
+	 * "The receiving entity shall remove the final <CR> character where
+	 * the message ends on an octet boundary with <CR> as the last
+	 * character.
+	 */
+	if (ussd && (((out - buf) % 8) == 0) && (*(out - 1) == '\r'))
+		out = out - 1;
+
+	if (terminator)
+		*out = terminator;
+
+	if (items_written)
+		*items_written = out - buf;
+
+	return buf;
+}
+
+static unsigned char *ref_pack_7bit(const unsigned char *in, long len,
+					int byte_offset, gboolean ussd,
+					long *items_written,
+					unsigned char terminator,
+					unsigned char *buf)
+{
+	int bits = 7 - (byte_offset % 7);
+	unsigned char *out = buf;
+	long i;
+	long total_bits;
+
+	if (len == 0)
+		return NULL;
+
+	if (len < 0) {
+		i = 0;
+
+		while (in[i] != terminator)
+			i++;
+
+		len = i;
+	}
+
+	total_bits = len * 7;
+
+	if (bits != 7) {
+		total_bits += bits;
+		bits = bits - 1;
+		*out = 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		if (bits != 7) {
+			*out |= (in[i] & ((1 << (7 - bits)) - 1)) <<
+					(bits + 1);
+			out++;
+		}
+
+		/* This is a no op when bits == 0, lets keep valgrind happy */
+		if (bits != 0)
+			*out = in[i] >> (7 - bits);
+
+		if (bits == 0)
+			bits = 7;
+		else
+			bits = bits - 1;
+	}
+
+	/*
+	 * If <CR> is intended to be the last character and the message
+	 * (including the wanted <CR>) ends on an octet boundary, then
+	 * another <CR> must be added together with a padding bit 0. The
+	 * receiving entity will perform the carriage return function twice,
+	 * but this will not result in misoperation as the definition of
+	 * <CR> in clause 6.1.1 is identical to the definition of <CR><CR>.
+	 */
+	if (ussd && ((total_bits % 8) == 1))
+		*out |= '\r' << 1;
+
+	if (bits != 7)
+		out++;
+
+	if (ussd && ((total_bits % 8) == 0) && (in[len - 1] == '\r')) {
+		*out = '\r';
+		out++;
+	}
+
+	if (items_written)
+		*items_written = out - buf;
+
+	return buf;
+}
+
+static void test_pack_groups(void)
+{
+	GRand *rand = g_rand_new_with_seed(7);
+	unsigned char septets[64];
+	unsigned char octets[64];
+	unsigned char expect[80];
+	unsigned char result[80];
+	long expect_len;
+	long result_len;
+	gboolean ussd;
+	int offset;
+	int len;
+	int i;
+
+	for (offset = 0; offset < 7; offset++) {
+		for (len = 1; len <= 48; len++) {
+			for (i = 0; i < len; i++)
+				septets[i] = g_rand_int_range(rand, 0, 0x80);
+
+			/* Exercise the <CR> padding rules as well */
+			if (len % 3 == 0)
+				septets[len - 1] = '\r';
+
+			/* USSD never has a header in front of it */
+			ussd = offset == 0 && len % 2;
+
+			memset(expect, 0, sizeof(expect));
+			memset(result, 0, sizeof(result));
+
+			ref_pack_7bit(septets, len, offset, ussd,
+					&expect_len, 0, expect);
+			pack_7bit_own_buf(septets, len, offset, ussd,
+					&result_len, 0, result);
+
+			g_assert(result_len == expect_len);
+			g_assert(memcmp(result, expect, expect_len) == 0);
+
+			for (i = 0; i < len; i++)
+				octets[i] = g_rand_int_range(rand, 0, 0x100);
+
+			ref_unpack_7bit(octets, len, offset, ussd, len,
+					&expect_len, 0, expect);
+			unpack_7bit_own_buf(octets, len, offset, ussd, len,
+					&result_len, 0, result);
+
+			g_assert(result_len == expect_len);
+			g_assert(memcmp(result, expect, expect_len) == 0);
+		}
+	}
+
+	g_rand_free(rand);
+}
+
 static void test_cr_handling(void)
 {
 	unsigned char c7[] = { 'a', 'b', 'c', 'd', 'e', 'f', 'g' };
@@ -991,6 +1196,47 @@ static void test_unicode_to_gsm(void)
 	}
 }
 
+static void test_gsm_candidates(void)
+{
+	enum gsm_dialect locking[GSM_DIALECT_CANDIDATES];
+	enum gsm_dialect single[GSM_DIALECT_CANDIDATES];
+	long septets[GSM_DIALECT_CANDIDATES];
+	int n;
+
+	/* Plain text only needs the default tables */
+	n = utf8_to_gsm_candidates("a{", -1, GSM_DIALECT_DEFAULT,
+					locking, single, septets);
+	g_assert(n == 1);
+	g_assert(septets[0] == 3);
+
+	n = utf8_to_gsm_candidates("a{", -1, GSM_DIALECT_TURKISH,
+					locking, single, septets);
+	g_assert(n == 3);
+	g_assert(locking[0] == GSM_DIALECT_DEFAULT);
+	g_assert(single[0] == GSM_DIALECT_DEFAULT);
+	g_assert(single[1] == GSM_DIALECT_TURKISH);
+	g_assert(locking[2] == GSM_DIALECT_TURKISH);
+
+	/* s-cedilla is an escape in the single shift table only */
+	n = utf8_to_gsm_candidates("a\xc5\x9f", -1, GSM_DIALECT_TURKISH,
+					locking, single, septets);
+	g_assert(n == 2);
+	g_assert(locking[0] == GSM_DIALECT_DEFAULT);
+	g_assert(single[0] == GSM_DIALECT_TURKISH);
+	g_assert(septets[0] == 3);
+	g_assert(locking[1] == GSM_DIALECT_TURKISH);
+	g_assert(septets[1] == 2);
+
+	/* Spanish has no locking shift table of its own */
+	n = utf8_to_gsm_candidates("a", -1, GSM_DIALECT_SPANISH,
+					locking, single, septets);
+	g_assert(n == 2);
+
+	n = utf8_to_gsm_candidates("\xd0\x96", -1, GSM_DIALECT_TURKISH,
+					locking, single, septets);
+	g_assert(n == 0);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -1001,10 +1247,13 @@ int main(int argc, char **argv)
 			test_valid_turkish);
 	g_test_add_func("/testutil/Decode Encode", test_decode_encode);
 	g_test_add_func("/testutil/Pack Size", test_pack_size);
+	g_test_add_func("/testutil/Pack Groups", test_pack_groups);
 	g_test_add_func("/testutil/CBS CR Handling", test_cr_handling);
 	g_test_add_func("/testutil/SMS Handling", test_sms_handling);
 	g_test_add_func("/testutil/Offset Handling", test_offset_handling);
 	g_test_add_func("/testutil/SIM conversions", test_sim);
+	g_test_add_func("/testutil/GSM dialect candidates",
+			test_gsm_candidates);
 	g_test_add_func("/testutil/Valid Unicode to GSM Conversion",
 			test_unicode_to_gsm);
 